@@ -0,0 +1,591 @@
+#include "ofMain.h"
+#include "ofxPerceptionNeuron.h"
+#include "ofxBvhMod.h"
+#include "ofxBvhKernels.h"
+#include "SkeletonRenderer.h"
+#include "StreamDecoder.h"
+#include "BvhTemplate.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <new>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Headless benchmarks of the receive path, on synthetic frames of the Axis
+// Neuron template (BvhTemplate.h). No window or GL context is created.
+//
+//   example-benchmark [--avatars 1,8,32,128] [--iterations 200] [--out results.json]
+//
+// Each benchmark runs once per avatar count and reports, per frame (or per
+// lookup / skeleton, see "per"), the median and fastest time in ns, heap
+// allocations, and last level cache misses where the kernel lets us count
+// them (null otherwise). Results go to stdout as JSON, and to --out if given.
+// kernel_* entries time the ofxBvhKernels kernels alone, once for every
+// instruction set the CPU supports (named "<kernel>/<isa>").
+
+using namespace ofxPerceptionNeuron;
+
+#pragma mark - allocation counting
+
+static std::atomic<uint64_t> num_allocations(0);
+
+void* operator new(size_t size)
+{
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+#pragma mark - cache misses
+
+// hardware cache misses of the calling thread, user space only
+class CacheMissCounter
+{
+public:
+    CacheMissCounter()
+    {
+#if defined(__linux__)
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    
+    ~CacheMissCounter()
+    {
+#if defined(__linux__)
+        if (fd >= 0) {
+            ::close(fd);
+        }
+#endif
+    }
+    
+    bool isAvailable() const { return fd >= 0; }
+    
+    void start()
+    {
+#if defined(__linux__)
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+    
+    uint64_t stop()
+    {
+        uint64_t count = 0;
+#if defined(__linux__)
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+                count = 0;
+            }
+        }
+#endif
+        return count;
+    }
+
+protected:
+    int fd = -1;
+};
+
+#pragma mark - measurement
+
+struct Result
+{
+    string name;
+    string per;
+    int avatars;
+    double ns_median;
+    double ns_min;
+    double allocations;
+    double cache_misses; // < 0 if not available
+};
+
+struct Settings
+{
+    vector<int> avatars = {1, 8, 32, 128};
+    int iterations = 200;
+    string out;
+};
+
+static const int WARMUP_ITERATIONS = 10;
+// AvatarIndex values a DataReader keeps per server
+static const int MAX_AVATARS = 128;
+
+// Times body() settings.iterations times, after a warm-up. prepare() runs
+// before each body() and isn't counted. Figures are per op, body() doing
+// ops of them per call.
+template<typename Prepare, typename Body>
+static Result measure(const Settings& settings, CacheMissCounter& counter, const string& name, const string& per,
+                      int avatars, uint64_t ops, Prepare prepare, Body body)
+{
+    for (int i=0; i<WARMUP_ITERATIONS; ++i) {
+        prepare();
+        body();
+    }
+    
+    vector<uint64_t> times;
+    uint64_t allocations = 0;
+    uint64_t misses = 0;
+    for (int i=0; i<settings.iterations; ++i) {
+        prepare();
+        const uint64_t a = num_allocations.load(std::memory_order_relaxed);
+        counter.start();
+        const auto t0 = std::chrono::steady_clock::now();
+        body();
+        const auto t1 = std::chrono::steady_clock::now();
+        misses += counter.stop();
+        allocations += num_allocations.load(std::memory_order_relaxed) - a;
+        times.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+    }
+    sort(times.begin(), times.end());
+    
+    const double total_ops = double(ops) * settings.iterations;
+    Result r;
+    r.name = name;
+    r.per = per;
+    r.avatars = avatars;
+    r.ns_median = double(times[times.size() / 2]) / ops;
+    r.ns_min = double(times.front()) / ops;
+    r.allocations = allocations / total_ops;
+    r.cache_misses = counter.isAvailable() ? misses / total_ops : -1;
+    return r;
+}
+
+#pragma mark - synthetic frames
+
+static const int FRAMES_PER_AVATAR = 16;
+
+// template positions and a sway on every rotation, different per avatar and frame
+static void makeFrame(int avatar, int frame, vector<float>& data)
+{
+    data.resize(NeuronSkeleton::NUM_CHANNELS);
+    for (int k=0; k<NeuronSkeleton::NUM_ROTATIONS; ++k) {
+        const int j = NeuronSkeleton::rotation_joints[k];
+        float* v = &data[k * NeuronSkeleton::CHANNELS_PER_JOINT];
+        const float phase = 0.1f * frame + 0.7f * k + 1.3f * avatar;
+        v[0] = NeuronSkeleton::offsets[j][0];
+        v[1] = NeuronSkeleton::offsets[j][1];
+        v[2] = NeuronSkeleton::offsets[j][2];
+        v[3] = 30 * sinf(phase);
+        v[4] = 20 * sinf(1.3f * phase);
+        v[5] = 10 * cosf(phase);
+    }
+}
+
+static BvhDataHeader makeHeader(int avatar, uint32_t frame_index)
+{
+    BvhDataHeader h;
+    memset(&h, 0, sizeof(h));
+    h.Token1 = StreamDecoder::BVH_TOKEN_BEGIN;
+    h.Token2 = StreamDecoder::BVH_TOKEN_END;
+    h.DataVersion.Major = 1;
+    h.DataCount = NeuronSkeleton::NUM_CHANNELS;
+    h.WithDisp = 1;
+    h.AvatarIndex = avatar;
+    snprintf(reinterpret_cast<char*>(h.AvatarName), sizeof(h.AvatarName), "Avatar%d", avatar);
+    h.FrameIndex = frame_index;
+    return h;
+}
+
+struct Frames
+{
+    vector<vector<float> > data; // [avatar * FRAMES_PER_AVATAR + frame]
+    vector<BvhDataHeader> headers; // per avatar, FrameIndex advanced by next()
+    uint32_t frame_index = 0;
+    
+    explicit Frames(int avatars) : data(avatars * FRAMES_PER_AVATAR)
+    {
+        for (int a=0; a<avatars; ++a) {
+            headers.push_back(makeHeader(a, 0));
+            for (int f=0; f<FRAMES_PER_AVATAR; ++f) {
+                makeFrame(a, f, data[a * FRAMES_PER_AVATAR + f]);
+            }
+        }
+    }
+    
+    void next()
+    {
+        ++frame_index;
+        for (auto& h : headers) {
+            h.FrameIndex = frame_index;
+        }
+    }
+    
+    const vector<float>& get(int avatar) const
+    {
+        return data[avatar * FRAMES_PER_AVATAR + frame_index % FRAMES_PER_AVATAR];
+    }
+};
+
+#pragma mark - benchmarks
+
+static void countFrame(void* user, const BvhDataHeader*, const float*)
+{
+    ++*static_cast<uint64_t*>(user);
+}
+
+// the bytes a server sends for one frame of every avatar, through StreamDecoder
+static Result benchDecode(const Settings& settings, CacheMissCounter& counter, int avatars)
+{
+    Frames frames(avatars);
+    vector<uint8_t> stream;
+    for (int a=0; a<avatars; ++a) {
+        const uint8_t* h = reinterpret_cast<const uint8_t*>(&frames.headers[a]);
+        const uint8_t* v = reinterpret_cast<const uint8_t*>(frames.get(a).data());
+        stream.insert(stream.end(), h, h + sizeof(BvhDataHeader));
+        stream.insert(stream.end(), v, v + NeuronSkeleton::NUM_CHANNELS * sizeof(float));
+    }
+    StreamDecoder decoder;
+    uint64_t decoded = 0;
+    decoder.setBvhFrameHandler(countFrame, &decoded);
+    return measure(settings, counter, "decode", "frame", avatars, avatars, [] {}, [&] {
+        // as a socket would deliver it: as much as fits per read
+        size_t offset = 0;
+        while (offset < stream.size()) {
+            const size_t n = min(decoder.writable(), stream.size() - offset);
+            memcpy(decoder.writePtr(), stream.data() + offset, n);
+            decoder.commit(n);
+            offset += n;
+        }
+    });
+}
+
+// DataReader's receive thread handler, through receiveFrame()
+static Result benchIngest(const Settings& settings, CacheMissCounter& counter, int avatars)
+{
+    Frames frames(avatars);
+    DataReader reader;
+    return measure(settings, counter, "ingest", "frame", avatars, avatars, [&] { frames.next(); }, [&] {
+        for (int a=0; a<avatars; ++a) {
+            reader.receiveFrame(0, frames.headers[a], frames.get(a).data());
+        }
+    });
+}
+
+// DataReader::update() with a new frame for every avatar: pick up, forward
+// kinematics into the skeletons' pose buffers, stats
+static Result benchReaderUpdate(const Settings& settings, CacheMissCounter& counter, int avatars)
+{
+    Frames frames(avatars);
+    DataReader reader;
+    return measure(settings, counter, "reader_update", "frame", avatars, avatars, [&] {
+        frames.next();
+        for (int a=0; a<avatars; ++a) {
+            reader.receiveFrame(0, frames.headers[a], frames.get(a).data());
+        }
+    }, [&] {
+        reader.update();
+    });
+}
+
+// the generic path: ofxBvh on the hierarchy parsed from BvhTemplate.h
+static vector<Result> benchBvhUpdate(const Settings& settings, CacheMissCounter& counter, int avatars)
+{
+    Frames frames(avatars);
+    const ofxBvhHierarchyRef hierarchy = ofxBvhHierarchy::parse(bvh_header_template);
+    vector<unique_ptr<ofxBvh> > bvhs;
+    for (int a=0; a<avatars; ++a) {
+        bvhs.push_back(unique_ptr<ofxBvh>(new ofxBvh(hierarchy)));
+    }
+    vector<Result> results;
+    results.push_back(measure(settings, counter, "bvh_update", "frame", avatars, avatars, [&] { frames.next(); }, [&] {
+        for (int a=0; a<avatars; ++a) {
+            bvhs[a]->update(frames.get(a));
+        }
+    }));
+    // the recursive ofMatrix4x4 solver ofxBvhSolver replaced, for comparison
+    results.push_back(measure(settings, counter, "bvh_update_recursive", "frame", avatars, avatars, [&] { frames.next(); }, [&] {
+        for (int a=0; a<avatars; ++a) {
+            bvhs[a]->updateRecursive(frames.get(a));
+        }
+    }));
+    return results;
+}
+
+// a reader with one frame of every avatar received and picked up
+static void fillReader(DataReader& reader, int avatars)
+{
+    Frames frames(avatars);
+    for (int a=0; a<avatars; ++a) {
+        reader.receiveFrame(0, frames.headers[a], frames.get(a).data());
+    }
+    reader.update();
+}
+
+static vector<Result> benchLookups(const Settings& settings, CacheMissCounter& counter, int avatars)
+{
+    DataReader reader;
+    fillReader(reader, avatars);
+    const vector<Skeleton>& skeletons = reader.getSkeletons();
+    
+    // names held as strings, as scripts keep them
+    vector<string> joint_names(NeuronSkeleton::names, NeuronSkeleton::names + NeuronSkeleton::NUM_JOINTS);
+    vector<string> skeleton_names;
+    for (const auto& s : skeletons) {
+        skeleton_names.push_back(s.getQualifiedName());
+    }
+    const uint64_t joint_lookups = uint64_t(skeletons.size()) * joint_names.size();
+    volatile int sink = 0;
+    
+    vector<Result> results;
+    results.push_back(measure(settings, counter, "lookup_joint", "lookup", avatars, joint_lookups, [] {}, [&] {
+        for (const auto& s : skeletons) {
+            for (const auto& name : joint_names) {
+                sink = sink + s.findJoint(name);
+            }
+        }
+    }));
+    // the hierarchy's std::map, for comparison
+    results.push_back(measure(settings, counter, "lookup_joint_map", "lookup", avatars, joint_lookups, [] {}, [&] {
+        for (const auto& s : skeletons) {
+            for (const auto& name : joint_names) {
+                sink = sink + s.getHierarchy()->findJoint(name);
+            }
+        }
+    }));
+    results.push_back(measure(settings, counter, "lookup_skeleton", "lookup", avatars, skeleton_names.size(), [] {}, [&] {
+        for (const auto& name : skeleton_names) {
+            sink = sink + reader.findSkeleton(name);
+        }
+    }));
+    return results;
+}
+
+// SkeletonRenderer's CPU side: every skeleton into one mesh
+static Result benchRenderBuild(const Settings& settings, CacheMissCounter& counter, int avatars)
+{
+    DataReader reader;
+    fillReader(reader, avatars);
+    SkeletonRenderer renderer;
+    ofMatrix4x4 camera;
+    camera.glTranslate(ofVec3f(0, 100, 300));
+    return measure(settings, counter, "render_build", "skeleton", avatars, avatars, [] {}, [&] {
+        renderer.begin(camera);
+        for (const auto& s : reader.getSkeletons()) {
+            renderer.add(s);
+        }
+    });
+}
+
+// every instruction set this CPU runs, scalar first
+static vector<ofxBvhKernels::ISA> getIsas()
+{
+    vector<ofxBvhKernels::ISA> isas(1, ofxBvhKernels::ISA_SCALAR);
+    const ofxBvhKernels::ISA best = ofxBvhKernels::getBestIsa();
+    if (best == ofxBvhKernels::ISA_NEON) {
+        isas.push_back(best);
+    } else {
+        for (int isa=ofxBvhKernels::ISA_SSE2; isa<=best; ++isa) {
+            isas.push_back(ofxBvhKernels::ISA(isa));
+        }
+    }
+    return isas;
+}
+
+// the SIMD kernels on their own, once per instruction set; names end in "/<isa>"
+static vector<Result> benchKernels(const Settings& settings, CacheMissCounter& counter, int avatars)
+{
+    Frames frames(avatars);
+    ofxBvhSolver solver(ofxBvhHierarchy::parse(bvh_header_template));
+    vector<const float*> data(avatars);
+    for (int a=0; a<avatars; ++a) {
+        data[a] = frames.get(a).data();
+    }
+    vector<float> globals(avatars * solver.getNumJoints() * 16);
+    
+    // one Euler triple per joint with channels
+    const size_t rotations = size_t(avatars) * NeuronSkeleton::NUM_ROTATIONS;
+    vector<float> angles(3 * rotations), quats(4 * rotations);
+    for (size_t i=0; i<angles.size(); ++i) {
+        angles[i] = data[i % avatars][i % NeuronSkeleton::NUM_CHANNELS];
+    }
+    
+    // one matrix per joint, composed with its parent's
+    const size_t matrices = size_t(avatars) * NeuronSkeleton::NUM_JOINTS;
+    vector<float> local(ofxBvhKernels::SOA_COMPONENTS * matrices), parent(local.size()), global(local.size());
+    for (size_t i=0; i<local.size(); ++i) {
+        local[i] = sinf(0.1f * i);
+        parent[i] = cosf(0.3f * i);
+    }
+    
+    // 1024 vertices per avatar, 4 bones each
+    const size_t vertices = size_t(avatars) * 1024;
+    const int influences = 4;
+    vector<float> skin(NeuronSkeleton::NUM_JOINTS * ofxBvhKernels::SOA_COMPONENTS);
+    for (size_t i=0; i<skin.size(); ++i) {
+        skin[i] = sinf(0.7f * i);
+    }
+    vector<uint16_t> bones(influences * vertices);
+    vector<float> weights(influences * vertices, 1.f / influences);
+    for (size_t i=0; i<bones.size(); ++i) {
+        bones[i] = uint16_t((i * 7919) % NeuronSkeleton::NUM_JOINTS);
+    }
+    vector<float> pos(3 * vertices), out_pos(pos.size()), normals(pos.size()), out_normals(pos.size());
+    for (size_t i=0; i<pos.size(); ++i) {
+        pos[i] = sinf(0.01f * i) * 100;
+        normals[i] = cosf(0.01f * i);
+    }
+    
+    vector<Result> results;
+    const ofxBvhKernels::ISA previous = ofxBvhKernels::getIsa();
+    for (ofxBvhKernels::ISA isa : getIsas()) {
+        ofxBvhKernels::setIsa(isa);
+        const string suffix = string("/") + ofxBvhKernels::getIsaName(isa);
+        results.push_back(measure(settings, counter, "kernel_solve_batch" + suffix, "frame", avatars, avatars, [] {}, [&] {
+            solver.solveBatch(data.data(), avatars, globals.data(), ofxBvhSolver::BATCH_AVATAR_MAJOR);
+        }));
+        results.push_back(measure(settings, counter, "kernel_euler_to_quat" + suffix, "joint", avatars, rotations, [] {}, [&] {
+            ofxBvhKernels::eulerYXZToQuat(&angles[0], &angles[rotations], &angles[2 * rotations], &quats[0],
+                                          &quats[rotations], &quats[2 * rotations], &quats[3 * rotations], rotations);
+        }));
+        results.push_back(measure(settings, counter, "kernel_compose_affine" + suffix, "matrix", avatars, matrices, [] {}, [&] {
+            ofxBvhKernels::composeAffineSoA(global.data(), local.data(), parent.data(), matrices, matrices);
+        }));
+        results.push_back(measure(settings, counter, "kernel_skin" + suffix, "vertex", avatars, vertices, [] {}, [&] {
+            ofxBvhKernels::skinLinearBlendSoA(skin.data(), bones.data(), weights.data(), influences, pos.data(),
+                                              out_pos.data(), normals.data(), out_normals.data(), vertices, vertices);
+        }));
+    }
+    ofxBvhKernels::setIsa(previous);
+    return results;
+}
+
+#pragma mark - output
+
+static string toJson(const Settings& settings, bool have_cache_misses, const vector<Result>& results)
+{
+    ostringstream out;
+    out.precision(6);
+    out << "{\n";
+    out << "  \"suite\": \"ofxPerceptionNeuron\",\n";
+#if defined(__VERSION__)
+    out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+#endif
+    out << "  \"isa\": \"" << ofxBvhKernels::getIsaName(ofxBvhKernels::getIsa()) << "\",\n";
+    out << "  \"iterations\": " << settings.iterations << ",\n";
+    out << "  \"cache_misses_available\": " << (have_cache_misses ? "true" : "false") << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i=0; i<results.size(); ++i) {
+        const Result& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"avatars\": " << r.avatars
+            << ", \"per\": \"" << r.per << "\""
+            << ", \"ns_median\": " << r.ns_median
+            << ", \"ns_min\": " << r.ns_min
+            << ", \"allocations\": " << r.allocations
+            << ", \"cache_misses\": ";
+        if (r.cache_misses < 0) {
+            out << "null";
+        } else {
+            out << r.cache_misses;
+        }
+        out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+    return out.str();
+}
+
+static bool parseArguments(int argc, char** argv, Settings& settings)
+{
+    for (int i=1; i<argc; ++i) {
+        const string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--avatars") {
+            settings.avatars.clear();
+            char* end = const_cast<char*>(value);
+            while (*end) {
+                const long n = strtol(end, &end, 10);
+                if (n < 1 || n > MAX_AVATARS) {
+                    return false;
+                }
+                settings.avatars.push_back(int(n));
+                if (*end == ',') {
+                    ++end;
+                } else if (*end) {
+                    return false;
+                }
+            }
+        } else if (arg == "--iterations") {
+            settings.iterations = max(1, atoi(value));
+        } else if (arg == "--out") {
+            settings.out = value;
+        } else {
+            return false;
+        }
+    }
+    return !settings.avatars.empty();
+}
+
+//========================================================================
+int main(int argc, char** argv)
+{
+    Settings settings;
+    if (!parseArguments(argc, argv, settings)) {
+        fprintf(stderr, "usage: %s [--avatars 1,8,32,128] [--iterations 200] [--out results.json]\n", argv[0]);
+        return 1;
+    }
+    ofSetLogLevel(OF_LOG_WARNING);
+    
+    CacheMissCounter counter;
+    vector<Result> results;
+    for (int avatars : settings.avatars) {
+        results.push_back(benchDecode(settings, counter, avatars));
+        results.push_back(benchIngest(settings, counter, avatars));
+        results.push_back(benchReaderUpdate(settings, counter, avatars));
+        const vector<Result> bvh_updates = benchBvhUpdate(settings, counter, avatars);
+        results.insert(results.end(), bvh_updates.begin(), bvh_updates.end());
+        const vector<Result> lookups = benchLookups(settings, counter, avatars);
+        results.insert(results.end(), lookups.begin(), lookups.end());
+        results.push_back(benchRenderBuild(settings, counter, avatars));
+        const vector<Result> kernels = benchKernels(settings, counter, avatars);
+        results.insert(results.end(), kernels.begin(), kernels.end());
+    }
+    
+    const string json = toJson(settings, counter.isAvailable(), results);
+    fputs(json.c_str(), stdout);
+    if (!settings.out.empty()) {
+        ofstream file(settings.out.c_str());
+        file << json;
+        if (!file) {
+            fprintf(stderr, "can't write %s\n", settings.out.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
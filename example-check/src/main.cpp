@@ -0,0 +1,1075 @@
+#include "ofMain.h"
+#include "ofxPerceptionNeuron.h"
+#include "ofxBvhMod.h"
+#include "ofxBvhKernels.h"
+#include "NeuronSkeleton.h"
+#include "BvhTemplate.h"
+#include "ofxBvhCapture.h"
+#include "StreamDecoder.h"
+#include "SkeletonRenderer.h"
+#include "HistoryRing.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+#include <random>
+
+// Headless self-checks of the addon's numeric and real-time guarantees,
+// for CI. No window or GL context is created.
+//
+//   example-check
+//
+// Each check prints its measured figure against the documented bound, and
+// the program exits with 1 if any fails.
+//
+// decoder: StreamDecoder dispatches packets split across reads, back to
+// back, and after garbage or a bogus DataCount, and datagrams holding several
+// packets or a truncated one, with the packet and skipped byte counts.
+//
+// kernels: every ofxBvhKernels instruction set the CPU supports against
+// the ofMatrix4x4 reference (ofxBvh::updateRecursive), through ofxBvh,
+// ofxBvhSolver::solveBatch, NeuronSkeleton::Pose and skinning, and lazy
+// solvers read a few joints at a time, also after updateRecursive.
+//
+// capture: ofxBvhCapture round trips within its documented error (rotations
+// 360 / 2^17 degrees, positions half a position_step), and a file that was
+// never closed, with a torn chunk at the end, reads back every whole chunk.
+//
+// recording: a stream sent without displacement is recorded, as BVH and as
+// captures, with the template offsets as positions.
+//
+// history: HistoryRing::findAtOrBefore, and frames received at synthetic
+// times posed by getSkeletonAt() and OUTPUT_SAMPLED at both ends of the
+// history, with extrapolation capped at the max prediction.
+//
+// udp: frames reordered and restarted over loopback to listenUdp(), with
+// stale ones discarded by FrameIndex and monotonic arrival times.
+//
+// renderer: mesh sizes and vertex positions built by SkeletonRenderer for a
+// known skeleton, and billboards facing a turned camera.
+//
+// allocations: once every avatar has been seen, DataReader::receiveFrame()
+// (the receive thread's path), update() and findSkeleton() don't touch the heap.
+
+using namespace ofxPerceptionNeuron;
+
+#pragma mark - allocation counting
+
+static std::atomic<uint64_t> num_allocations(0);
+
+void* operator new(size_t size)
+{
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+#pragma mark - checks
+
+static int num_checks = 0;
+static int num_failures = 0;
+
+static void check(const string& name, double measured, double bound)
+{
+    const bool ok = measured <= bound;
+    printf("%s %s: %g (bound %g)\n", ok ? "ok  " : "FAIL", name.c_str(), measured, bound);
+    ++num_checks;
+    if (!ok) {
+        ++num_failures;
+    }
+}
+
+#pragma mark - synthetic frames
+
+// template positions with rotations over the whole range, so every
+// quadrant of the trigonometry is exercised
+static void makeFrame(std::mt19937& random, vector<float>& data)
+{
+    std::uniform_real_distribution<float> angle(-180, 180);
+    data.resize(NeuronSkeleton::NUM_CHANNELS);
+    for (int k=0; k<NeuronSkeleton::NUM_ROTATIONS; ++k) {
+        const int j = NeuronSkeleton::rotation_joints[k];
+        float* v = &data[k * NeuronSkeleton::CHANNELS_PER_JOINT];
+        v[0] = NeuronSkeleton::offsets[j][0];
+        v[1] = NeuronSkeleton::offsets[j][1];
+        v[2] = NeuronSkeleton::offsets[j][2];
+        v[3] = angle(random);
+        v[4] = angle(random);
+        v[5] = angle(random);
+    }
+}
+
+#pragma mark - decoder
+
+static const int DECODER_VALUES = 16;
+
+// what the decoder dispatched, in order
+struct DecodedPackets
+{
+    vector<uint32_t> frame_indices;
+    double value_error = 0; // payloads against the values appendPacket() wrote
+};
+
+static void onDecodedBvh(void* user, const BvhDataHeader* header, const float* data)
+{
+    DecodedPackets* decoded = static_cast<DecodedPackets*>(user);
+    decoded->frame_indices.push_back(header->FrameIndex);
+    for (int i=0; i<header->DataCount; ++i) {
+        decoded->value_error = max(decoded->value_error, fabs(double(data[i]) - (header->FrameIndex + i)));
+    }
+}
+
+// a BVH packet of DECODER_VALUES floats counting up from its frame index;
+// data_count is what the header claims
+static void appendPacket(vector<uint8_t>& bytes, uint32_t frame_index, uint16_t data_count = DECODER_VALUES)
+{
+    BvhDataHeader h;
+    memset(&h, 0, sizeof(h));
+    h.Token1 = StreamDecoder::BVH_TOKEN_BEGIN;
+    h.Token2 = StreamDecoder::BVH_TOKEN_END;
+    h.DataCount = data_count;
+    h.FrameIndex = frame_index;
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&h);
+    bytes.insert(bytes.end(), p, p + sizeof(h));
+    for (int i=0; i<DECODER_VALUES; ++i) {
+        const float v = float(frame_index + i);
+        p = reinterpret_cast<const uint8_t*>(&v);
+        bytes.insert(bytes.end(), p, p + sizeof(v));
+    }
+}
+
+// one read of bytes [begin, end) into the decoder's buffer
+static void feed(StreamDecoder& decoder, const vector<uint8_t>& bytes, size_t begin, size_t end)
+{
+    memcpy(decoder.writePtr(), bytes.data() + begin, end - begin);
+    decoder.commit(end - begin);
+}
+
+static void checkDecoded(const string& name, const StreamDecoder& decoder, const DecodedPackets& decoded,
+                         const vector<uint32_t>& expected, size_t skipped)
+{
+    check(name + " packets", fabs(double(decoder.getNumPackets()) - double(expected.size())), 0);
+    check(name + " skipped bytes", fabs(double(decoder.getNumSkippedBytes()) - double(skipped)), 0);
+    check(name + " handler calls wrong", decoded.frame_indices == expected ? 0 : 1, 0);
+    check(name + " values", decoded.value_error, 0);
+}
+
+// StreamDecoder through commit() as the TCP reader uses it, and through
+// decodeDatagram() as the UDP reader does
+static void checkDecoder()
+{
+    // a packet in three reads, cut inside the header and inside the payload
+    {
+        StreamDecoder decoder;
+        DecodedPackets decoded;
+        decoder.setBvhFrameHandler(onDecodedBvh, &decoded);
+        vector<uint8_t> bytes;
+        appendPacket(bytes, 1);
+        feed(decoder, bytes, 0, 10);
+        const uint64_t early = decoder.getNumPackets();
+        feed(decoder, bytes, 10, 100);
+        check("decoder/split early packets", double(early + decoder.getNumPackets()), 0);
+        feed(decoder, bytes, 100, bytes.size());
+        checkDecoded("decoder/split", decoder, decoded, {1}, 0);
+    }
+    
+    // garbage holding token bytes, leaving the packet unaligned in the buffer
+    {
+        StreamDecoder decoder;
+        DecodedPackets decoded;
+        decoder.setBvhFrameHandler(onDecodedBvh, &decoded);
+        vector<uint8_t> bytes = { 0x12, 0xFF, 0x34, 0x00, 0x56, 0xFF, 0x78 };
+        appendPacket(bytes, 2);
+        feed(decoder, bytes, 0, bytes.size());
+        checkDecoded("decoder/garbage", decoder, decoded, {2}, 7);
+    }
+    
+    // a header claiming more than a packet can hold is skipped with its payload
+    {
+        StreamDecoder decoder;
+        DecodedPackets decoded;
+        decoder.setBvhFrameHandler(onDecodedBvh, &decoded);
+        vector<uint8_t> bytes;
+        appendPacket(bytes, 3, 0xFFFF);
+        const size_t bogus = bytes.size();
+        appendPacket(bytes, 4);
+        feed(decoder, bytes, 0, bytes.size());
+        checkDecoded("decoder/bogus DataCount", decoder, decoded, {4}, bogus);
+    }
+    
+    // packets back to back in one read
+    {
+        StreamDecoder decoder;
+        DecodedPackets decoded;
+        decoder.setBvhFrameHandler(onDecodedBvh, &decoded);
+        vector<uint8_t> bytes;
+        for (uint32_t f=5; f<8; ++f) {
+            appendPacket(bytes, f);
+        }
+        feed(decoder, bytes, 0, bytes.size());
+        checkDecoded("decoder/back to back", decoder, decoded, {5, 6, 7}, 0);
+    }
+    
+    // datagrams are read in place, so they're copied to float aligned storage
+    {
+        StreamDecoder decoder;
+        DecodedPackets decoded;
+        decoder.setBvhFrameHandler(onDecodedBvh, &decoded);
+        vector<uint8_t> bytes;
+        appendPacket(bytes, 8);
+        const size_t size = bytes.size() - 8;
+        vector<float> datagram(bytes.size() / sizeof(float));
+        memcpy(datagram.data(), bytes.data(), size);
+        const size_t dispatched = decoder.decodeDatagram(reinterpret_cast<const uint8_t*>(datagram.data()), size);
+        check("decoder/truncated datagram dispatched", double(dispatched), 0);
+        checkDecoded("decoder/truncated datagram", decoder, decoded, {}, size);
+    }
+    {
+        StreamDecoder decoder;
+        DecodedPackets decoded;
+        decoder.setBvhFrameHandler(onDecodedBvh, &decoded);
+        vector<uint8_t> bytes;
+        for (uint32_t f=9; f<12; ++f) {
+            appendPacket(bytes, f);
+        }
+        vector<float> datagram(bytes.size() / sizeof(float));
+        memcpy(datagram.data(), bytes.data(), bytes.size());
+        const size_t dispatched = decoder.decodeDatagram(reinterpret_cast<const uint8_t*>(datagram.data()), bytes.size());
+        check("decoder/datagram dispatched", fabs(double(dispatched) - 3), 0);
+        checkDecoded("decoder/datagram", decoder, decoded, {9, 10, 11}, 0);
+    }
+}
+
+#pragma mark - kernels
+
+// largest difference of the rotation entries and of the translation, in cm
+struct MatrixError
+{
+    double rotation = 0;
+    double translation = 0;
+    
+    void add(const float* a, const float* b)
+    {
+        for (int r=0; r<3; ++r) {
+            for (int c=0; c<3; ++c) {
+                rotation = max(rotation, double(fabsf(a[r * 4 + c] - b[r * 4 + c])));
+            }
+            translation = max(translation, double(fabsf(a[12 + r] - b[12 + r])));
+        }
+    }
+};
+
+static const double ROTATION_BOUND = 1e-5;
+static const double TRANSLATION_BOUND = 1e-3;
+static const double SKIN_BOUND = 1e-3;
+static const int KERNEL_FRAMES = 64;
+static const int SKIN_VERTICES = 4099; // not a multiple of any lane count
+
+static vector<ofxBvhKernels::ISA> getIsas()
+{
+    vector<ofxBvhKernels::ISA> isas(1, ofxBvhKernels::ISA_SCALAR);
+    const ofxBvhKernels::ISA best = ofxBvhKernels::getBestIsa();
+    if (best == ofxBvhKernels::ISA_NEON) {
+        isas.push_back(best);
+    } else {
+        for (int isa=ofxBvhKernels::ISA_SSE2; isa<=best; ++isa) {
+            isas.push_back(ofxBvhKernels::ISA(isa));
+        }
+    }
+    return isas;
+}
+
+// Lazy solvers only solve the joints that are read, with their stale
+// ancestors. A couple of joints are read each frame and all of them every
+// eighth, leaves first so chains end at ancestors that are already current.
+static void checkLazy(const string& prefix, const ofxBvhHierarchyRef& hierarchy, const vector<vector<float> >& frames,
+                      const vector<ofMatrix4x4>& reference)
+{
+    const int num_joints = hierarchy->getNumJoints();
+    const int n = int(frames.size());
+    
+    MatrixError lazy;
+    ofxBvhSolver full(hierarchy), lazy_solver(hierarchy);
+    lazy_solver.setLazy(true);
+    vector<int> read;
+    for (int f=0; f<n; ++f) {
+        full.solve(frames[f].data(), frames[f].size());
+        lazy_solver.solve(frames[f].data(), frames[f].size());
+        read.clear();
+        if (f % 8 == 7) {
+            for (int j=num_joints - 1; j>=0; --j) {
+                read.push_back(j);
+            }
+        } else {
+            read.push_back((f * 7) % num_joints);
+            read.push_back((f * 13) % num_joints);
+        }
+        for (int j : read) {
+            lazy.add(lazy_solver.getGlobalMatrix(j).getPtr(), full.getGlobalMatrix(j).getPtr());
+            lazy.add(lazy_solver.getMatrix(j).getPtr(), full.getMatrix(j).getPtr());
+            lazy.translation = max(lazy.translation, double((lazy_solver.getOffset(j) - full.getOffset(j)).length()));
+        }
+    }
+    check(prefix + "lazy rotation", lazy.rotation, ROTATION_BOUND);
+    check(prefix + "lazy translation", lazy.translation, TRANSLATION_BOUND);
+    
+    // updateRecursive() leaves every joint current, so a lazy ofxBvh must not
+    // re-solve them from the channels of an earlier update()
+    MatrixError mixed;
+    ofxBvh mixed_bvh(hierarchy);
+    mixed_bvh.setLazy(true);
+    for (int f=0; f<n; ++f) {
+        if (f % 3 == 1) {
+            mixed_bvh.updateRecursive(frames[f]);
+        } else {
+            mixed_bvh.update(frames[f]);
+        }
+        for (int j=0; j<num_joints; ++j) {
+            if (f % 4 == 3 || j == (f * 11) % num_joints) {
+                mixed.add(mixed_bvh.getJoint(j)->getGlobalMatrix().getPtr(), reference[f * num_joints + j].getPtr());
+            }
+        }
+    }
+    check(prefix + "lazy updateRecursive rotation", mixed.rotation, ROTATION_BOUND);
+    check(prefix + "lazy updateRecursive translation", mixed.translation, TRANSLATION_BOUND);
+}
+
+static void checkKernels(ofxBvhKernels::ISA isa, const vector<vector<float> >& frames)
+{
+    ofxBvhKernels::setIsa(isa);
+    const string prefix = string("kernels/") + ofxBvhKernels::getIsaName(isa) + "/";
+    const ofxBvhHierarchyRef hierarchy = ofxBvhHierarchy::parse(bvh_header_template);
+    const int num_joints = hierarchy->getNumJoints();
+    const int n = int(frames.size());
+    
+    // the reference: one ofMatrix4x4 product per joint, recursively
+    vector<ofMatrix4x4> reference(n * num_joints);
+    ofxBvh ref(hierarchy);
+    for (int f=0; f<n; ++f) {
+        ref.updateRecursive(frames[f]);
+        for (int j=0; j<num_joints; ++j) {
+            reference[f * num_joints + j] = ref.getJoint(j)->getGlobalMatrix();
+        }
+    }
+    
+    MatrixError solve;
+    ofxBvh bvh(hierarchy);
+    for (int f=0; f<n; ++f) {
+        bvh.update(frames[f]);
+        for (int j=0; j<num_joints; ++j) {
+            solve.add(bvh.getJoint(j)->getGlobalMatrix().getPtr(), reference[f * num_joints + j].getPtr());
+        }
+    }
+    check(prefix + "solve rotation", solve.rotation, ROTATION_BOUND);
+    check(prefix + "solve translation", solve.translation, TRANSLATION_BOUND);
+    
+    checkLazy(prefix, hierarchy, frames, reference);
+    
+    MatrixError batch;
+    ofxBvhSolver solver(hierarchy);
+    vector<const float*> data;
+    for (const auto& frame : frames) {
+        data.push_back(frame.data());
+    }
+    vector<float> out(n * num_joints * 16);
+    solver.solveBatch(data.data(), n, out.data(), ofxBvhSolver::BATCH_AVATAR_MAJOR);
+    for (int i=0; i<n * num_joints; ++i) {
+        batch.add(&out[i * 16], reference[i].getPtr());
+    }
+    check(prefix + "solveBatch rotation", batch.rotation, ROTATION_BOUND);
+    check(prefix + "solveBatch translation", batch.translation, TRANSLATION_BOUND);
+    
+    MatrixError pose;
+    NeuronSkeleton::Pose p;
+    for (int f=0; f<n; ++f) {
+        p.solve(frames[f].data());
+        for (int j=0; j<num_joints; ++j) {
+            pose.add(p.global_matrices[j].getPtr(), reference[f * num_joints + j].getPtr());
+        }
+    }
+    check(prefix + "Pose rotation", pose.rotation, ROTATION_BOUND);
+    check(prefix + "Pose translation", pose.translation, TRANSLATION_BOUND);
+    
+    // skinning with the first frame's globals as bone matrices, against a
+    // weighted sum of ofMatrix4x4::preMult
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> coordinate(-100, 100), weight(0, 1);
+    std::uniform_int_distribution<int> bone(0, num_joints - 1);
+    const int influences = 4;
+    const size_t count = SKIN_VERTICES;
+    vector<float> skin(num_joints * ofxBvhKernels::SOA_COMPONENTS);
+    for (int j=0; j<num_joints; ++j) {
+        const float* m = reference[j].getPtr();
+        float* s = &skin[j * ofxBvhKernels::SOA_COMPONENTS];
+        for (int r=0; r<3; ++r) {
+            s[r * 3 + 0] = m[r * 4 + 0];
+            s[r * 3 + 1] = m[r * 4 + 1];
+            s[r * 3 + 2] = m[r * 4 + 2];
+            s[9 + r] = m[12 + r];
+        }
+    }
+    vector<uint16_t> bones(influences * count);
+    vector<float> weights(influences * count), pos(3 * count), out_pos(3 * count);
+    vector<float> normals(3 * count), out_normals(3 * count);
+    double skin_error = 0;
+    for (size_t i=0; i<count; ++i) {
+        float sum = 0;
+        for (int k=0; k<influences; ++k) {
+            bones[k * count + i] = bone(random);
+            weights[k * count + i] = weight(random);
+            sum += weights[k * count + i];
+        }
+        for (int k=0; k<influences; ++k) {
+            weights[k * count + i] /= sum;
+        }
+        for (int c=0; c<3; ++c) {
+            pos[c * count + i] = coordinate(random);
+            normals[c * count + i] = coordinate(random) / 100;
+        }
+    }
+    ofxBvhKernels::skinLinearBlendSoA(skin.data(), bones.data(), weights.data(), influences, pos.data(),
+                                      out_pos.data(), normals.data(), out_normals.data(), count, count);
+    for (size_t i=0; i<count; ++i) {
+        const ofVec3f v(pos[i], pos[count + i], pos[2 * count + i]);
+        const ofVec3f nv(normals[i], normals[count + i], normals[2 * count + i]);
+        ofVec3f expected, expected_normal;
+        for (int k=0; k<influences; ++k) {
+            const ofMatrix4x4& m = reference[bones[k * count + i]];
+            const float w = weights[k * count + i];
+            expected += m.preMult(v) * w;
+            expected_normal += (m.preMult(nv) - m.getTranslation()) * w;
+        }
+        const ofVec3f got(out_pos[i], out_pos[count + i], out_pos[2 * count + i]);
+        const ofVec3f got_normal(out_normals[i], out_normals[count + i], out_normals[2 * count + i]);
+        skin_error = max(skin_error, double((got - expected).length()));
+        skin_error = max(skin_error, double((got_normal - expected_normal).length()));
+    }
+    check(prefix + "skin", skin_error, SKIN_BOUND);
+}
+
+#pragma mark - capture
+
+static const int CAPTURE_FRAMES = 1000; // not a multiple of the chunk size
+// float rounding of values up to a few hundred, on top of the quantization
+static const double CAPTURE_ROUNDING = 2e-5;
+static const double CAPTURE_ROTATION_BOUND = 360.0 / (1 << 17) + CAPTURE_ROUNDING;
+
+// largest error of the decoded frames, rotations compared mod 360
+static void compareCapture(ofxBvhCaptureReader& reader, const vector<vector<float> >& frames,
+                           const vector<uint8_t>& is_rotation, double& rotation_error, double& position_error)
+{
+    rotation_error = 0;
+    position_error = 0;
+    vector<float> decoded(NeuronSkeleton::NUM_CHANNELS);
+    for (int f=0; f<reader.getNumFrames(); ++f) {
+        if (!reader.readFrame(f, decoded.data())) {
+            rotation_error = position_error = INFINITY;
+            return;
+        }
+        for (int c=0; c<NeuronSkeleton::NUM_CHANNELS; ++c) {
+            double d = fabs(double(decoded[c]) - frames[f][c]);
+            if (is_rotation[c]) {
+                d = fmod(d, 360);
+                rotation_error = max(rotation_error, min(d, 360 - d));
+            } else {
+                position_error = max(position_error, d);
+            }
+        }
+    }
+}
+
+static void checkCapture(std::mt19937& random)
+{
+    const ofxBvhHierarchyRef hierarchy = ofxBvhHierarchy::parse(bvh_header_template);
+    std::uniform_real_distribution<float> displacement(-50, 50);
+    vector<vector<float> > frames(CAPTURE_FRAMES);
+    for (auto& frame : frames) {
+        makeFrame(random, frame);
+        for (int k=0; k<NeuronSkeleton::NUM_ROTATIONS; ++k) {
+            for (int c=0; c<3; ++c) {
+                frame[k * NeuronSkeleton::CHANNELS_PER_JOINT + c] += displacement(random);
+            }
+        }
+    }
+    vector<uint8_t> is_rotation(NeuronSkeleton::NUM_CHANNELS);
+    for (int c=0; c<NeuronSkeleton::NUM_CHANNELS; ++c) {
+        is_rotation[c] = c % NeuronSkeleton::CHANNELS_PER_JOINT >= 3;
+    }
+    
+    const string path = ofToDataPath("check.bvhcap");
+    const ofxBvhCaptureWriter::Settings settings;
+    ofxBvhCaptureWriter writer;
+    bool ok = writer.open(path, hierarchy, 1 / 120.f, settings);
+    for (const auto& frame : frames) {
+        ok = ok && writer.addFrame(frame.data());
+    }
+    ok = ok && writer.close();
+    check("capture/write", ok ? 0 : 1, 0);
+    
+    const double position_bound = settings.position_step / 2 + CAPTURE_ROUNDING;
+    double rotation_error, position_error;
+    ofxBvhCaptureReader reader;
+    reader.open(path);
+    check("capture/frames", fabs(double(reader.getNumFrames() - CAPTURE_FRAMES)), 0);
+    compareCapture(reader, frames, is_rotation, rotation_error, position_error);
+    check("capture/rotation degrees", rotation_error, CAPTURE_ROTATION_BOUND);
+    check("capture/position", position_error, position_bound);
+    reader.close();
+    
+    // as if the writer had crashed: no index or frame count, the last
+    // (partial) chunk still in memory and the start of it torn on disk
+    ofxBvhCapture::Header header;
+    FILE* f = fopen(path.c_str(), "r+b");
+    ok = f && fread(&header, sizeof(header), 1, f) == 1 && header.index_offset > 0;
+    const int whole_chunks = CAPTURE_FRAMES / settings.chunk_frames;
+    uint64_t end = 0;
+    if (ok) {
+        ok = fseek(f, long(header.index_offset + whole_chunks * sizeof(uint64_t)), SEEK_SET) == 0
+            && fread(&end, sizeof(end), 1, f) == 1;
+    }
+    if (ok) {
+        ofxBvhCapture::ChunkHeader torn;
+        torn.size = 1 << 20;
+        torn.num_frames = CAPTURE_FRAMES % settings.chunk_frames;
+        header.num_frames = 0;
+        header.index_offset = 0;
+        ok = fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1
+            && fseek(f, long(end), SEEK_SET) == 0 && fwrite(&torn, sizeof(torn), 1, f) == 1
+            && fflush(f) == 0 && truncate(path.c_str(), end + sizeof(torn)) == 0;
+    }
+    if (f) {
+        fclose(f);
+    }
+    check("capture/unclosed setup", ok ? 0 : 1, 0);
+    reader.open(path);
+    check("capture/unclosed frames", fabs(double(reader.getNumFrames() - whole_chunks * settings.chunk_frames)), 0);
+    compareCapture(reader, frames, is_rotation, rotation_error, position_error);
+    check("capture/unclosed rotation degrees", rotation_error, CAPTURE_ROTATION_BOUND);
+    check("capture/unclosed position", position_error, position_bound);
+    reader.close();
+    remove(path.c_str());
+}
+
+#pragma mark - recording
+
+static const int RECORD_FRAMES = 300;
+// BVH text keeps 4 decimals
+static const double RECORD_BVH_BOUND = 0.5e-4 + CAPTURE_ROUNDING;
+
+// a stream sent without displacement is recorded with the template offsets
+static void checkRecording(std::mt19937& random)
+{
+    vector<vector<float> > frames(RECORD_FRAMES);
+    for (auto& frame : frames) {
+        makeFrame(random, frame);
+    }
+    BvhDataHeader h;
+    memset(&h, 0, sizeof(h));
+    h.Token1 = StreamDecoder::BVH_TOKEN_BEGIN;
+    h.Token2 = StreamDecoder::BVH_TOKEN_END;
+    h.DataCount = NeuronSkeleton::NUM_CHANNELS_NO_DISP;
+    h.WithDisp = 0;
+    vector<float> packet(NeuronSkeleton::NUM_CHANNELS_NO_DISP);
+    
+    const Recorder::Format formats[] = { Recorder::FORMAT_BVH, Recorder::FORMAT_CAPTURE };
+    for (Recorder::Format format : formats) {
+        const bool capture = format == Recorder::FORMAT_CAPTURE;
+        const string name = capture ? "recording/capture " : "recording/bvh ";
+        Recorder::Settings settings;
+        settings.path = ofToDataPath("check_nodisp");
+        settings.format = format;
+        
+        DataReader reader;
+        bool ok = reader.startRecording(settings);
+        for (int f=0; f<RECORD_FRAMES; ++f) {
+            const float* frame = frames[f].data();
+            copy(frame, frame + NeuronSkeleton::CHANNELS_PER_JOINT, packet.begin());
+            for (int k=1; k<NeuronSkeleton::NUM_ROTATIONS; ++k) {
+                copy(frame + k * NeuronSkeleton::CHANNELS_PER_JOINT + 3,
+                     frame + (k + 1) * NeuronSkeleton::CHANNELS_PER_JOINT, packet.begin() + 3 + k * 3);
+            }
+            h.FrameIndex = f;
+            reader.receiveFrame(0, h, packet.data());
+        }
+        reader.stopRecording();
+        const Recorder::Stats stats = reader.getRecordingStats();
+        check(name + "frames written", fabs(double(stats.frames_written) - RECORD_FRAMES), 0);
+        check(name + "frames skipped", double(stats.frames_skipped), 0);
+        
+        const string base = settings.path + "_avatar0_000";
+        const string path = base + (capture ? ".bvhcap" : ".bvh");
+        ofxBvh bvh;
+        ok = ok && bvh.loadFile(path);
+        check(name + "frames read", ok ? fabs(double(bvh.getNumFrames() - RECORD_FRAMES)) : INFINITY, 0);
+        
+        double rotation_error = 0, position_error = 0;
+        for (int f=0; ok && f<bvh.getNumFrames(); ++f) {
+            const float* decoded = bvh.getFrameData(f);
+            for (int c=0; c<NeuronSkeleton::NUM_CHANNELS; ++c) {
+                double d = fabs(double(decoded[c]) - frames[f][c]);
+                if (c % NeuronSkeleton::CHANNELS_PER_JOINT >= 3) {
+                    d = fmod(d, 360);
+                    rotation_error = max(rotation_error, min(d, 360 - d));
+                } else {
+                    position_error = max(position_error, d);
+                }
+            }
+        }
+        const ofxBvhCaptureWriter::Settings capture_settings;
+        check(name + "rotation degrees", rotation_error, capture ? CAPTURE_ROTATION_BOUND : RECORD_BVH_BOUND);
+        check(name + "position", position_error,
+              capture ? capture_settings.position_step / 2 + CAPTURE_ROUNDING : RECORD_BVH_BOUND);
+        remove(path.c_str());
+        remove((base + ".csv").c_str());
+    }
+}
+
+#pragma mark - history
+
+static const int HISTORY_LENGTH = 8;
+static const int HISTORY_FRAMES = 20;
+static const uint64_t HISTORY_INTERVAL = 10000000; // ns, so frame f arrives at start + f * HISTORY_INTERVAL
+static const double HISTORY_BOUND = 1e-4; // cm
+
+// Hips' x, the one channel that changes from frame to frame: it moves 1 cm a
+// frame, so the pose at time t stands for frame (t - start) / HISTORY_INTERVAL
+static double hipsError(const ofMatrix4x4& hips, const vector<float>& frame, double f)
+{
+    return fabs(double(hips.getTranslation().x) - (frame[0] + f));
+}
+
+// HistoryRing::findAtOrBefore, and DataReader's history through receiveFrame()
+// with synthetic arrival times: getSkeletonAt() at both ends of the history,
+// and OUTPUT_SAMPLED interpolating and extrapolating up to the max prediction
+static void checkHistory(std::mt19937& random)
+{
+    // records k = 0..9 at 100 (k + 1); the ring keeps the last 8, from 300
+    HistoryRing ring;
+    ring.allocate(HISTORY_LENGTH, 1);
+    for (int k=0; k<10; ++k) {
+        const float v = float(k);
+        ring.push(100 * (k + 1), k, &v, 1);
+    }
+    const uint64_t times[] = { 300, 350, 999, 1000, 2000 };
+    const uint64_t expected[] = { 2, 2, 8, 9, 9 };
+    int wrong = 0;
+    for (int k=0; k<5; ++k) {
+        uint64_t i = 0;
+        if (!ring.findAtOrBefore(times[k], i) || i != expected[k]) {
+            ++wrong;
+        }
+    }
+    uint64_t i = 0;
+    check("history/findAtOrBefore wrong", double(wrong), 0);
+    check("history/findAtOrBefore older", ring.findAtOrBefore(299, i) ? 1 : 0, 0);
+    
+    vector<float> frame;
+    makeFrame(random, frame);
+    vector<float> moved(frame);
+    BvhDataHeader h;
+    memset(&h, 0, sizeof(h));
+    h.DataCount = NeuronSkeleton::NUM_CHANNELS;
+    h.WithDisp = 1;
+    
+    // in the past, so latencies measured against now() stay positive
+    const uint64_t start = DataReader::now() - (HISTORY_FRAMES + 100) * HISTORY_INTERVAL;
+    DataReader reader;
+    reader.setHistoryLength(HISTORY_LENGTH);
+    for (int f=0; f<HISTORY_FRAMES; ++f) {
+        moved[0] = frame[0] + f;
+        h.FrameIndex = f;
+        reader.receiveFrame(0, h, moved.data(), start + f * HISTORY_INTERVAL);
+    }
+    reader.update();
+    if (reader.getSkeletons().empty()) {
+        check("history/skeletons", 1, 0);
+        return;
+    }
+    // a copy resolves to the same avatar
+    const Skeleton skeleton = reader.getSkeletons()[0];
+    const int oldest = HISTORY_FRAMES - HISTORY_LENGTH;
+    const int newest = HISTORY_FRAMES - 1;
+    
+    NeuronSkeleton::Pose pose;
+    double error = 0;
+    bool found = reader.getSkeletonAt(skeleton, start + oldest * HISTORY_INTERVAL + HISTORY_INTERVAL / 4, pose);
+    error = max(error, hipsError(pose.global_matrices[0], frame, oldest + 0.25));
+    found = found && reader.getSkeletonAt(skeleton, start + (newest - 1) * HISTORY_INTERVAL + HISTORY_INTERVAL * 3 / 4, pose);
+    error = max(error, hipsError(pose.global_matrices[0], frame, newest - 0.25));
+    // getSkeletonAt() doesn't predict: past the newest frame it holds it
+    found = found && reader.getSkeletonAt(skeleton, start + (newest + 2) * HISTORY_INTERVAL, pose);
+    error = max(error, hipsError(pose.global_matrices[0], frame, newest));
+    check("history/getSkeletonAt found", found ? 0 : 1, 0);
+    check("history/getSkeletonAt hips", error, HISTORY_BOUND);
+    check("history/getSkeletonAt older", reader.getSkeletonAt(skeleton, start + oldest * HISTORY_INTERVAL - 1, pose) ? 1 : 0, 0);
+    
+    // presented half a frame past the newest, then far past it with the
+    // prediction capped at one and a half frames, then delayed into the oldest interval
+    reader.setOutputMode(DataReader::OUTPUT_SAMPLED);
+    reader.setSampleDelay(0);
+    reader.setMaxPrediction(HISTORY_INTERVAL * 3 / 2);
+    const uint64_t newest_time = start + newest * HISTORY_INTERVAL;
+    const uint64_t presentation[] = { newest_time + HISTORY_INTERVAL / 2, newest_time + 5 * HISTORY_INTERVAL, newest_time + HISTORY_INTERVAL / 2 };
+    const int64_t delay[] = { 0, 0, int64_t(HISTORY_INTERVAL) * 6 };
+    const double shown[] = { newest + 0.5, newest + 1.5, oldest + 1.5 };
+    error = 0;
+    double offset_error = 0;
+    for (int k=0; k<3; ++k) {
+        reader.setSampleDelay(delay[k]);
+        reader.update(presentation[k]);
+        error = max(error, hipsError(skeleton.getJoints()[0].getGlobalTransform(), frame, shown[k]));
+        const double offset = (shown[k] - newest) * HISTORY_INTERVAL;
+        offset_error = max(offset_error, fabs(double(reader.getSampleOffset(skeleton)) - offset));
+    }
+    check("history/sampled hips", error, HISTORY_BOUND);
+    check("history/sampled offset ns", offset_error, 0);
+}
+
+#pragma mark - udp
+
+static const int UDP_TIMEOUT_MS = 2000;
+
+// a loopback port nothing is bound to, 0 if there's none
+static int findUdpPort()
+{
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    int port = 0;
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+        getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &length) == 0) {
+        port = ntohs(addr.sin_port);
+    }
+    ::close(fd);
+    return port;
+}
+
+// until the source has decoded n packets in all
+static bool waitForPackets(const DataReader& reader, int source, uint64_t n)
+{
+    for (int i=0; i<UDP_TIMEOUT_MS; ++i) {
+        if (reader.getSourceStatus(source).num_packets >= n) {
+            return true;
+        }
+        usleep(1000);
+    }
+    return false;
+}
+
+// Frames sent over loopback to listenUdp(), reordered and then restarted:
+// stale FrameIndex values are discarded and the newest frame's pose wins,
+// while a jump back of RESTART_FRAMES or more is taken as a server restart.
+// The history keeps the frames that got through, with arrival times that
+// never go backwards.
+static void checkUdp(std::mt19937& random)
+{
+    vector<float> frame;
+    makeFrame(random, frame);
+    
+    DataReader reader;
+    const int port = findUdpPort();
+    const int source = port > 0 ? reader.listenUdp(port, "127.0.0.1") : -1;
+    int i = 0;
+    while (source >= 0 && reader.getSourceStatus(source).status != CS_Running && i++ < UDP_TIMEOUT_MS) {
+        usleep(1000);
+    }
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (source < 0 || fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        check("udp/listening", 1, 0);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return;
+    }
+    
+    // Hips' x carries FrameIndex % 100, so the pose shows which frame won
+    const uint32_t reordered[] = { 1000, 1001, 1003, 1003, 1002, 999 };
+    const uint32_t restarted[] = { 5, 6, 7, 4 };
+    const uint32_t* phases[] = { reordered, restarted };
+    const int sizes[] = { 6, 4 };
+    const uint32_t winners[] = { 1003, 7 };
+    const uint64_t discarded[] = { 3, 4 };
+    
+    BvhDataHeader h;
+    memset(&h, 0, sizeof(h));
+    h.Token1 = StreamDecoder::BVH_TOKEN_BEGIN;
+    h.Token2 = StreamDecoder::BVH_TOKEN_END;
+    h.DataCount = NeuronSkeleton::NUM_CHANNELS;
+    h.WithDisp = 1;
+    vector<uint8_t> packet(sizeof(h) + NeuronSkeleton::NUM_CHANNELS * sizeof(float));
+    vector<float> moved(frame);
+    uint64_t sent = 0;
+    double error = 0;
+    double discard_error = 0;
+    for (int p=0; p<2; ++p) {
+        for (int k=0; k<sizes[p]; ++k) {
+            h.FrameIndex = phases[p][k];
+            moved[0] = frame[0] + h.FrameIndex % 100;
+            memcpy(packet.data(), &h, sizeof(h));
+            memcpy(packet.data() + sizeof(h), moved.data(), NeuronSkeleton::NUM_CHANNELS * sizeof(float));
+            if (::send(fd, packet.data(), packet.size(), 0) == ssize_t(packet.size())) {
+                ++sent;
+            }
+        }
+        if (!waitForPackets(reader, source, sent) || (reader.update(), reader.getSkeletons().empty())) {
+            check("udp/received", 1, 0);
+            ::close(fd);
+            return;
+        }
+        const Skeleton& skeleton = reader.getSkeletons()[0];
+        error = max(error, hipsError(skeleton.getJoints()[0].getGlobalTransform(), frame, winners[p] % 100));
+        LatencyStats stats;
+        reader.getLatencyStats(skeleton, stats);
+        discard_error = max(discard_error, fabs(double(stats.frames_discarded) - double(discarded[p])));
+    }
+    ::close(fd);
+    check("udp/winning hips", error, HISTORY_BOUND);
+    check("udp/frames_discarded", discard_error, 0);
+    
+    const Skeleton& skeleton = reader.getSkeletons()[0];
+    vector<JointSample> samples;
+    reader.getHistory(skeleton, skeleton.getJoints()[0], uint64_t(60) * 1000000000, samples);
+    const uint32_t accepted[] = { 1000, 1001, 1003, 5, 6, 7 };
+    int wrong = samples.size() == 6 ? 0 : 1;
+    double backwards = 0;
+    for (size_t k=0; k<samples.size(); ++k) {
+        if (k < 6 && samples[k].frame_index != accepted[k]) {
+            ++wrong;
+        }
+        if (k > 0 && samples[k].timestamp < samples[k - 1].timestamp) {
+            backwards = max(backwards, double(samples[k - 1].timestamp - samples[k].timestamp));
+        }
+    }
+    check("udp/history frames wrong", double(wrong), 0);
+    check("udp/arrival times backwards ns", backwards, 0);
+}
+
+#pragma mark - renderer
+
+// a root at the origin with one joint straight up; as in Neuron BVH, joints
+// are placed by their position channels, and the End Site sits on Spine
+static const char* RENDER_BVH =
+    "HIERARCHY\n"
+    "ROOT Hips\n{\n  OFFSET 0 0 0\n"
+    "  CHANNELS 6 Xposition Yposition Zposition Yrotation Xrotation Zrotation\n"
+    "  JOINT Spine\n  {\n    OFFSET 0 10 0\n"
+    "    CHANNELS 6 Xposition Yposition Zposition Yrotation Xrotation Zrotation\n"
+    "    End Site\n    {\n      OFFSET 0 10 0\n    }\n  }\n}\n"
+    "MOTION\nFrames: 1\nFrame Time: 0.008333\n0 0 0 0 0 0 0 10 0 0 0 0\n";
+static const double RENDER_BOUND = 1e-4;
+
+static double distance(const ofVec3f& a, const ofVec3f& b)
+{
+    return (a - b).length();
+}
+
+// SkeletonRenderer's CPU side, headless: mesh sizes, and billboards in the
+// camera's image plane
+static void checkRenderer(const vector<float>& frame)
+{
+    SkeletonRenderer renderer;
+    ofxBvhRenderer::Style style;
+    style.marker_segments = 12;
+    style.marker_radius = 2;
+    style.bone_width = 1;
+    renderer.setStyle(style);
+    
+    // looking down -z from (0, 0, 100)
+    ofMatrix4x4 camera;
+    camera.makeTranslationMatrix(ofVec3f(0, 0, 100));
+    ofxBvh bvh(RENDER_BVH);
+    bvh.setFrame(0);
+    renderer.begin(camera);
+    renderer.add(bvh);
+    
+    // three markers of 1 + 12 vertices, and two bones of one quad each
+    const vector<ofVec3f>& v = renderer.getMesh().getVertices();
+    check("renderer/bvh vertices", fabs(double(v.size()) - (3 * 13 + 2 * 4)), 0);
+    check("renderer/bvh triangles", fabs(double(renderer.getNumTriangles()) - (3 * 12 + 2 * 2)), 0);
+    check("renderer/bvh colors", fabs(double(renderer.getMesh().getColors().size()) - double(v.size())), 0);
+    if (v.size() == 3 * 13 + 2 * 4) {
+        // the root marker starts at +x and is a quarter turn in at +y
+        double error = distance(v[0], ofVec3f(0, 0, 0));
+        error = max(error, distance(v[1], ofVec3f(2, 0, 0)));
+        error = max(error, distance(v[4], ofVec3f(0, 2, 0)));
+        // the bone to Spine follows the marker, as a quad one unit wide facing the camera
+        error = max(error, distance(v[13], ofVec3f(0.5, 0, 0)));
+        error = max(error, distance(v[14], ofVec3f(-0.5, 0, 0)));
+        error = max(error, distance(v[15], ofVec3f(-0.5, 10, 0)));
+        error = max(error, distance(v[16], ofVec3f(0.5, 10, 0)));
+        error = max(error, distance(v[17], ofVec3f(0, 10, 0)));
+        // the bone to the End Site has no length, so it's laid along the camera's right
+        error = max(error, distance(v[30], ofVec3f(-0.5, 10, 0)));
+        error = max(error, distance(v[31], ofVec3f(0.5, 10, 0)));
+        // the End Site marker, after Spine's marker and bone
+        error = max(error, distance(v[2 * 17], ofVec3f(0, 10, 0)));
+        check("renderer/bvh positions", error, RENDER_BOUND);
+    }
+    
+    // turned 30 degrees about y: every marker stays in the image plane,
+    // and every ribbon's width is across the line of sight
+    const float a = ofDegToRad(30);
+    const float m[16] = {
+        cosf(a), 0, -sinf(a), 0,
+        0, 1, 0, 0,
+        sinf(a), 0, cosf(a), 0,
+        60, 5, 80, 1,
+    };
+    camera.set(m);
+    const ofVec3f eye(m[12], m[13], m[14]), forward(m[8], m[9], m[10]);
+    renderer.begin(camera);
+    renderer.add(bvh);
+    double off_plane = 0;
+    for (int j=0; j<3; ++j) {
+        const int base = j * 17;
+        for (int i=1; i<=12; ++i) {
+            off_plane = max(off_plane, fabs(double((v[base + i] - v[base]).dot(forward))));
+        }
+        if (j == 0) {
+            const ofVec3f& a0 = v[base + 13];
+            const ofVec3f& a1 = v[base + 14];
+            const ofVec3f& b1 = v[base + 15];
+            const ofVec3f mid = (a0 + a1 + b1 + v[base + 16]) * 0.25f;
+            off_plane = max(off_plane, fabs(double((a1 - a0).dot((mid - eye).getNormalized()))));
+        }
+    }
+    check("renderer/billboard off-plane", off_plane, RENDER_BOUND);
+    
+    // a DataReader skeleton: 12 box edges and 3 axes per joint, plus one bone per non-root joint
+    DataReader reader;
+    BvhDataHeader h;
+    memset(&h, 0, sizeof(h));
+    h.DataCount = NeuronSkeleton::NUM_CHANNELS;
+    h.WithDisp = 1;
+    reader.receiveFrame(0, h, frame.data());
+    reader.update();
+    renderer.begin(camera);
+    if (!reader.getSkeletons().empty()) {
+        renderer.add(reader.getSkeletons()[0]);
+    }
+    const int quads = NeuronSkeleton::NUM_JOINTS * 15 + NeuronSkeleton::NUM_JOINTS - 1;
+    check("renderer/skeleton vertices", fabs(double(v.size()) - quads * 4), 0);
+    check("renderer/skeleton triangles", fabs(double(renderer.getNumTriangles()) - quads * 2), 0);
+}
+
+#pragma mark - allocations
+
+static const int ALLOCATION_AVATARS = 16;
+static const int ALLOCATION_FRAMES = 1000;
+
+static void checkAllocations(std::mt19937& random)
+{
+    vector<vector<float> > frames(8);
+    for (auto& frame : frames) {
+        makeFrame(random, frame);
+    }
+    vector<BvhDataHeader> headers(ALLOCATION_AVATARS);
+    for (int a=0; a<ALLOCATION_AVATARS; ++a) {
+        BvhDataHeader& h = headers[a];
+        memset(&h, 0, sizeof(h));
+        h.Token1 = StreamDecoder::BVH_TOKEN_BEGIN;
+        h.Token2 = StreamDecoder::BVH_TOKEN_END;
+        h.DataCount = NeuronSkeleton::NUM_CHANNELS;
+        h.WithDisp = 1;
+        h.AvatarIndex = a;
+        // longer than any std::string keeps inline
+        snprintf(reinterpret_cast<char*>(h.AvatarName), sizeof(h.AvatarName), "Performer %02d, stage left", a);
+    }
+    
+    DataReader reader;
+    uint32_t frame_index = 0;
+    auto receive = [&]() {
+        for (auto& h : headers) {
+            h.FrameIndex = frame_index;
+            reader.receiveFrame(0, h, frames[frame_index % frames.size()].data());
+        }
+        ++frame_index;
+    };
+    // first sight allocates each avatar's buffers and history, and the
+    // skeletons are created by the first update()
+    for (int i=0; i<4; ++i) {
+        receive();
+        reader.update();
+    }
+    
+    uint64_t received = 0, updated = 0;
+    for (int i=0; i<ALLOCATION_FRAMES; ++i) {
+        uint64_t before = num_allocations.load(std::memory_order_relaxed);
+        receive();
+        received += num_allocations.load(std::memory_order_relaxed) - before;
+        before = num_allocations.load(std::memory_order_relaxed);
+        reader.update();
+        updated += num_allocations.load(std::memory_order_relaxed) - before;
+    }
+    check("allocations/receiveFrame", double(received), 0);
+    check("allocations/update", double(updated), 0);
+    
+    const vector<string> names = { "Performer 00, stage left", "Performer 15, stage left", "Performer 16, stage left" };
+    const int expected[] = { 0, ALLOCATION_AVATARS - 1, -1 };
+    int wrong = 0;
+    const uint64_t before = num_allocations.load(std::memory_order_relaxed);
+    for (size_t i=0; i<names.size(); ++i) {
+        wrong += reader.findSkeleton(names[i]) != expected[i];
+    }
+    check("allocations/findSkeleton", double(num_allocations.load(std::memory_order_relaxed) - before), 0);
+    check("lookup/findSkeleton wrong", double(wrong), 0);
+}
+
+//========================================================================
+int main()
+{
+    ofSetLogLevel(OF_LOG_WARNING);
+    
+    std::mt19937 random(1);
+    vector<vector<float> > frames(KERNEL_FRAMES);
+    for (auto& frame : frames) {
+        makeFrame(random, frame);
+    }
+    const ofxBvhKernels::ISA previous = ofxBvhKernels::getIsa();
+    for (ofxBvhKernels::ISA isa : getIsas()) {
+        checkKernels(isa, frames);
+    }
+    ofxBvhKernels::setIsa(previous);
+    checkDecoder();
+    checkCapture(random);
+    checkRecording(random);
+    checkHistory(random);
+    checkUdp(random);
+    checkRenderer(frames[0]);
+    checkAllocations(random);
+    
+    printf("%d of %d checks passed\n", num_checks - num_failures, num_checks);
+    return num_failures > 0 ? 1 : 0;
+}
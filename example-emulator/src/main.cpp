@@ -0,0 +1,540 @@
+#include "ofMain.h"
+#include "ofxBvhMod.h"
+#include "NeuronSkeleton.h"
+#include "StreamDecoder.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <random>
+#include <thread>
+
+// Stands in for Axis Neuron's BVH broadcast, so DataReader can be load and
+// soak tested on one machine without a suit. No window is created.
+//
+//   example-emulator [--tcp 7001] [--udp 127.0.0.1:7004 ...] [--bvh file ...]
+//                    [--avatars 1] [--rate 60] [--seconds 0]
+//                    [--loss 0] [--reorder 0] [--jitter 0] [--seed 1]
+//
+// Frames are sent in the binary BVH format with displacement, every avatar
+// once per tick, to every TCP client and UDP target. --bvh replays files in
+// the Axis Neuron hierarchy (BVH or ofxBvhCapture, as Recorder writes them),
+// one frame per tick and looping, avatars taking the files in turn;
+// otherwise the template is swayed synthetically. --seconds 0 runs until
+// interrupted.
+//
+// Impairments: --loss and --reorder are per packet probabilities. A lost
+// packet is never sent, so the receiver sees a FrameIndex gap; a reordered
+// one is held back and sent after its avatar's next packet. --jitter delays
+// each tick by up to that many microseconds. The generator is seeded, so a
+// run can be repeated.
+//
+// A TCP client that can't keep up has whole ticks skipped for it until its
+// socket drains ("stalled"), as the stream must stay packet aligned.
+// Above a few kHz the sender spins between ticks rather than sleeping.
+
+using namespace ofxPerceptionNeuron;
+
+static const int MAX_AVATARS = 256;
+static const int SYNTHETIC_FRAMES = 240; // one loop of the generated motion
+static const uint64_t SPIN_NS = 200000; // sleeping overshoots by about this much
+static const uint64_t ACCEPT_INTERVAL_NS = 10000000;
+static const int SEND_BUFFER = 1 << 20;
+static const size_t PACKET_SIZE = sizeof(BvhDataHeader) + NeuronSkeleton::NUM_CHANNELS * sizeof(float);
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void interrupt(int)
+{
+    interrupted = 1;
+}
+
+static uint64_t steadyNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void waitUntil(uint64_t t)
+{
+    for (;;) {
+        const uint64_t now = steadyNow();
+        if (now >= t) {
+            return;
+        }
+        if (t - now > SPIN_NS) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(t - now - SPIN_NS));
+        }
+    }
+}
+
+static void setNonBlocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+struct Settings
+{
+    int tcp_port = 7001; // 0 disables the server
+    vector<pair<string, int> > udp_targets;
+    vector<string> files;
+    int avatars = 1;
+    double rate = 60;
+    double seconds = 0;
+    double loss = 0;
+    double reorder = 0;
+    double jitter_us = 0;
+    unsigned seed = 1;
+};
+
+#pragma mark - motion
+
+// channel data of every avatar at every tick, from files or generated
+class Motion
+{
+public:
+    bool setup(const Settings& settings)
+    {
+        for (const auto& path : settings.files) {
+            unique_ptr<ofxBvh> bvh(new ofxBvh());
+            if (!bvh->loadFile(path) || bvh->getNumFrames() == 0) {
+                fprintf(stderr, "can't load %s\n", path.c_str());
+                return false;
+            }
+            if (bvh->getHierarchy()->getNumChannels() != NeuronSkeleton::NUM_CHANNELS) {
+                fprintf(stderr, "%s has %d channels, not the %d of the Axis Neuron hierarchy with displacement\n",
+                        path.c_str(), bvh->getHierarchy()->getNumChannels(), int(NeuronSkeleton::NUM_CHANNELS));
+                return false;
+            }
+            files.push_back(std::move(bvh));
+        }
+        if (files.empty()) {
+            makeSynthetic();
+        }
+        return true;
+    }
+    
+    // avatars sharing a clip are offset in time so they don't move in unison
+    const float* get(int avatar, uint64_t tick) const
+    {
+        if (files.empty()) {
+            const uint64_t frame = (tick + avatar * 37) % SYNTHETIC_FRAMES;
+            return &synthetic[frame * NeuronSkeleton::NUM_CHANNELS];
+        }
+        const ofxBvh& bvh = *files[avatar % files.size()];
+        const uint64_t offset = avatar / files.size() * 37;
+        return bvh.getFrameData(int((tick + offset) % bvh.getNumFrames()));
+    }
+
+protected:
+    vector<unique_ptr<ofxBvh> > files;
+    vector<float> synthetic; // SYNTHETIC_FRAMES frames back to back
+    
+    // the template positions and a sway on every rotation, looping seamlessly
+    void makeSynthetic()
+    {
+        synthetic.resize(SYNTHETIC_FRAMES * NeuronSkeleton::NUM_CHANNELS);
+        for (int f=0; f<SYNTHETIC_FRAMES; ++f) {
+            const float t = TWO_PI * f / SYNTHETIC_FRAMES;
+            for (int k=0; k<NeuronSkeleton::NUM_ROTATIONS; ++k) {
+                const int j = NeuronSkeleton::rotation_joints[k];
+                float* v = &synthetic[f * NeuronSkeleton::NUM_CHANNELS + k * NeuronSkeleton::CHANNELS_PER_JOINT];
+                const float phase = t + 0.7f * k;
+                v[0] = NeuronSkeleton::offsets[j][0];
+                v[1] = NeuronSkeleton::offsets[j][1];
+                v[2] = NeuronSkeleton::offsets[j][2];
+                v[3] = 30 * sinf(phase);
+                v[4] = 20 * sinf(2 * phase);
+                v[5] = 10 * cosf(phase);
+            }
+        }
+    }
+};
+
+#pragma mark - TCP
+
+// accepts any number of clients and sends each the same bytes
+class TcpServer
+{
+public:
+    ~TcpServer()
+    {
+        for (auto& c : clients) {
+            ::close(c.fd);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    
+    bool setup(int port)
+    {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return false;
+        }
+        const int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+            fprintf(stderr, "can't listen on TCP port %d: %s\n", port, strerror(errno));
+            return false;
+        }
+        setNonBlocking(fd);
+        return true;
+    }
+    
+    void accept()
+    {
+        for (;;) {
+            const int c = ::accept(fd, nullptr, nullptr);
+            if (c < 0) {
+                return;
+            }
+            setNonBlocking(c);
+            const int on = 1;
+            setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            setsockopt(c, SOL_SOCKET, SO_SNDBUF, &SEND_BUFFER, sizeof(SEND_BUFFER));
+            clients.push_back(Client());
+            clients.back().fd = c;
+            fprintf(stderr, "TCP client connected (%d)\n", int(clients.size()));
+        }
+    }
+    
+    // data holds num_packets whole packets
+    void send(const uint8_t* data, size_t size, int num_packets)
+    {
+        for (size_t i=0; i<clients.size(); ) {
+            Client& c = clients[i];
+            // finish the last partly sent tick first, or skip this one
+            bool ok = write(c, c.pending.data() + c.pending_offset, c.pending.size() - c.pending_offset, c.pending_offset);
+            if (ok && c.pending_offset == c.pending.size()) {
+                c.pending.clear();
+                c.pending_offset = 0;
+                size_t sent = 0;
+                ok = write(c, data, size, sent);
+                if (ok && sent < size) {
+                    c.pending.assign(data + sent, data + size);
+                }
+            } else if (ok) {
+                num_stalled += num_packets;
+            }
+            if (!ok) {
+                ::close(c.fd);
+                clients.erase(clients.begin() + i);
+                fprintf(stderr, "TCP client disconnected (%d)\n", int(clients.size()));
+                continue;
+            }
+            ++i;
+        }
+    }
+    
+    int getNumClients() const { return int(clients.size()); }
+    uint64_t getNumStalled() const { return num_stalled; }
+
+protected:
+    struct Client
+    {
+        int fd = -1;
+        vector<uint8_t> pending; // rest of a partly sent tick
+        size_t pending_offset = 0;
+    };
+    
+    int fd = -1;
+    vector<Client> clients;
+    uint64_t num_stalled = 0; // packets skipped for slow clients
+    
+    // sends what the socket takes, advancing offset; false if the client is gone
+    static bool write(Client& c, const uint8_t* data, size_t size, size_t& offset)
+    {
+        size_t done = 0;
+        while (done < size) {
+            const ssize_t n = ::send(c.fd, data + done, size - done, 0);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                offset += done;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            done += n;
+        }
+        offset += done;
+        return true;
+    }
+};
+
+#pragma mark - UDP
+
+// one datagram per packet to a single target, in batches where sendmmsg exists
+class UdpSender
+{
+public:
+    ~UdpSender()
+    {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    
+    bool setup(const string& host, int port)
+    {
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo* res = nullptr;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0) {
+            fprintf(stderr, "can't resolve %s\n", host.c_str());
+            return false;
+        }
+        fd = socket(res->ai_family, SOCK_DGRAM, 0);
+        const bool ok = fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) == 0;
+        freeaddrinfo(res);
+        if (!ok) {
+            fprintf(stderr, "can't send to %s:%d: %s\n", host.c_str(), port, strerror(errno));
+            return false;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &SEND_BUFFER, sizeof(SEND_BUFFER));
+        setNonBlocking(fd);
+        return true;
+    }
+    
+    void send(const uint8_t* data, int num_packets)
+    {
+#ifdef __linux__
+        static const int BATCH = 64;
+        iovec iov[BATCH];
+        mmsghdr msgs[BATCH];
+        memset(msgs, 0, sizeof(msgs));
+        for (int i=0; i<num_packets; ) {
+            const int n = min(BATCH, num_packets - i);
+            for (int k=0; k<n; ++k) {
+                iov[k].iov_base = const_cast<uint8_t*>(data + (i + k) * PACKET_SIZE);
+                iov[k].iov_len = PACKET_SIZE;
+                msgs[k].msg_hdr.msg_iov = &iov[k];
+                msgs[k].msg_hdr.msg_iovlen = 1;
+            }
+            const int sent = sendmmsg(fd, msgs, n, 0);
+            if (sent <= 0) {
+                // a full buffer or nobody listening yet: the rest of the tick is gone
+                num_dropped += num_packets - i;
+                return;
+            }
+            i += sent;
+        }
+#else
+        for (int i=0; i<num_packets; ++i) {
+            if (::send(fd, data + i * PACKET_SIZE, PACKET_SIZE, 0) < 0) {
+                ++num_dropped;
+            }
+        }
+#endif
+    }
+    
+    uint64_t getNumDropped() const { return num_dropped; }
+
+protected:
+    int fd = -1;
+    uint64_t num_dropped = 0; // packets the socket refused
+};
+
+#pragma mark - emulator
+
+static void makeHeader(int avatar, BvhDataHeader& h)
+{
+    memset(&h, 0, sizeof(h));
+    h.Token1 = StreamDecoder::BVH_TOKEN_BEGIN;
+    h.Token2 = StreamDecoder::BVH_TOKEN_END;
+    h.DataVersion.Major = 1;
+    h.DataCount = NeuronSkeleton::NUM_CHANNELS;
+    h.WithDisp = 1;
+    h.AvatarIndex = avatar;
+    snprintf(reinterpret_cast<char*>(h.AvatarName), sizeof(h.AvatarName), "Avatar%d", avatar);
+}
+
+static bool parseArguments(int argc, char** argv, Settings& settings)
+{
+    for (int i=1; i<argc; ++i) {
+        const string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--tcp") {
+            settings.tcp_port = atoi(value);
+        } else if (arg == "--udp") {
+            // host:port, or a port on this machine
+            const char* colon = strrchr(value, ':');
+            const string host = colon ? string(value, colon) : "127.0.0.1";
+            const int port = atoi(colon ? colon + 1 : value);
+            if (port <= 0) {
+                return false;
+            }
+            settings.udp_targets.push_back(make_pair(host, port));
+        } else if (arg == "--bvh") {
+            settings.files.push_back(value);
+        } else if (arg == "--avatars") {
+            settings.avatars = atoi(value);
+        } else if (arg == "--rate") {
+            settings.rate = atof(value);
+        } else if (arg == "--seconds") {
+            settings.seconds = atof(value);
+        } else if (arg == "--loss") {
+            settings.loss = atof(value);
+        } else if (arg == "--reorder") {
+            settings.reorder = atof(value);
+        } else if (arg == "--jitter") {
+            settings.jitter_us = atof(value);
+        } else if (arg == "--seed") {
+            settings.seed = unsigned(strtoul(value, nullptr, 10));
+        } else {
+            return false;
+        }
+    }
+    return settings.avatars >= 1 && settings.avatars <= MAX_AVATARS && settings.rate > 0
+        && settings.loss >= 0 && settings.loss <= 1 && settings.reorder >= 0 && settings.reorder <= 1
+        && settings.jitter_us >= 0 && (settings.tcp_port > 0 || !settings.udp_targets.empty());
+}
+
+//========================================================================
+int main(int argc, char** argv)
+{
+    Settings settings;
+    if (!parseArguments(argc, argv, settings)) {
+        fprintf(stderr, "usage: %s [--tcp 7001] [--udp host:port ...] [--bvh file ...] [--avatars 1] [--rate 60]\n"
+                "       [--seconds 0] [--loss 0] [--reorder 0] [--jitter 0] [--seed 1]\n", argv[0]);
+        return 1;
+    }
+    ofSetLogLevel(OF_LOG_WARNING);
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+    signal(SIGPIPE, SIG_IGN);
+    
+    Motion motion;
+    if (!motion.setup(settings)) {
+        return 1;
+    }
+    unique_ptr<TcpServer> tcp;
+    if (settings.tcp_port > 0) {
+        tcp.reset(new TcpServer());
+        if (!tcp->setup(settings.tcp_port)) {
+            return 1;
+        }
+    }
+    vector<unique_ptr<UdpSender> > udp;
+    for (const auto& target : settings.udp_targets) {
+        udp.push_back(unique_ptr<UdpSender>(new UdpSender()));
+        if (!udp.back()->setup(target.first, target.second)) {
+            return 1;
+        }
+    }
+    
+    const int avatars = settings.avatars;
+    vector<BvhDataHeader> headers(avatars);
+    for (int a=0; a<avatars; ++a) {
+        makeHeader(a, headers[a]);
+    }
+    // a tick sends each avatar's packet and possibly one held back from before
+    vector<uint8_t> tick_packets(2 * avatars * PACKET_SIZE);
+    vector<uint8_t> held(avatars * PACKET_SIZE);
+    vector<bool> is_held(avatars, false);
+    
+    std::mt19937 random(settings.seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    uint64_t num_packets = 0, num_lost = 0, num_reordered = 0, num_late = 0;
+    uint64_t max_late_ns = 0;
+    
+    fprintf(stderr, "sending %d avatar%s at %g Hz (%s motion)\n", avatars, avatars > 1 ? "s" : "",
+            settings.rate, settings.files.empty() ? "synthetic" : "replayed");
+    const double period_ns = 1e9 / settings.rate;
+    const uint64_t start = steadyNow();
+    const uint64_t end = settings.seconds > 0 ? start + uint64_t(settings.seconds * 1e9) : 0;
+    uint64_t next_accept = start;
+    uint64_t next_report = start + 1000000000ull;
+    uint64_t report_ticks = 0;
+    for (uint64_t tick=0; !interrupted; ++tick) {
+        // scheduled from the start rather than the last tick, so the rate doesn't drift
+        const uint64_t due = start + uint64_t(tick * period_ns) + uint64_t(uniform(random) * settings.jitter_us * 1000);
+        if (end && due >= end) {
+            break;
+        }
+        waitUntil(due);
+        const uint64_t now = steadyNow();
+        // behind by more than a period: the emulator, not the receiver, is the bottleneck
+        if (now - due > period_ns) {
+            ++num_late;
+        }
+        max_late_ns = max(max_late_ns, now - due);
+        
+        if (tcp && now >= next_accept) {
+            tcp->accept();
+            next_accept = now + ACCEPT_INTERVAL_NS;
+        }
+        
+        uint8_t* out = tick_packets.data();
+        for (int a=0; a<avatars; ++a) {
+            headers[a].FrameIndex = uint32_t(tick);
+            if (uniform(random) < settings.loss) {
+                ++num_lost;
+                continue;
+            }
+            uint8_t* packet = out;
+            memcpy(packet, &headers[a], sizeof(BvhDataHeader));
+            memcpy(packet + sizeof(BvhDataHeader), motion.get(a, tick), NeuronSkeleton::NUM_CHANNELS * sizeof(float));
+            if (is_held[a]) {
+                memcpy(packet + PACKET_SIZE, &held[a * PACKET_SIZE], PACKET_SIZE);
+                is_held[a] = false;
+                out += 2 * PACKET_SIZE;
+            } else if (uniform(random) < settings.reorder) {
+                memcpy(&held[a * PACKET_SIZE], packet, PACKET_SIZE);
+                is_held[a] = true;
+                ++num_reordered;
+            } else {
+                out += PACKET_SIZE;
+            }
+        }
+        const size_t size = out - tick_packets.data();
+        const int count = int(size / PACKET_SIZE);
+        if (tcp) {
+            tcp->send(tick_packets.data(), size, count);
+        }
+        for (auto& u : udp) {
+            u->send(tick_packets.data(), count);
+        }
+        num_packets += count;
+        ++report_ticks;
+        
+        if (now >= next_report) {
+            uint64_t udp_dropped = 0;
+            for (auto& u : udp) {
+                udp_dropped += u->getNumDropped();
+            }
+            fprintf(stderr, "%.0f s: %llu ticks/s, %llu packets, %d TCP clients, lost %llu, reordered %llu,"
+                    " stalled %llu, UDP dropped %llu, late ticks %llu (max %.0f us)\n",
+                    (now - start) * 1e-9, (unsigned long long)report_ticks, (unsigned long long)num_packets,
+                    tcp ? tcp->getNumClients() : 0, (unsigned long long)num_lost, (unsigned long long)num_reordered,
+                    tcp ? (unsigned long long)tcp->getNumStalled() : 0ull, (unsigned long long)udp_dropped,
+                    (unsigned long long)num_late, max_late_ns * 1e-3);
+            report_ticks = 0;
+            max_late_ns = 0;
+            next_report += 1000000000ull;
+        }
+    }
+    fprintf(stderr, "sent %llu packets (lost %llu, reordered %llu)\n", (unsigned long long)num_packets,
+            (unsigned long long)num_lost, (unsigned long long)num_reordered);
+    return 0;
+}
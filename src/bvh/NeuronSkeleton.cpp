@@ -0,0 +1,219 @@
+#include "NeuronSkeleton.h"
+#include "ofxBvhKernels.h"
+
+namespace ofxPerceptionNeuron
+{
+namespace NeuronSkeleton
+{
+    namespace
+    {
+        inline void solveLocal(Pose& pose, const float* data, const Rotations& r, int k)
+        {
+            const int i = rotation_joints[k];
+            const float* v = data + k * CHANNELS_PER_JOINT;
+            float* m = pose.matrices[i].getPtr();
+            ofVec3f& t = pose.offsets[i];
+            t.x = v[0];
+            t.y = v[1];
+            t.z = v[2];
+            ofxBvhKernels::quatToMatrix(m, r.x[k], r.y[k], r.z[k], r.w[k]);
+            m[12] = t.x;
+            m[13] = t.y;
+            m[14] = t.z;
+            m[15] = 1;
+        }
+        
+        ofxBvhHierarchyRef buildHierarchy()
+        {
+            shared_ptr<ofxBvhHierarchy> h = make_shared<ofxBvhHierarchy>();
+            const vector<ofxBvhHierarchy::CHANNEL> channels = {
+                ofxBvhHierarchy::X_POSITION, ofxBvhHierarchy::Y_POSITION, ofxBvhHierarchy::Z_POSITION,
+                ofxBvhHierarchy::Y_ROTATION, ofxBvhHierarchy::X_ROTATION, ofxBvhHierarchy::Z_ROTATION
+            };
+            const vector<ofxBvhHierarchy::CHANNEL> none;
+            for (int i=0; i<NUM_JOINTS; ++i) {
+                h->addJoint(names[i], parents[i], ofVec3f(offsets[i][0], offsets[i][1], offsets[i][2]),
+                            channel_offsets[i] < 0 ? none : channels);
+            }
+            return h;
+        }
+    }
+    
+    static_assert(parents[0] < 0 && rotation_joints[0] == 0, "the root must be the first joint");
+    static_assert(LeftHandPinky3End == NUM_JOINTS - 1, "JointId must name every joint");
+    
+    // FNV-1a with a seed chosen so the template's 60 distinct names land in
+    // distinct slots of name_table
+    static const uint32_t NAME_HASH_SEED = 811;
+    
+    static inline uint8_t hashName(const char* name, size_t length)
+    {
+        uint32_t h = 2166136261u ^ NAME_HASH_SEED;
+        for (size_t i=0; i<length; ++i) {
+            h = (h ^ uint8_t(name[i])) * 16777619u;
+        }
+        return uint8_t(h >> 24);
+    }
+    
+    // joint by hashName(), -1 for no joint
+    static const int8_t name_table[256] = {
+        -1, -1, 34, -1, -1, -1, -1, -1, -1, 60, 59, 58, -1, 52, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, 54, 55, -1, 53, -1, -1, 27, 26, 25,
+        -1, -1, 24, -1, -1, -1, -1, 0, -1, -1, -1, 40, 41, 42, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, 30, 31, 32, -1, -1, -1, -1, 47,
+        -1, -1, 44, -1, -1, -1, 10, -1, 12, 11, 37, 36, 35, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 18, 57, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, -1, -1, -1,
+        -1, 67, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 46, 16, -1, -1,
+        -1, 49, 50, -1, 48, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, 14, -1, -1, -1, -1, -1, -1, -1, 6,
+        -1, -1, 71, -1, -1, -1, -1, -1, 29, -1, -1, -1, 68, -1, 70, 69,
+        -1, -1, -1, 9, -1, -1, -1, -1, 19, -1, -1, -1, -1, -1, -1, -1,
+        63, 64, 65, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 39,
+        -1, -1, -1, -1, -1, -1, 5, -1, -1, 3, 17, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, 45, -1, 22,
+        21, 20, -1, -1, -1, 2, -1, -1, -1, -1, 7, -1, -1, -1, 13, -1,
+    };
+    
+    Pose::Pose()
+    {
+        for (int i=0; i<NUM_JOINTS; ++i) {
+            offsets[i].set(NeuronSkeleton::offsets[i][0], NeuronSkeleton::offsets[i][1], NeuronSkeleton::offsets[i][2]);
+        }
+    }
+    
+    // The layout is known, so there is no channel program to interpret: every
+    // joint with channels is position + YXZ rotation and every End Site is a
+    // leaf. Fully unrolling the joints was measured slower than these loops
+    // over constant tables (the unrolled body no longer fits the I-cache).
+    void Pose::solve(const float* data)
+    {
+        Rotations r;
+        r.set(data);
+        solve(data, r);
+    }
+    
+    void Pose::solve(const float* data, const Rotations& r)
+    {
+        solveLocal(*this, data, r, 0);
+        global_matrices[0] = matrices[0];
+        for (int k=1; k<NUM_ROTATIONS; ++k) {
+            const int i = rotation_joints[k];
+            solveLocal(*this, data, r, k);
+            ofxBvhKernels::composeAffine(global_matrices[i].getPtr(), matrices[i].getPtr(),
+                                         global_matrices[parents[i]].getPtr());
+        }
+        
+        // End Sites carry no channels: identity local transform, as in ofxBvh
+        for (int k=0; k<NUM_SITES; ++k) {
+            const int i = site_joints[k];
+            offsets[i] = ofVec3f();
+            matrices[i].makeIdentityMatrix();
+            global_matrices[i] = global_matrices[parents[i]];
+        }
+    }
+    
+    void Pose::setRest()
+    {
+        float data[NUM_CHANNELS] = {};
+        for (int k=0; k<NUM_ROTATIONS; ++k) {
+            const int i = rotation_joints[k];
+            data[k * CHANNELS_PER_JOINT + 0] = NeuronSkeleton::offsets[i][0];
+            data[k * CHANNELS_PER_JOINT + 1] = NeuronSkeleton::offsets[i][1];
+            data[k * CHANNELS_PER_JOINT + 2] = NeuronSkeleton::offsets[i][2];
+        }
+        solve(data);
+    }
+    
+    void expandChannels(const float* data, float* out)
+    {
+        for (int c=0; c<CHANNELS_PER_JOINT; ++c) {
+            out[c] = data[c];
+        }
+        for (int k=1; k<NUM_ROTATIONS; ++k) {
+            const int i = rotation_joints[k];
+            const float* r = data + 3 + k * 3;
+            float* v = out + k * CHANNELS_PER_JOINT;
+            v[0] = offsets[i][0];
+            v[1] = offsets[i][1];
+            v[2] = offsets[i][2];
+            v[3] = r[0];
+            v[4] = r[1];
+            v[5] = r[2];
+        }
+    }
+    
+    void Rotations::set(const float* data)
+    {
+        alignas(64) float ey[ROTATION_STRIDE], ex[ROTATION_STRIDE], ez[ROTATION_STRIDE];
+        for (int k=0; k<NUM_ROTATIONS; ++k) {
+            const float* v = data + k * CHANNELS_PER_JOINT + 3;
+            ey[k] = v[0];
+            ex[k] = v[1];
+            ez[k] = v[2];
+        }
+        ofxBvhKernels::eulerYXZToQuat(ey, ex, ez, x, y, z, w, NUM_ROTATIONS);
+    }
+    
+    void Rotations::slerp(const Rotations& a, const Rotations& b, float t)
+    {
+        for (int k=0; k<NUM_ROTATIONS; ++k) {
+            float bx = b.x[k], by = b.y[k], bz = b.z[k], bw = b.w[k];
+            float d = a.x[k] * bx + a.y[k] * by + a.z[k] * bz + a.w[k] * bw;
+            if (d < 0) {
+                d = -d;
+                bx = -bx;
+                by = -by;
+                bz = -bz;
+                bw = -bw;
+            }
+            float sa = 1 - t, sb = t;
+            // nearly parallel: lerp is as accurate and avoids dividing by sin(~0)
+            if (d < 0.9995f) {
+                const float theta = acosf(d);
+                const float inv_sin = 1 / sinf(theta);
+                sa = sinf(sa * theta) * inv_sin;
+                sb = sinf(sb * theta) * inv_sin;
+            }
+            float qx = sa * a.x[k] + sb * bx;
+            float qy = sa * a.y[k] + sb * by;
+            float qz = sa * a.z[k] + sb * bz;
+            float qw = sa * a.w[k] + sb * bw;
+            const float inv_len = 1 / sqrtf(qx * qx + qy * qy + qz * qz + qw * qw);
+            x[k] = qx * inv_len;
+            y[k] = qy * inv_len;
+            z[k] = qz * inv_len;
+            w[k] = qw * inv_len;
+        }
+    }
+    
+    int findJoint(const char* name, size_t length)
+    {
+        const int i = name_table[hashName(name, length)];
+        return i >= 0 && strlen(names[i]) == length && memcmp(names[i], name, length) == 0 ? i : -1;
+    }
+    
+    const ofxBvhHierarchyRef& getHierarchy()
+    {
+        static const ofxBvhHierarchyRef hierarchy = buildHierarchy();
+        return hierarchy;
+    }
+    
+    bool matches(const ofxBvhHierarchy& hierarchy)
+    {
+        if (hierarchy.getNumJoints() != NUM_JOINTS || hierarchy.getNumChannels() != NUM_CHANNELS) {
+            return false;
+        }
+        for (int i=0; i<NUM_JOINTS; ++i) {
+            const ofxBvhHierarchy::PROGRAM program = channel_offsets[i] < 0
+                ? ofxBvhHierarchy::PROGRAM_NONE : ofxBvhHierarchy::PROGRAM_POS_ROT_YXZ;
+            const ofVec3f& o = hierarchy.getInitialOffset(i);
+            if (hierarchy.getParent(i) != parents[i] || hierarchy.getProgram(i) != program ||
+                o.x != offsets[i][0] || o.y != offsets[i][1] || o.z != offsets[i][2]) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+}
@@ -0,0 +1,352 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxBvhHierarchy.h"
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+// Compile-time description of the Axis Neuron BVH template (see BvhTemplate.h)
+// and a forward kinematics solver specialized for it. Joints are numbered as
+// ofxBvh numbers them, parent before child with End Sites included, so poses
+// line up index for index with the dynamic path.
+namespace ofxPerceptionNeuron
+{
+    // names for lookups: a string_view where the compiler has one, so
+    // literals and slices are never copied into a string
+#if __cplusplus >= 201703L
+    typedef std::string_view NameRef;
+#else
+    typedef const std::string& NameRef;
+#endif
+    
+namespace NeuronSkeleton
+{
+    enum
+    {
+        NUM_JOINTS = 72,
+        NUM_ROTATIONS = 59, // joints with channels
+        NUM_SITES = 13,
+        NUM_CHANNELS = 354,
+        // sent without displacement: Hips position and rotation, rotation only for the rest
+        NUM_CHANNELS_NO_DISP = 3 + 3 * NUM_ROTATIONS
+    };
+    
+    // every joint with channels has Xposition Yposition Zposition Yrotation Xrotation Zrotation
+    static constexpr int CHANNELS_PER_JOINT = 6;
+    
+    static constexpr const char* names[NUM_JOINTS] = {
+        "Hips",
+        "RightUpLeg",
+        "RightLeg",
+        "RightFoot",
+        "Site", // 4, child of RightFoot
+        "LeftUpLeg",
+        "LeftLeg",
+        "LeftFoot",
+        "Site", // 8, child of LeftFoot
+        "Spine",
+        "Spine1",
+        "Spine2",
+        "Spine3",
+        "Neck",
+        "Head",
+        "Site", // 15, child of Head
+        "RightShoulder",
+        "RightArm",
+        "RightForeArm",
+        "RightHand",
+        "RightHandThumb1",
+        "RightHandThumb2",
+        "RightHandThumb3",
+        "Site", // 23, child of RightHandThumb3
+        "RightInHandIndex",
+        "RightHandIndex1",
+        "RightHandIndex2",
+        "RightHandIndex3",
+        "Site", // 28, child of RightHandIndex3
+        "RightInHandMiddle",
+        "RightHandMiddle1",
+        "RightHandMiddle2",
+        "RightHandMiddle3",
+        "Site", // 33, child of RightHandMiddle3
+        "RightInHandRing",
+        "RightHandRing1",
+        "RightHandRing2",
+        "RightHandRing3",
+        "Site", // 38, child of RightHandRing3
+        "RightInHandPinky",
+        "RightHandPinky1",
+        "RightHandPinky2",
+        "RightHandPinky3",
+        "Site", // 43, child of RightHandPinky3
+        "LeftShoulder",
+        "LeftArm",
+        "LeftForeArm",
+        "LeftHand",
+        "LeftHandThumb1",
+        "LeftHandThumb2",
+        "LeftHandThumb3",
+        "Site", // 51, child of LeftHandThumb3
+        "LeftInHandIndex",
+        "LeftHandIndex1",
+        "LeftHandIndex2",
+        "LeftHandIndex3",
+        "Site", // 56, child of LeftHandIndex3
+        "LeftInHandMiddle",
+        "LeftHandMiddle1",
+        "LeftHandMiddle2",
+        "LeftHandMiddle3",
+        "Site", // 61, child of LeftHandMiddle3
+        "LeftInHandRing",
+        "LeftHandRing1",
+        "LeftHandRing2",
+        "LeftHandRing3",
+        "Site", // 66, child of LeftHandRing3
+        "LeftInHandPinky",
+        "LeftHandPinky1",
+        "LeftHandPinky2",
+        "LeftHandPinky3",
+        "Site", // 71, child of LeftHandPinky3
+    };
+    
+    // joint indices by name, e.g. skeleton.getJoint(NeuronSkeleton::LeftHand).
+    // End Sites are named after their parent.
+    enum JointId
+    {
+        Hips = 0,
+        RightUpLeg,
+        RightLeg,
+        RightFoot,
+        RightFootEnd,
+        LeftUpLeg,
+        LeftLeg,
+        LeftFoot,
+        LeftFootEnd,
+        Spine,
+        Spine1,
+        Spine2,
+        Spine3,
+        Neck,
+        Head,
+        HeadEnd,
+        RightShoulder,
+        RightArm,
+        RightForeArm,
+        RightHand,
+        RightHandThumb1,
+        RightHandThumb2,
+        RightHandThumb3,
+        RightHandThumb3End,
+        RightInHandIndex,
+        RightHandIndex1,
+        RightHandIndex2,
+        RightHandIndex3,
+        RightHandIndex3End,
+        RightInHandMiddle,
+        RightHandMiddle1,
+        RightHandMiddle2,
+        RightHandMiddle3,
+        RightHandMiddle3End,
+        RightInHandRing,
+        RightHandRing1,
+        RightHandRing2,
+        RightHandRing3,
+        RightHandRing3End,
+        RightInHandPinky,
+        RightHandPinky1,
+        RightHandPinky2,
+        RightHandPinky3,
+        RightHandPinky3End,
+        LeftShoulder,
+        LeftArm,
+        LeftForeArm,
+        LeftHand,
+        LeftHandThumb1,
+        LeftHandThumb2,
+        LeftHandThumb3,
+        LeftHandThumb3End,
+        LeftInHandIndex,
+        LeftHandIndex1,
+        LeftHandIndex2,
+        LeftHandIndex3,
+        LeftHandIndex3End,
+        LeftInHandMiddle,
+        LeftHandMiddle1,
+        LeftHandMiddle2,
+        LeftHandMiddle3,
+        LeftHandMiddle3End,
+        LeftInHandRing,
+        LeftHandRing1,
+        LeftHandRing2,
+        LeftHandRing3,
+        LeftHandRing3End,
+        LeftInHandPinky,
+        LeftHandPinky1,
+        LeftHandPinky2,
+        LeftHandPinky3,
+        LeftHandPinky3End,
+    };
+    
+    static constexpr int parents[NUM_JOINTS] = {
+        -1, 0, 1, 2, 3, 0, 5, 6, 7, 0, 9, 10,
+        11, 12, 13, 14, 12, 16, 17, 18, 19, 20, 21, 22,
+        19, 24, 25, 26, 27, 19, 29, 30, 31, 32, 19, 34,
+        35, 36, 37, 19, 39, 40, 41, 42, 12, 44, 45, 46,
+        47, 48, 49, 50, 47, 52, 53, 54, 55, 47, 57, 58,
+        59, 60, 47, 62, 63, 64, 65, 47, 67, 68, 69, 70,
+    };
+    
+    // first channel of each joint, -1 for End Sites
+    static constexpr int channel_offsets[NUM_JOINTS] = {
+        0, 6, 12, 18, -1, 24, 30, 36, -1, 42, 48, 54,
+        60, 66, 72, -1, 78, 84, 90, 96, 102, 108, 114, -1,
+        120, 126, 132, 138, -1, 144, 150, 156, 162, -1, 168, 174,
+        180, 186, -1, 192, 198, 204, 210, -1, 216, 222, 228, 234,
+        240, 246, 252, -1, 258, 264, 270, 276, -1, 282, 288, 294,
+        300, -1, 306, 312, 318, 324, -1, 330, 336, 342, 348, -1,
+    };
+    
+    // joints with channels in order; joint rotation_joints[k] reads channels k * CHANNELS_PER_JOINT onwards
+    static constexpr int rotation_joints[NUM_ROTATIONS] = {
+        0, 1, 2, 3, 5, 6, 7, 9, 10, 11, 12, 13,
+        14, 16, 17, 18, 19, 20, 21, 22, 24, 25, 26, 27,
+        29, 30, 31, 32, 34, 35, 36, 37, 39, 40, 41, 42,
+        44, 45, 46, 47, 48, 49, 50, 52, 53, 54, 55, 57,
+        58, 59, 60, 62, 63, 64, 65, 67, 68, 69, 70,
+    };
+    
+    static constexpr int site_joints[NUM_SITES] = {
+        4, 8, 15, 23, 28, 33, 38, 43, 51, 56, 61, 66,
+        71,
+    };
+    
+    static constexpr float offsets[NUM_JOINTS][3] = {
+        { 0.000f, 95.729f, 0.000f }, // Hips
+        { -9.625f, -1.639f, 0.000f }, // RightUpLeg
+        { 0.000f, -41.481f, 0.000f }, // RightLeg
+        { 0.000f, -43.120f, 0.000f }, // RightFoot
+        { 0.000f, -7.850f, 17.850f }, // Site
+        { 9.625f, -1.639f, 0.000f }, // LeftUpLeg
+        { 0.000f, -43.120f, 0.000f }, // LeftLeg
+        { 0.000f, -43.120f, 0.000f }, // LeftFoot
+        { 0.000f, -7.850f, 17.850f }, // Site
+        { 0.000f, 16.395f, 0.000f }, // Spine
+        { 0.000f, 10.023f, 0.000f }, // Spine1
+        { 0.000f, 10.437f, 0.000f }, // Spine2
+        { 0.000f, 10.023f, 0.000f }, // Spine3
+        { 0.000f, 10.713f, 0.000f }, // Neck
+        { 0.000f, 9.720f, 0.000f }, // Head
+        { 0.000f, 16.450f, 0.000f }, // Site
+        { -3.275f, 7.142f, 0.000f }, // RightShoulder
+        { -13.100f, 0.000f, 0.000f }, // RightArm
+        { -27.250f, 0.000f, 0.000f }, // RightForeArm
+        { -26.750f, 0.000f, 0.000f }, // RightHand
+        { -2.560f, 0.196f, 3.210f }, // RightHandThumb1
+        { -3.788f, 0.000f, 0.000f }, // RightHandThumb2
+        { -2.631f, 0.000f, 0.000f }, // RightHandThumb3
+        { -2.256f, 0.000f, 0.000f }, // Site
+        { -3.316f, 0.523f, 2.035f }, // RightInHandIndex
+        { -5.366f, -0.094f, 1.028f }, // RightHandIndex1
+        { -3.723f, 0.000f, 0.000f }, // RightHandIndex2
+        { -2.111f, 0.000f, 0.000f }, // RightHandIndex3
+        { -1.857f, 0.000f, 0.000f }, // Site
+        { -3.479f, 0.532f, 0.778f }, // RightInHandMiddle
+        { -5.322f, -0.086f, 0.323f }, // RightHandMiddle1
+        { -4.062f, 0.000f, 0.000f }, // RightHandMiddle2
+        { -2.547f, 0.000f, 0.000f }, // RightHandMiddle3
+        { -2.031f, 0.000f, 0.000f }, // Site
+        { -3.461f, 0.553f, -0.133f }, // RightInHandRing
+        { -4.767f, -0.023f, -0.493f }, // RightHandRing1
+        { -3.541f, 0.000f, 0.000f }, // RightHandRing2
+        { -2.456f, 0.000f, 0.000f }, // RightHandRing3
+        { -1.910f, 0.000f, 0.000f }, // Site
+        { -3.251f, 0.483f, -1.236f }, // RightInHandPinky
+        { -4.259f, -0.023f, -1.122f }, // RightHandPinky1
+        { -2.835f, 0.000f, 0.000f }, // RightHandPinky2
+        { -1.792f, 0.000f, 0.000f }, // RightHandPinky3
+        { -1.692f, 0.000f, 0.000f }, // Site
+        { 3.275f, 7.142f, 0.000f }, // LeftShoulder
+        { 13.100f, 0.000f, 0.000f }, // LeftArm
+        { 27.250f, 0.000f, 0.000f }, // LeftForeArm
+        { 26.750f, 0.000f, 0.000f }, // LeftHand
+        { 2.560f, 0.196f, 3.210f }, // LeftHandThumb1
+        { 3.788f, 0.000f, 0.000f }, // LeftHandThumb2
+        { 2.631f, 0.000f, 0.000f }, // LeftHandThumb3
+        { 2.256f, 0.000f, 0.000f }, // Site
+        { 3.316f, 0.523f, 2.035f }, // LeftInHandIndex
+        { 5.366f, -0.094f, 1.028f }, // LeftHandIndex1
+        { 3.723f, 0.000f, 0.000f }, // LeftHandIndex2
+        { 2.111f, 0.000f, 0.000f }, // LeftHandIndex3
+        { 1.857f, 0.000f, 0.000f }, // Site
+        { 3.479f, 0.532f, 0.778f }, // LeftInHandMiddle
+        { 5.322f, -0.086f, 0.323f }, // LeftHandMiddle1
+        { 4.062f, 0.000f, 0.000f }, // LeftHandMiddle2
+        { 2.547f, 0.000f, 0.000f }, // LeftHandMiddle3
+        { 2.031f, 0.000f, 0.000f }, // Site
+        { 3.461f, 0.553f, -0.133f }, // LeftInHandRing
+        { 4.767f, -0.023f, -0.493f }, // LeftHandRing1
+        { 3.541f, 0.000f, 0.000f }, // LeftHandRing2
+        { 2.456f, 0.000f, 0.000f }, // LeftHandRing3
+        { 1.910f, 0.000f, 0.000f }, // Site
+        { 3.251f, 0.483f, -1.236f }, // LeftInHandPinky
+        { 4.259f, -0.023f, -1.122f }, // LeftHandPinky1
+        { 2.835f, 0.000f, 0.000f }, // LeftHandPinky2
+        { 1.792f, 0.000f, 0.000f }, // LeftHandPinky3
+        { 1.692f, 0.000f, 0.000f }, // Site
+    };
+    
+    // Local rotations of the joints with channels as quaternions, in
+    // rotation_joints order, structure of arrays. Rows are padded to whole
+    // cache lines for the SIMD kernels.
+    enum { ROTATION_STRIDE = (NUM_ROTATIONS + 15) & ~15 };
+    
+    struct alignas(64) Rotations
+    {
+        float x[ROTATION_STRIDE], y[ROTATION_STRIDE], z[ROTATION_STRIDE], w[ROTATION_STRIDE];
+        
+        // from the Euler channels of a frame of NUM_CHANNELS values
+        void set(const float* data);
+        // shortest-path slerp from a (t = 0) to b (t = 1)
+        void slerp(const Rotations& a, const Rotations& b, float t);
+    };
+    
+    // Pose buffers for one avatar. Everything is fixed size, so a pose costs a
+    // single allocation and no parsing.
+    struct Pose
+    {
+        ofVec3f offsets[NUM_JOINTS];
+        ofMatrix4x4 matrices[NUM_JOINTS];
+        ofMatrix4x4 global_matrices[NUM_JOINTS];
+        
+        Pose();
+        
+        // solves all local and global transforms. data must hold NUM_CHANNELS values.
+        void solve(const float* data);
+        // same, with the rotations given instead of taken from data's Euler channels
+        void solve(const float* data, const Rotations& rotations);
+        // the template's rest pose: every joint at its offset, no rotation
+        void setRest();
+    };
+    
+    // expands a frame of NUM_CHANNELS_NO_DISP values to the NUM_CHANNELS
+    // layout, with the template offsets as the positions of all but Hips
+    void expandChannels(const float* data, float* out);
+    
+    // Joint index by name without a string map: the name is hashed into a
+    // perfect hash table of the template's names and confirmed with one
+    // compare. -1 if the template has no such joint. End Sites share the name
+    // "Site", which resolves to the last one as in ofxBvhHierarchy::findJoint.
+    // Resolve names once and keep the index (or use JointId) on hot paths.
+    int findJoint(const char* name, size_t length);
+    inline int findJoint(NameRef name) { return findJoint(name.data(), name.size()); }
+    
+    // the template as an ofxBvhHierarchy, built on first use and shared by all callers
+    const ofxBvhHierarchyRef& getHierarchy();
+    
+    // true if the hierarchy is identical to this template, i.e. Pose::solve
+    // can stand in for ofxBvhSolver::solve
+    bool matches(const ofxBvhHierarchy& hierarchy);
+}
+}
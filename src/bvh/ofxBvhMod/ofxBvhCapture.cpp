@@ -0,0 +1,381 @@
+#include "ofxBvhCapture.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace ofxBvhCapture;
+
+namespace
+{
+	const char MAGIC[8] = { 'B', 'V', 'H', 'C', 'A', 'P', '1', '\0' };
+	
+	// one step of a 16 bit turn, exact in float
+	const float ANGLE_STEP = 360.0f / 65536.0f;
+	
+	enum MODE
+	{
+		MODE_CONSTANT,
+		MODE_DELTA,
+		MODE_LINEAR
+	};
+	
+	inline uint64_t zigzag(int64_t v) { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); }
+	inline int64_t unzigzag(uint64_t v) { return int64_t(v >> 1) ^ -int64_t(v & 1); }
+	
+	inline int varintSize(int64_t v)
+	{
+		uint64_t u = zigzag(v);
+		int n = 1;
+		while (u >= 0x80) { u >>= 7; n++; }
+		return n;
+	}
+	
+	inline void writeVarint(vector<uint8_t>& out, int64_t v)
+	{
+		uint64_t u = zigzag(v);
+		while (u >= 0x80)
+		{
+			out.push_back(uint8_t(u) | 0x80);
+			u >>= 7;
+		}
+		out.push_back(uint8_t(u));
+	}
+	
+	inline bool readVarint(const uint8_t*& p, const uint8_t* end, int64_t& v)
+	{
+		uint64_t u = 0;
+		for (int shift = 0; shift < 64 && p < end; shift += 7)
+		{
+			const uint8_t b = *p++;
+			u |= uint64_t(b & 0x7f) << shift;
+			if (b < 0x80)
+			{
+				v = unzigzag(u);
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	// rotations live on a 16 bit circle, so their residuals wrap too
+	inline int64_t wrap(int64_t v, bool rotation) { return rotation ? int64_t(int16_t(v)) : v; }
+	
+	inline int32_t quantize(float v, bool rotation, double inv_step)
+	{
+		if (v != v) return 0;
+		if (rotation) return int16_t(llround(fmod(v * (65536.0 / 360.0), 65536.0)));
+		return int32_t(llround(min(max(v * inv_step, -2147483648.0), 2147483647.0)));
+	}
+	
+	void encodeChannel(const int32_t* q, int n, bool rotation, vector<uint8_t>& out)
+	{
+		bool constant = true;
+		for (int f = 1; f < n && constant; f++) constant = q[f] == q[0];
+		
+		if (constant)
+		{
+			out.push_back(MODE_CONSTANT);
+			writeVarint(out, q[0]);
+			return;
+		}
+		
+		// pick whichever predictor codes this channel smaller
+		int delta_size = 0, linear_size = varintSize(wrap(int64_t(q[1]) - q[0], rotation));
+		for (int f = 1; f < n; f++) delta_size += varintSize(wrap(int64_t(q[f]) - q[f - 1], rotation));
+		for (int f = 2; f < n; f++) linear_size += varintSize(wrap(int64_t(q[f]) - (2 * int64_t(q[f - 1]) - q[f - 2]), rotation));
+		
+		const MODE mode = linear_size < delta_size ? MODE_LINEAR : MODE_DELTA;
+		out.push_back(mode);
+		writeVarint(out, q[0]);
+		writeVarint(out, wrap(int64_t(q[1]) - q[0], rotation));
+		for (int f = 2; f < n; f++)
+		{
+			const int64_t pred = mode == MODE_LINEAR ? 2 * int64_t(q[f - 1]) - q[f - 2] : q[f - 1];
+			writeVarint(out, wrap(q[f] - pred, rotation));
+		}
+	}
+	
+	void findRotations(const ofxBvhHierarchy& h, vector<uint8_t>& rotations)
+	{
+		rotations.assign(h.getNumChannels(), 0);
+		for (int i = 0; i < h.getNumJoints(); i++)
+			for (int c = 0; c < h.getNumJointChannels(i); c++)
+				rotations[h.getChannelOffset(i) + c] = h.getChannel(i, c) < ofxBvhHierarchy::X_POSITION;
+	}
+}
+
+bool ofxBvhCapture::isCaptureFile(const string& path)
+{
+	char magic[sizeof(MAGIC)];
+	FILE* f = fopen(path.c_str(), "rb");
+	if (!f) return false;
+	const bool ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+	fclose(f);
+	return ok;
+}
+
+#pragma mark - ofxBvhCaptureWriter
+
+ofxBvhCaptureWriter::ofxBvhCaptureWriter() : file(NULL), num_bytes(0), failed(false), pending_frames(0)
+{
+	memset(&header, 0, sizeof(header));
+}
+
+ofxBvhCaptureWriter::~ofxBvhCaptureWriter()
+{
+	close();
+}
+
+bool ofxBvhCaptureWriter::open(const string& path, const ofxBvhHierarchyRef& hierarchy, float frame_time, const Settings& settings)
+{
+	close();
+	if (!hierarchy || settings.chunk_frames < 1 || settings.position_step <= 0) return false;
+	
+	file = fopen(path.c_str(), "wb");
+	if (!file)
+	{
+		ofLogError("ofxBvh") << "can't open " << path;
+		return false;
+	}
+	
+	const string text = hierarchy->toString();
+	
+	this->hierarchy = hierarchy;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.num_channels = hierarchy->getNumChannels();
+	header.frame_time = frame_time;
+	header.position_step = settings.position_step;
+	header.chunk_frames = settings.chunk_frames;
+	header.hierarchy_size = text.size();
+	
+	findRotations(*hierarchy, rotations);
+	pending.assign(size_t(header.chunk_frames) * header.num_channels, 0);
+	pending_frames = 0;
+	chunk_offsets.clear();
+	num_bytes = 0;
+	failed = false;
+	
+	write(&header, sizeof(header));
+	write(text.data(), text.size());
+	return !failed;
+}
+
+bool ofxBvhCaptureWriter::addFrame(const float* data)
+{
+	if (!file) return false;
+	
+	const double inv_step = 1.0 / header.position_step;
+	for (uint32_t c = 0; c < header.num_channels; c++)
+		pending[size_t(c) * header.chunk_frames + pending_frames] = quantize(data[c], rotations[c], inv_step);
+	
+	header.num_frames++;
+	if (++pending_frames == header.chunk_frames) flushChunk();
+	return !failed;
+}
+
+void ofxBvhCaptureWriter::flushChunk()
+{
+	if (pending_frames == 0) return;
+	
+	encoded.clear();
+	for (uint32_t c = 0; c < header.num_channels; c++)
+		encodeChannel(&pending[size_t(c) * header.chunk_frames], pending_frames, rotations[c], encoded);
+	
+	ChunkHeader chunk;
+	chunk.size = encoded.size();
+	chunk.num_frames = pending_frames;
+	
+	chunk_offsets.push_back(num_bytes);
+	write(&chunk, sizeof(chunk));
+	write(encoded.data(), encoded.size());
+	pending_frames = 0;
+}
+
+void ofxBvhCaptureWriter::write(const void* data, size_t size)
+{
+	if (fwrite(data, 1, size, file) != size) failed = true;
+	num_bytes += size;
+}
+
+bool ofxBvhCaptureWriter::close()
+{
+	if (!file) return false;
+	
+	flushChunk();
+	header.index_offset = num_bytes;
+	write(chunk_offsets.data(), chunk_offsets.size() * sizeof(uint64_t));
+	
+	if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1) failed = true;
+	if (fclose(file) != 0) failed = true;
+	file = NULL;
+	
+	if (failed) ofLogError("ofxBvh", "error writing capture");
+	return !failed;
+}
+
+#pragma mark - ofxBvhCaptureReader
+
+ofxBvhCaptureReader::ofxBvhCaptureReader() : data(NULL), size(0), num_frames(0), cached_chunk(-1)
+{
+	memset(&header, 0, sizeof(header));
+}
+
+ofxBvhCaptureReader::~ofxBvhCaptureReader()
+{
+	close();
+}
+
+bool ofxBvhCaptureReader::open(const string& path)
+{
+	close();
+	
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		ofLogError("ofxBvh") << "can't open " << path;
+		return false;
+	}
+	
+	struct stat st;
+	void* p = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= off_t(sizeof(Header)))
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+	{
+		ofLogError("ofxBvh") << "can't map " << path;
+		return false;
+	}
+	data = (const uint8_t*)p;
+	size = st.st_size;
+	
+	memcpy(&header, data, sizeof(header));
+	const uint64_t chunks_begin = sizeof(Header) + uint64_t(header.hierarchy_size);
+	if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.chunk_frames == 0 || chunks_begin > size)
+	{
+		close();
+		ofLogError("ofxBvh", "invalid capture format");
+		return false;
+	}
+	
+	const char* text = (const char*)data + sizeof(Header);
+	hierarchy = ofxBvhHierarchy::parse(text, text + header.hierarchy_size);
+	if (!hierarchy || uint32_t(hierarchy->getNumChannels()) != header.num_channels)
+	{
+		close();
+		ofLogError("ofxBvh", "invalid capture format");
+		return false;
+	}
+	findRotations(*hierarchy, rotations);
+	
+	const uint64_t num_chunks = (uint64_t(header.num_frames) + header.chunk_frames - 1) / header.chunk_frames;
+	if (header.index_offset != 0 && header.index_offset + num_chunks * sizeof(uint64_t) <= size)
+	{
+		chunk_offsets.resize(num_chunks);
+		memcpy(chunk_offsets.data(), data + header.index_offset, num_chunks * sizeof(uint64_t));
+		num_frames = header.num_frames;
+	}
+	else
+	{
+		// never closed: walk the chunks that made it to disk
+		uint64_t pos = chunks_begin;
+		num_frames = 0;
+		while (pos + sizeof(ChunkHeader) <= size)
+		{
+			ChunkHeader chunk;
+			memcpy(&chunk, data + pos, sizeof(chunk));
+			if (chunk.num_frames == 0 || chunk.num_frames > header.chunk_frames
+				|| pos + sizeof(chunk) + chunk.size > size) break;
+			
+			chunk_offsets.push_back(pos);
+			num_frames += chunk.num_frames;
+			pos += sizeof(chunk) + chunk.size;
+			if (chunk.num_frames < header.chunk_frames) break;
+		}
+		ofLogWarning("ofxBvh") << "capture was not closed, recovered " << num_frames << " frames";
+	}
+	
+	cache.resize(size_t(header.chunk_frames) * header.num_channels);
+	return true;
+}
+
+void ofxBvhCaptureReader::close()
+{
+	if (data) munmap((void*)data, size);
+	data = NULL;
+	size = 0;
+	
+	memset(&header, 0, sizeof(header));
+	hierarchy.reset();
+	num_frames = 0;
+	rotations.clear();
+	chunk_offsets.clear();
+	cached_chunk = -1;
+	cache.clear();
+}
+
+bool ofxBvhCaptureReader::readFrame(int frame, float* out)
+{
+	if (frame < 0 || frame >= num_frames) return false;
+	
+	const int chunk = frame / header.chunk_frames;
+	if (chunk != cached_chunk && !decodeChunk(chunk)) return false;
+	
+	const int num_channels = header.num_channels;
+	memcpy(out, &cache[size_t(frame % header.chunk_frames) * num_channels], num_channels * sizeof(float));
+	return true;
+}
+
+bool ofxBvhCaptureReader::decodeChunk(int chunk)
+{
+	cached_chunk = -1;
+	
+	const uint64_t offset = chunk_offsets[chunk];
+	if (offset + sizeof(ChunkHeader) > size) return false;
+	
+	ChunkHeader chunk_header;
+	memcpy(&chunk_header, data + offset, sizeof(chunk_header));
+	const uint8_t* p = data + offset + sizeof(chunk_header);
+	const uint8_t* end = p + chunk_header.size;
+	const int n = chunk_header.num_frames;
+	if (end > data + size || n <= 0 || uint32_t(n) > header.chunk_frames) return false;
+	
+	const int num_channels = header.num_channels;
+	for (int c = 0; c < num_channels; c++)
+	{
+		const bool rotation = rotations[c];
+		const float scale = rotation ? ANGLE_STEP : header.position_step;
+		float* out = &cache[c];
+		
+		int64_t first, r;
+		if (p >= end) return false;
+		const uint8_t mode = *p++;
+		if (!readVarint(p, end, first)) return false;
+		out[0] = first * scale;
+		
+		if (mode == MODE_CONSTANT)
+		{
+			for (int f = 1; f < n; f++) out[f * num_channels] = out[0];
+			continue;
+		}
+		if (mode != MODE_DELTA && mode != MODE_LINEAR) return false;
+		
+		int64_t prev = first, prev2 = first;
+		for (int f = 1; f < n; f++)
+		{
+			if (!readVarint(p, end, r)) return false;
+			const int64_t pred = mode == MODE_LINEAR && f > 1 ? 2 * prev - prev2 : prev;
+			const int64_t v = wrap(pred + r, rotation);
+			out[f * num_channels] = v * scale;
+			prev2 = prev;
+			prev = v;
+		}
+	}
+	
+	if (p != end) return false;
+	cached_chunk = chunk;
+	return true;
+}
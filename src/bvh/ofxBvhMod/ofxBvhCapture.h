@@ -0,0 +1,127 @@
+#pragma once
+
+#include "ofxBvhFrameSource.h"
+
+// Compact binary capture of BVH motion.
+//
+// Layout: Header, the HIERARCHY section as text, chunks of up to
+// chunk_frames frames, then an index of the file offset of every chunk.
+// Each chunk is a ChunkHeader followed by its channels one after another:
+// a mode byte, the first frame's value, then the residuals of the other
+// frames against a prediction (previous value, or linear from the two
+// before), all as zigzag varints. Channels that don't change within a chunk
+// store only their first value.
+//
+// Rotation channels are quantized to 16 bits over a full turn (error at
+// most 360 / 2^17 degrees) and decode to [-180, 180), i.e. the same
+// rotation mod 360. Position channels are fixed point in steps of
+// position_step (error at most position_step / 2, plus float rounding).
+//
+// A file that was never closed has no index; the reader rebuilds it by
+// walking the chunk headers, so an interrupted recording stays readable.
+namespace ofxBvhCapture
+{
+#pragma pack(push, 1)
+	struct Header
+	{
+		char magic[8]; // "BVHCAP1"
+		uint32_t num_channels;
+		uint32_t num_frames;
+		float frame_time;
+		float position_step;
+		uint32_t chunk_frames;
+		uint32_t hierarchy_size;
+		uint64_t index_offset; // 0 until the writer is closed
+	};
+	
+	struct ChunkHeader
+	{
+		uint32_t size; // payload bytes
+		uint32_t num_frames;
+	};
+#pragma pack(pop)
+
+	// true if the file starts like a capture
+	bool isCaptureFile(const string& path);
+}
+
+class ofxBvhCaptureWriter
+{
+public:
+
+	struct Settings
+	{
+		Settings() : chunk_frames(64), position_step(0.001) {}
+		int chunk_frames;
+		float position_step;
+	};
+	
+	ofxBvhCaptureWriter();
+	~ofxBvhCaptureWriter();
+	
+	bool open(const string& path, const ofxBvhHierarchyRef& hierarchy, float frame_time, const Settings& settings = Settings());
+	// data holds hierarchy->getNumChannels() values
+	bool addFrame(const float* data);
+	// writes the last chunk and the index
+	bool close();
+	
+	bool isOpen() const { return file != NULL; }
+	// e.g. once a live take's frame rate is known, before close()
+	void setFrameTime(float frame_time) { header.frame_time = frame_time; }
+	int getNumFrames() const { return header.num_frames; }
+	uint64_t getNumBytes() const { return num_bytes; }
+
+protected:
+	FILE* file;
+	ofxBvhHierarchyRef hierarchy;
+	ofxBvhCapture::Header header;
+	uint64_t num_bytes;
+	bool failed;
+	
+	vector<uint8_t> rotations; // per channel: 1 if quantized as an angle
+	vector<int32_t> pending; // quantized frames of the open chunk, channel major
+	uint32_t pending_frames;
+	vector<uint8_t> encoded;
+	vector<uint64_t> chunk_offsets;
+	
+	void flushChunk();
+	void write(const void* data, size_t size);
+};
+
+// Reads a capture through a read-only mapping. Frames are decoded a chunk
+// at a time; the last chunk is kept, so playing forward decodes each chunk
+// once and seeking costs one chunk. POSIX only.
+class ofxBvhCaptureReader : public ofxBvhFrameSource
+{
+public:
+
+	ofxBvhCaptureReader();
+	virtual ~ofxBvhCaptureReader();
+	
+	bool open(const string& path);
+	void close();
+	bool isOpen() const { return data != NULL; }
+	
+	const ofxBvhHierarchyRef& getHierarchy() const { return hierarchy; }
+	int getNumFrames() const { return num_frames; }
+	float getFrameTime() const { return header.frame_time; }
+	
+	bool readFrame(int frame, float* out);
+
+protected:
+	const uint8_t* data;
+	size_t size;
+	
+	ofxBvhCapture::Header header;
+	ofxBvhHierarchyRef hierarchy;
+	int num_frames;
+	vector<uint8_t> rotations;
+	
+	// every chunk but the last holds header.chunk_frames frames
+	vector<uint64_t> chunk_offsets;
+	
+	int cached_chunk;
+	vector<float> cache; // frame major
+	
+	bool decodeChunk(int chunk);
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxBvhHierarchy.h"
+
+// Frames that are fetched on demand rather than held in memory, e.g. from a
+// memory-mapped capture file. ofxBvh plays these back like loaded frames.
+class ofxBvhFrameSource
+{
+public:
+
+	virtual ~ofxBvhFrameSource() {}
+	
+	virtual const ofxBvhHierarchyRef& getHierarchy() const = 0;
+	virtual int getNumFrames() const = 0;
+	virtual float getFrameTime() const = 0;
+	
+	// writes getHierarchy()->getNumChannels() values of one frame to out
+	virtual bool readFrame(int frame, float* out) = 0;
+};
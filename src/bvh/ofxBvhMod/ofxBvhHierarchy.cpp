@@ -0,0 +1,192 @@
+#include "ofxBvhHierarchy.h"
+
+using ofxBvhParser::Token;
+
+ofxBvhHierarchyRef ofxBvhHierarchy::parse(const string& data)
+{
+	return parse(data.data(), data.data() + data.size());
+}
+
+ofxBvhHierarchyRef ofxBvhHierarchy::parse(const char* begin, const char* end)
+{
+	vector<Token> tokens;
+	ofxBvhParser::tokenize(begin, end, tokens);
+	
+	shared_ptr<ofxBvhHierarchy> hierarchy = make_shared<ofxBvhHierarchy>();
+	
+	size_t index = 0;
+	while (index < tokens.size())
+	{
+		if (tokens[index++] == "ROOT")
+		{
+			if (hierarchy->parseJoint(index, tokens, -1) < 0)
+			{
+				ofLogError("ofxBvh", "invalid bvh format");
+				return ofxBvhHierarchyRef();
+			}
+		}
+	}
+	
+	return hierarchy;
+}
+
+// A joint is added once its OFFSET and CHANNELS are known, i.e. before its
+// first child, so joints come out depth first and parent-before-child.
+int ofxBvhHierarchy::parseJoint(size_t& index, const vector<Token>& tokens, int parent)
+{
+	if (index >= tokens.size()) return -1;
+	
+	string name = tokens[index++].str();
+	ofVec3f initial_offset;
+	vector<CHANNEL> channels;
+	int joint = -1;
+	
+	while (index < tokens.size())
+	{
+		const Token& token = tokens[index++];
+		
+		if (token == "OFFSET")
+		{
+			if (index + 3 > tokens.size()) return -1;
+			for (int i = 0; i < 3; i++)
+				if (!ofxBvhParser::parseFloat(tokens[index++], initial_offset[i])) return -1;
+		}
+		else if (token == "CHANNELS")
+		{
+			if (index >= tokens.size()) return -1;
+			int num = 0;
+			if (!ofxBvhParser::parseInt(tokens[index++], num)) return -1;
+			// a joint has at most one position and one rotation
+			if (num < 0 || num > 6 || index + size_t(num) > tokens.size()) return -1;
+			
+			channels.resize(num);
+			
+			for (int i = 0; i < num; i++)
+			{
+				const Token& ch = tokens[index++];
+				if (ch.size < 2) return -1;
+				
+				char axis = tolower(ch.data[0]);
+				char elem = tolower(ch.data[1]);
+				
+				if (axis < 'x' || axis > 'z') return -1;
+				
+				if (elem == 'p')
+					channels[i] = CHANNEL(X_POSITION + axis - 'x');
+				else if (elem == 'r')
+					channels[i] = CHANNEL(X_ROTATION + axis - 'x');
+				else
+					return -1;
+			}
+		}
+		else if (token == "JOINT"
+				 || token == "End")
+		{
+			if (joint < 0) joint = addJoint(name, parent, initial_offset, channels);
+			if (parseJoint(index, tokens, joint) < 0) return -1;
+		}
+		else if (token == "}")
+		{
+			break;
+		}
+	}
+	
+	if (joint < 0) joint = addJoint(name, parent, initial_offset, channels);
+	
+	return joint;
+}
+
+int ofxBvhHierarchy::addJoint(const string& name, int parent, const ofVec3f& initial_offset, const vector<CHANNEL>& channels)
+{
+	if (channels.size() > 6) return -1;
+	
+	const int index = parents.size();
+	
+	static const CHANNEL pos_rot_yxz[] = { X_POSITION, Y_POSITION, Z_POSITION, Y_ROTATION, X_ROTATION, Z_ROTATION };
+	static const CHANNEL rot_yxz[] = { Y_ROTATION, X_ROTATION, Z_ROTATION };
+	
+	PROGRAM program = PROGRAM_GENERIC;
+	if (channels.empty())
+		program = PROGRAM_NONE;
+	else if (channels.size() == 6 && equal(channels.begin(), channels.end(), pos_rot_yxz))
+		program = PROGRAM_POS_ROT_YXZ;
+	else if (channels.size() == 3 && equal(channels.begin(), channels.end(), rot_yxz))
+		program = PROGRAM_ROT_YXZ;
+	
+	if (parent >= index) parent = -1;
+	
+	names.push_back(name);
+	parents.push_back(parent);
+	children.push_back(vector<int>());
+	if (parent >= 0) children[parent].push_back(index);
+	initial_offsets.push_back(initial_offset);
+	name_map[name] = index;
+	
+	programs.push_back(program);
+	channel_offsets.push_back(num_channels);
+	channel_counts.push_back(channels.size());
+	for (size_t i = 0; i < 6; i++)
+		channel_types.push_back(i < channels.size() ? channels[i] : 0);
+	
+	if (program == PROGRAM_POS_ROT_YXZ || program == PROGRAM_ROT_YXZ)
+	{
+		rot_slots.push_back(rot_channels.size());
+		rot_joints.push_back(index);
+		rot_channels.push_back(num_channels + (program == PROGRAM_POS_ROT_YXZ ? 3 : 0));
+	}
+	else
+	{
+		rot_slots.push_back(-1);
+	}
+	
+	num_channels += channels.size();
+	
+	return index;
+}
+
+int ofxBvhHierarchy::findJoint(const string& name) const
+{
+	map<string, int>::const_iterator it = name_map.find(name);
+	return it != name_map.end() ? it->second : -1;
+}
+
+string ofxBvhHierarchy::toString() const
+{
+	ostringstream out;
+	out << "HIERARCHY\n";
+	for (int i = 0; i < getNumJoints(); i++)
+		if (parents[i] < 0) writeJoint(out, i, 0);
+	out << "MOTION\n";
+	return out.str();
+}
+
+void ofxBvhHierarchy::writeJoint(ostream& out, int index, int depth) const
+{
+	static const char* channel_names[] = { "Xrotation", "Yrotation", "Zrotation", "Xposition", "Yposition", "Zposition" };
+	
+	const string indent(depth, '\t');
+	const ofVec3f& offset = initial_offsets[index];
+	
+	if (depth == 0)
+		out << indent << "ROOT " << names[index] << "\n";
+	else if (channel_counts[index] == 0 && children[index].empty())
+		out << indent << "End Site\n";
+	else
+		out << indent << "JOINT " << names[index] << "\n";
+	
+	out << indent << "{\n";
+	out << indent << "\tOFFSET " << offset.x << " " << offset.y << " " << offset.z << "\n";
+	
+	if (channel_counts[index] > 0)
+	{
+		out << indent << "\tCHANNELS " << int(channel_counts[index]);
+		for (int c = 0; c < channel_counts[index]; c++)
+			out << " " << channel_names[getChannel(index, c)];
+		out << "\n";
+	}
+	
+	for (size_t c = 0; c < children[index].size(); c++)
+		writeJoint(out, children[index][c], depth + 1);
+	
+	out << indent << "}\n";
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxBvhParser.h"
+
+class ofxBvhHierarchy;
+typedef shared_ptr<const ofxBvhHierarchy> ofxBvhHierarchyRef;
+
+// Topology of a BVH skeleton: joint names, parents, children, channel
+// layouts and initial offsets. Built once, then shared read-only between
+// every ofxBvh, ofxBvhSolver and skeleton that uses the same hierarchy;
+// pose data lives with them, never here.
+class ofxBvhHierarchy
+{
+public:
+
+	enum CHANNEL
+	{
+		X_ROTATION, Y_ROTATION, Z_ROTATION,
+		X_POSITION, Y_POSITION, Z_POSITION
+	};
+	
+	enum PROGRAM
+	{
+		PROGRAM_NONE,        // End Site, no channels
+		PROGRAM_POS_ROT_YXZ, // Xposition Yposition Zposition Yrotation Xrotation Zrotation
+		PROGRAM_ROT_YXZ,     // Yrotation Xrotation Zrotation
+		PROGRAM_GENERIC      // anything else, interpreted channel by channel
+	};
+	
+	// parses the HIERARCHY section of a BVH file; null on error
+	static ofxBvhHierarchyRef parse(const string& data);
+	static ofxBvhHierarchyRef parse(const char* begin, const char* end);
+	
+	// joints must be added parent-before-child; returns the joint index, or -1
+	// for more than 6 channels
+	int addJoint(const string& name, int parent, const ofVec3f& initial_offset, const vector<CHANNEL>& channels);
+	
+	inline int getNumJoints() const { return parents.size(); }
+	inline int getNumChannels() const { return num_channels; }
+	
+	inline const string& getName(int i) const { return names[i]; }
+	inline int getParent(int i) const { return parents[i]; }
+	inline int getNumChildren(int i) const { return children[i].size(); }
+	inline int getChild(int i, int c) const { return children[i][c]; }
+	inline const ofVec3f& getInitialOffset(int i) const { return initial_offsets[i]; }
+	
+	inline PROGRAM getProgram(int i) const { return PROGRAM(programs[i]); }
+	inline int getChannelOffset(int i) const { return channel_offsets[i]; }
+	inline int getNumJointChannels(int i) const { return channel_counts[i]; }
+	inline CHANNEL getChannel(int i, int c) const { return CHANNEL(channel_types[i * 6 + c]); }
+	
+	// YXZ joints, numbered in joint order: slot of joint i (-1 if none), and
+	// joint and first rotation channel of slot k
+	inline int getNumRotations() const { return rot_joints.size(); }
+	inline int getRotationSlot(int i) const { return rot_slots[i]; }
+	inline int getRotationJoint(int k) const { return rot_joints[k]; }
+	inline int getRotationChannel(int k) const { return rot_channels[k]; }
+	
+	// index of the joint with this name, -1 if none. End Sites are all
+	// named "Site"; the last one wins.
+	int findJoint(const string& name) const;
+	
+	// the HIERARCHY section as BVH text, ending with "MOTION\n"
+	string toString() const;
+
+protected:
+
+	int num_channels = 0;
+	
+	vector<string> names;
+	vector<int> parents;
+	vector<vector<int> > children;
+	vector<ofVec3f> initial_offsets;
+	map<string, int> name_map;
+	
+	vector<uint8_t> programs;
+	vector<int> channel_offsets;
+	vector<uint8_t> channel_counts;
+	vector<uint8_t> channel_types; // 6 slots per joint
+	
+	vector<int> rot_slots;
+	vector<int> rot_joints;
+	vector<int> rot_channels;
+	
+	int parseJoint(size_t& index, const vector<ofxBvhParser::Token>& tokens, int parent);
+	void writeJoint(ostream& out, int index, int depth) const;
+};
@@ -0,0 +1,595 @@
+#include "ofxBvhKernels.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+// The vector kernels are written once against GCC/Clang vector extensions
+// and instantiated per register width. AVX2 code lives in target("avx2,fma")
+// functions so the rest of the addon keeps the baseline instruction set.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OFX_BVH_KERNELS_X86
+#define OFX_BVH_KERNELS_INLINE inline __attribute__((always_inline))
+#define OFX_BVH_KERNELS_AVX2_TARGET __attribute__((target("avx2,fma")))
+#elif defined(__GNUC__)
+#define OFX_BVH_KERNELS_INLINE inline __attribute__((always_inline))
+#else
+#define OFX_BVH_KERNELS_INLINE inline
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+// 256 bit helpers are always inlined into AVX2 functions, so the ABI change doesn't apply
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+namespace ofxBvhKernels
+{
+	static const float DEG_TO_RAD = 0.017453292519943295f;
+	
+	// Cephes sinf/cosf: reduction by pi/4 and minimax polynomials, ~1 ulp on |x| < 8192
+	static const float FOUR_OVER_PI = 1.27323954473516f;
+	static const float DP1 = 0.78515625f;
+	static const float DP2 = 2.4187564849853515625e-4f;
+	static const float DP3 = 3.77489497744594108e-8f;
+	static const float SIN_P0 = -1.9515295891e-4f;
+	static const float SIN_P1 = 8.3321608736e-3f;
+	static const float SIN_P2 = -1.6666654611e-1f;
+	static const float COS_P0 = 2.443315711809948e-5f;
+	static const float COS_P1 = -1.388731625493765e-3f;
+	static const float COS_P2 = 4.166664568298827e-2f;
+	
+	template<typename V, typename VI>
+	static OFX_BVH_KERNELS_INLINE V select(const VI& mask, const V& a, const V& b)
+	{
+		return (V)((mask & (VI)a) | (~mask & (VI)b));
+	}
+	
+	template<typename V, typename VI>
+	static OFX_BVH_KERNELS_INLINE void sinCosRadians(const V& radians, V& s, V& c)
+	{
+		V x = radians;
+		const VI sign_bit = ((VI)x & 0) | INT32_MIN;
+		VI sign_sin = (VI)x & sign_bit;
+		x = (V)((VI)x & ~sign_bit);
+		
+		VI j = __builtin_convertvector(x * FOUR_OVER_PI, VI);
+		j = (j + 1) & ~1;
+		const V y = __builtin_convertvector(j, V);
+		
+		x = ((x - y * DP1) - y * DP2) - y * DP3;
+		
+		sign_sin ^= (VI)((j & 4) != 0) & sign_bit;
+		const VI sign_cos = (VI)(((j - 2) & 4) == 0) & sign_bit;
+		const VI poly_mask = (j & 2) != 0;
+		
+		const V z = x * x;
+		V yc = ((COS_P0 * z + COS_P1) * z + COS_P2) * z * z - 0.5f * z + 1.0f;
+		V ys = ((SIN_P0 * z + SIN_P1) * z + SIN_P2) * z * x + x;
+		
+		s = (V)((VI)select<V, VI>(poly_mask, yc, ys) ^ sign_sin);
+		c = (V)((VI)select<V, VI>(poly_mask, ys, yc) ^ sign_cos);
+	}
+	
+	template<typename V>
+	static OFX_BVH_KERNELS_INLINE V load(const float* p)
+	{
+		V v;
+		memcpy(&v, p, sizeof(V));
+		return v;
+	}
+	
+	template<typename V>
+	static OFX_BVH_KERNELS_INLINE void store(float* p, const V& v)
+	{
+		memcpy(p, &v, sizeof(V));
+	}
+	
+	// g[c] lane a = b[a][c] for the SOA_COMPONENTS floats at each b[a],
+	// i.e. AoS matrices to SoA; specialized below where shuffles beat lane inserts
+	template<typename V>
+	struct Gather
+	{
+		static OFX_BVH_KERNELS_INLINE void apply(const float* const* b, V* g)
+		{
+			for (size_t a = 0; a < sizeof(V) / sizeof(float); a++)
+				for (int c = 0; c < SOA_COMPONENTS; c++)
+					g[c][a] = b[a][c];
+		}
+	};
+	
+	template<>
+	struct Gather<float>
+	{
+		static OFX_BVH_KERNELS_INLINE void apply(const float* const* b, float* g)
+		{
+			memcpy(g, b[0], SOA_COMPONENTS * sizeof(float));
+		}
+	};
+	
+	template<typename V, typename VI>
+	static OFX_BVH_KERNELS_INLINE size_t sinCosBlock(const float* degrees, float* s, float* c, size_t n)
+	{
+		const size_t W = sizeof(V) / sizeof(float);
+		size_t i = 0;
+		for (; i + W <= n; i += W)
+		{
+			V vs, vc;
+			sinCosRadians<V, VI>(load<V>(degrees + i) * DEG_TO_RAD, vs, vc);
+			store(s + i, vs);
+			store(c + i, vc);
+		}
+		return i;
+	}
+	
+	template<typename V, typename VI>
+	static OFX_BVH_KERNELS_INLINE size_t eulerYXZToQuatBlock(const float* y, const float* x, const float* z,
+															  float* qx, float* qy, float* qz, float* qw, size_t n)
+	{
+		const size_t W = sizeof(V) / sizeof(float);
+		const float HALF = 0.5f * DEG_TO_RAD;
+		size_t i = 0;
+		for (; i + W <= n; i += W)
+		{
+			V sy, cy, sx, cx, sz, cz;
+			sinCosRadians<V, VI>(load<V>(y + i) * HALF, sy, cy);
+			sinCosRadians<V, VI>(load<V>(x + i) * HALF, sx, cx);
+			sinCosRadians<V, VI>(load<V>(z + i) * HALF, sz, cz);
+			
+			const V cycx = cy * cx, sysx = sy * sx, cysx = cy * sx, sycx = sy * cx;
+			store(qw + i, cycx * cz + sysx * sz);
+			store(qx + i, cysx * cz + sycx * sz);
+			store(qy + i, sycx * cz - cysx * sz);
+			store(qz + i, cycx * sz - sysx * cz);
+		}
+		return i;
+	}
+	
+	template<typename V>
+	static OFX_BVH_KERNELS_INLINE size_t composeAffineSoABlock(float* g, const float* l, const float* p,
+																size_t stride, size_t i, size_t n)
+	{
+		const size_t W = sizeof(V) / sizeof(float);
+		for (; i + W <= n; i += W)
+		{
+			V pm[SOA_COMPONENTS];
+			for (int c = 0; c < SOA_COMPONENTS; c++)
+				pm[c] = load<V>(p + c * stride + i);
+			
+			for (int r = 0; r < 4; r++)
+			{
+				const V a = load<V>(l + (r * 3 + 0) * stride + i);
+				const V b = load<V>(l + (r * 3 + 1) * stride + i);
+				const V c = load<V>(l + (r * 3 + 2) * stride + i);
+				for (int k = 0; k < 3; k++)
+				{
+					V v = a * pm[k] + b * pm[3 + k] + c * pm[6 + k];
+					if (r == 3)
+						v += pm[9 + k];
+					store(g + (r * 3 + k) * stride + i, v);
+				}
+			}
+		}
+		return i;
+	}
+	
+	template<typename V, typename VI>
+	static OFX_BVH_KERNELS_INLINE size_t solveJointYXZSoABlock(const float* const* data, int rot_channel, int pos_channel,
+																const float* parent, float* local, float* global,
+																size_t stride, size_t i, size_t n)
+	{
+		const size_t W = sizeof(V) / sizeof(float);
+		const float HALF = 0.5f * DEG_TO_RAD;
+		for (; i + W <= n; i += W)
+		{
+			float ch[6][W];
+			for (size_t a = 0; a < W; a++)
+			{
+				const float* v = data[i + a];
+				ch[0][a] = v[rot_channel];
+				ch[1][a] = v[rot_channel + 1];
+				ch[2][a] = v[rot_channel + 2];
+				ch[3][a] = pos_channel < 0 ? 0 : v[pos_channel];
+				ch[4][a] = pos_channel < 0 ? 0 : v[pos_channel + 1];
+				ch[5][a] = pos_channel < 0 ? 0 : v[pos_channel + 2];
+			}
+			
+			V sy, cy, sx, cx, sz, cz;
+			sinCosRadians<V, VI>(load<V>(ch[0]) * HALF, sy, cy);
+			sinCosRadians<V, VI>(load<V>(ch[1]) * HALF, sx, cx);
+			sinCosRadians<V, VI>(load<V>(ch[2]) * HALF, sz, cz);
+			
+			const V cycx = cy * cx, sysx = sy * sx, cysx = cy * sx, sycx = sy * cx;
+			const V w = cycx * cz + sysx * sz;
+			const V x = cysx * cz + sycx * sz;
+			const V y = sycx * cz - cysx * sz;
+			const V z = cycx * sz - sysx * cz;
+			
+			const V x2 = x + x, y2 = y + y, z2 = z + z;
+			const V xx = x * x2, xy = x * y2, xz = x * z2;
+			const V yy = y * y2, yz = y * z2, zz = z * z2;
+			const V wx = w * x2, wy = w * y2, wz = w * z2;
+			const V one = xx - xx + 1.0f;
+			
+			V l[SOA_COMPONENTS];
+			l[0] = one - (yy + zz); l[1] = xy + wz;       l[2] = xz - wy;
+			l[3] = xy - wz;       l[4] = one - (xx + zz); l[5] = yz + wx;
+			l[6] = xz + wy;       l[7] = yz - wx;       l[8] = one - (xx + yy);
+			l[9] = load<V>(ch[3]); l[10] = load<V>(ch[4]); l[11] = load<V>(ch[5]);
+			
+			for (int c = 0; c < SOA_COMPONENTS; c++)
+				store(local + c * stride + i, l[c]);
+			
+			if (!parent)
+			{
+				for (int c = 0; c < SOA_COMPONENTS; c++)
+					store(global + c * stride + i, l[c]);
+				continue;
+			}
+			
+			V p[SOA_COMPONENTS];
+			for (int c = 0; c < SOA_COMPONENTS; c++)
+				p[c] = load<V>(parent + c * stride + i);
+			for (int r = 0; r < 4; r++)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					V g = l[r * 3] * p[k] + l[r * 3 + 1] * p[3 + k] + l[r * 3 + 2] * p[6 + k];
+					if (r == 3)
+						g += p[9 + k];
+					store(global + (r * 3 + k) * stride + i, g);
+				}
+			}
+		}
+		return i;
+	}
+	
+	// m = (or +=) the bones' matrices times their weights, lane by lane
+	template<typename V>
+	static OFX_BVH_KERNELS_INLINE void blendBones(const float* skin, const uint16_t* bones, const float* weights,
+												  V* m, bool accumulate)
+	{
+		const size_t W = sizeof(V) / sizeof(float);
+		const float* b[W];
+		for (size_t a = 0; a < W; a++)
+			b[a] = skin + bones[a] * SOA_COMPONENTS;
+		V g[SOA_COMPONENTS];
+		Gather<V>::apply(b, g);
+		const V w = load<V>(weights);
+		for (int c = 0; c < SOA_COMPONENTS; c++)
+			m[c] = accumulate ? m[c] + w * g[c] : w * g[c];
+	}
+	
+	template<typename V>
+	static OFX_BVH_KERNELS_INLINE size_t skinLinearBlendSoABlock(const float* skin, const uint16_t* bones, const float* weights,
+																  int num_influences, const float* pos, float* out_pos,
+																  const float* normals, float* out_normals,
+																  size_t stride, size_t i, size_t n)
+	{
+		const size_t W = sizeof(V) / sizeof(float);
+		for (; i + W <= n; i += W)
+		{
+			// blend the bones' matrices; each lane may use a different bone
+			V m[SOA_COMPONENTS];
+			blendBones<V>(skin, bones + i, weights + i, m, false);
+			for (int k = 1; k < num_influences; k++)
+				blendBones<V>(skin, bones + k * stride + i, weights + k * stride + i, m, true);
+			
+			const V x = load<V>(pos + i), y = load<V>(pos + stride + i), z = load<V>(pos + 2 * stride + i);
+			for (int c = 0; c < 3; c++)
+				store(out_pos + c * stride + i, x * m[c] + y * m[3 + c] + z * m[6 + c] + m[9 + c]);
+			if (normals)
+			{
+				const V nx = load<V>(normals + i), ny = load<V>(normals + stride + i), nz = load<V>(normals + 2 * stride + i);
+				for (int c = 0; c < 3; c++)
+					store(out_normals + c * stride + i, nx * m[c] + ny * m[3 + c] + nz * m[6 + c]);
+			}
+		}
+		return i;
+	}
+	
+#pragma mark - scalar
+	
+	static void sinCosScalar(const float* degrees, float* s, float* c, size_t n)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			const float r = degrees[i] * DEG_TO_RAD;
+			s[i] = sinf(r);
+			c[i] = cosf(r);
+		}
+	}
+	
+	static void eulerYXZToQuatScalar(const float* y, const float* x, const float* z,
+									 float* qx, float* qy, float* qz, float* qw, size_t n)
+	{
+		const float HALF = 0.5f * DEG_TO_RAD;
+		for (size_t i = 0; i < n; i++)
+		{
+			const float sy = sinf(y[i] * HALF), cy = cosf(y[i] * HALF);
+			const float sx = sinf(x[i] * HALF), cx = cosf(x[i] * HALF);
+			const float sz = sinf(z[i] * HALF), cz = cosf(z[i] * HALF);
+			
+			qw[i] = cy * cx * cz + sy * sx * sz;
+			qx[i] = cy * sx * cz + sy * cx * sz;
+			qy[i] = sy * cx * cz - cy * sx * sz;
+			qz[i] = cy * cx * sz - sy * sx * cz;
+		}
+	}
+	
+	static void composeAffineSoAScalar(float* g, const float* l, const float* p, size_t stride, size_t n)
+	{
+		composeAffineSoABlock<float>(g, l, p, stride, 0, n);
+	}
+	
+	static void solveJointYXZSoAScalar(const float* const* data, int rot_channel, int pos_channel,
+									   const float* parent, float* local, float* global, size_t stride, size_t n)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			float ry = data[i][rot_channel], rx = data[i][rot_channel + 1], rz = data[i][rot_channel + 2];
+			float q[4];
+			eulerYXZToQuatScalar(&ry, &rx, &rz, q, q + 1, q + 2, q + 3, 1);
+			float m[12];
+			quatToMatrix(m, q[0], q[1], q[2], q[3]);
+			
+			float l[SOA_COMPONENTS];
+			for (int c = 0; c < 9; c++)
+				l[c] = m[(c / 3) * 4 + c % 3];
+			for (int c = 0; c < 3; c++)
+				l[9 + c] = pos_channel < 0 ? 0 : data[i][pos_channel + c];
+			
+			for (int c = 0; c < SOA_COMPONENTS; c++)
+				local[c * stride + i] = l[c];
+			if (parent)
+				composeAffineSoABlock<float>(global, local, parent, stride, i, i + 1);
+			else
+				for (int c = 0; c < SOA_COMPONENTS; c++)
+					global[c * stride + i] = l[c];
+		}
+	}
+	
+	static void skinLinearBlendSoAScalar(const float* skin, const uint16_t* bones, const float* weights, int num_influences,
+										 const float* pos, float* out_pos, const float* normals, float* out_normals,
+										 size_t stride, size_t n)
+	{
+		skinLinearBlendSoABlock<float>(skin, bones, weights, num_influences, pos, out_pos, normals, out_normals, stride, 0, n);
+	}
+	
+#pragma mark - 128 bit (SSE2 / NEON)
+	
+#if defined(__GNUC__) && (defined(OFX_BVH_KERNELS_SSE2) || defined(OFX_BVH_KERNELS_NEON))
+	typedef float v4sf __attribute__((vector_size(16)));
+	typedef int32_t v4si __attribute__((vector_size(16)));
+	
+#if defined(OFX_BVH_KERNELS_SSE2)
+	// three 4x4 transposes
+	template<>
+	struct Gather<v4sf>
+	{
+		static OFX_BVH_KERNELS_INLINE void apply(const float* const* b, v4sf* g)
+		{
+			for (int r = 0; r < 3; r++)
+			{
+				__m128 a0 = _mm_loadu_ps(b[0] + r * 4), a1 = _mm_loadu_ps(b[1] + r * 4);
+				__m128 a2 = _mm_loadu_ps(b[2] + r * 4), a3 = _mm_loadu_ps(b[3] + r * 4);
+				_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+				g[r * 4 + 0] = (v4sf)a0;
+				g[r * 4 + 1] = (v4sf)a1;
+				g[r * 4 + 2] = (v4sf)a2;
+				g[r * 4 + 3] = (v4sf)a3;
+			}
+		}
+	};
+#endif
+	
+	static void sinCos128(const float* degrees, float* s, float* c, size_t n)
+	{
+		size_t i = sinCosBlock<v4sf, v4si>(degrees, s, c, n);
+		sinCosScalar(degrees + i, s + i, c + i, n - i);
+	}
+	
+	static void eulerYXZToQuat128(const float* y, const float* x, const float* z,
+								  float* qx, float* qy, float* qz, float* qw, size_t n)
+	{
+		size_t i = eulerYXZToQuatBlock<v4sf, v4si>(y, x, z, qx, qy, qz, qw, n);
+		eulerYXZToQuatScalar(y + i, x + i, z + i, qx + i, qy + i, qz + i, qw + i, n - i);
+	}
+	
+	static void composeAffineSoA128(float* g, const float* l, const float* p, size_t stride, size_t n)
+	{
+		size_t i = composeAffineSoABlock<v4sf>(g, l, p, stride, 0, n);
+		composeAffineSoABlock<float>(g, l, p, stride, i, n);
+	}
+	
+	static void solveJointYXZSoA128(const float* const* data, int rot_channel, int pos_channel,
+									const float* parent, float* local, float* global, size_t stride, size_t n)
+	{
+		size_t i = solveJointYXZSoABlock<v4sf, v4si>(data, rot_channel, pos_channel, parent, local, global, stride, 0, n);
+		solveJointYXZSoAScalar(data + i, rot_channel, pos_channel, parent ? parent + i : NULL,
+							   local + i, global + i, stride, n - i);
+	}
+	
+	static void skinLinearBlendSoA128(const float* skin, const uint16_t* bones, const float* weights, int num_influences,
+									  const float* pos, float* out_pos, const float* normals, float* out_normals,
+									  size_t stride, size_t n)
+	{
+		size_t i = skinLinearBlendSoABlock<v4sf>(skin, bones, weights, num_influences, pos, out_pos, normals, out_normals, stride, 0, n);
+		skinLinearBlendSoABlock<float>(skin, bones, weights, num_influences, pos, out_pos, normals, out_normals, stride, i, n);
+	}
+#define OFX_BVH_KERNELS_HAS_128
+#endif
+	
+#pragma mark - AVX2
+	
+#if defined(OFX_BVH_KERNELS_X86)
+	typedef float v8sf __attribute__((vector_size(32)));
+	typedef int32_t v8si __attribute__((vector_size(32)));
+	
+	OFX_BVH_KERNELS_AVX2_TARGET
+	static void sinCosAvx2(const float* degrees, float* s, float* c, size_t n)
+	{
+		size_t i = sinCosBlock<v8sf, v8si>(degrees, s, c, n);
+		sinCos128(degrees + i, s + i, c + i, n - i);
+	}
+	
+	OFX_BVH_KERNELS_AVX2_TARGET
+	static void eulerYXZToQuatAvx2(const float* y, const float* x, const float* z,
+								   float* qx, float* qy, float* qz, float* qw, size_t n)
+	{
+		size_t i = eulerYXZToQuatBlock<v8sf, v8si>(y, x, z, qx, qy, qz, qw, n);
+		eulerYXZToQuat128(y + i, x + i, z + i, qx + i, qy + i, qz + i, qw + i, n - i);
+	}
+	
+	OFX_BVH_KERNELS_AVX2_TARGET
+	static void composeAffineSoAAvx2(float* g, const float* l, const float* p, size_t stride, size_t n)
+	{
+		size_t i = composeAffineSoABlock<v8sf>(g, l, p, stride, 0, n);
+		composeAffineSoABlock<float>(g, l, p, stride, i, n);
+	}
+	
+	OFX_BVH_KERNELS_AVX2_TARGET
+	static void solveJointYXZSoAAvx2(const float* const* data, int rot_channel, int pos_channel,
+									 const float* parent, float* local, float* global, size_t stride, size_t n)
+	{
+		size_t i = solveJointYXZSoABlock<v8sf, v8si>(data, rot_channel, pos_channel, parent, local, global, stride, 0, n);
+		solveJointYXZSoA128(data + i, rot_channel, pos_channel, parent ? parent + i : NULL,
+							local + i, global + i, stride, n - i);
+	}
+#endif
+	
+#pragma mark - dispatch
+	
+	typedef void (*SinCosFunc)(const float*, float*, float*, size_t);
+	typedef void (*EulerYXZToQuatFunc)(const float*, const float*, const float*, float*, float*, float*, float*, size_t);
+	typedef void (*ComposeAffineSoAFunc)(float*, const float*, const float*, size_t, size_t);
+	typedef void (*SolveJointYXZSoAFunc)(const float* const*, int, int, const float*, float*, float*, size_t, size_t);
+	typedef void (*SkinLinearBlendSoAFunc)(const float*, const uint16_t*, const float*, int,
+										   const float*, float*, const float*, float*, size_t, size_t);
+	
+	struct Dispatch
+	{
+		ISA isa;
+		SinCosFunc sin_cos;
+		EulerYXZToQuatFunc euler_yxz_to_quat;
+		ComposeAffineSoAFunc compose_affine_soa;
+		SolveJointYXZSoAFunc solve_joint_yxz_soa;
+		SkinLinearBlendSoAFunc skin_linear_blend_soa;
+	};
+	
+	// one constant table per instruction set; switching publishes another
+	// table rather than writing into the one other threads are calling through
+	static const Dispatch scalar_dispatch = { ISA_SCALAR, sinCosScalar, eulerYXZToQuatScalar, composeAffineSoAScalar,
+		solveJointYXZSoAScalar, skinLinearBlendSoAScalar };
+#if defined(OFX_BVH_KERNELS_HAS_128)
+#if defined(OFX_BVH_KERNELS_NEON)
+	static const Dispatch v128_dispatch = { ISA_NEON, sinCos128, eulerYXZToQuat128, composeAffineSoA128,
+		solveJointYXZSoA128, skinLinearBlendSoA128 };
+#else
+	static const Dispatch v128_dispatch = { ISA_SSE2, sinCos128, eulerYXZToQuat128, composeAffineSoA128,
+		solveJointYXZSoA128, skinLinearBlendSoA128 };
+#endif
+#endif
+#if defined(OFX_BVH_KERNELS_X86)
+	// skinning is bound by gathering bone matrices, which 256 bit lanes only
+	// make slower, so it stays at 128 bits
+	static const Dispatch avx2_dispatch = { ISA_AVX2, sinCosAvx2, eulerYXZToQuatAvx2, composeAffineSoAAvx2,
+		solveJointYXZSoAAvx2, skinLinearBlendSoA128 };
+#endif
+	
+	static const Dispatch* getDispatch(ISA isa)
+	{
+#if defined(OFX_BVH_KERNELS_X86)
+		if (isa == ISA_AVX2)
+			return &avx2_dispatch;
+#endif
+#if defined(OFX_BVH_KERNELS_HAS_128)
+		if (isa != ISA_SCALAR)
+			return &v128_dispatch;
+#endif
+		return &scalar_dispatch;
+	}
+	
+	static std::atomic<const Dispatch*>& current()
+	{
+		static std::atomic<const Dispatch*> d(getDispatch(getBestIsa()));
+		return d;
+	}
+	
+	static const Dispatch& dispatch()
+	{
+		return *current().load(std::memory_order_acquire);
+	}
+	
+	ISA getBestIsa()
+	{
+#if defined(OFX_BVH_KERNELS_X86)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+			return ISA_AVX2;
+#endif
+#if defined(OFX_BVH_KERNELS_HAS_128)
+#if defined(OFX_BVH_KERNELS_NEON)
+		return ISA_NEON;
+#else
+		return ISA_SSE2;
+#endif
+#endif
+		return ISA_SCALAR;
+	}
+	
+	ISA getIsa()
+	{
+		return dispatch().isa;
+	}
+	
+	void setIsa(ISA isa)
+	{
+		const ISA best = getBestIsa();
+		if (isa > best || (isa == ISA_NEON) != (best == ISA_NEON))
+			isa = isa == ISA_SCALAR ? ISA_SCALAR : best;
+		current().store(getDispatch(isa), std::memory_order_release);
+	}
+	
+	const char* getIsaName(ISA isa)
+	{
+		switch (isa)
+		{
+			case ISA_SSE2: return "sse2";
+			case ISA_AVX2: return "avx2";
+			case ISA_NEON: return "neon";
+			default: return "scalar";
+		}
+	}
+	
+	void sinCos(const float* degrees, float* s, float* c, size_t n)
+	{
+		dispatch().sin_cos(degrees, s, c, n);
+	}
+	
+	void eulerYXZToQuat(const float* y, const float* x, const float* z,
+						float* qx, float* qy, float* qz, float* qw, size_t n)
+	{
+		dispatch().euler_yxz_to_quat(y, x, z, qx, qy, qz, qw, n);
+	}
+	
+	void composeAffineSoA(float* g, const float* l, const float* p, size_t stride, size_t n)
+	{
+		dispatch().compose_affine_soa(g, l, p, stride, n);
+	}
+	
+	void solveJointYXZSoA(const float* const* data, int rot_channel, int pos_channel,
+						  const float* parent, float* local, float* global, size_t stride, size_t n)
+	{
+		dispatch().solve_joint_yxz_soa(data, rot_channel, pos_channel, parent, local, global, stride, n);
+	}
+	
+	void skinLinearBlendSoA(const float* skin, const uint16_t* bones, const float* weights, int num_influences,
+							const float* pos, float* out_pos, const float* normals, float* out_normals,
+							size_t stride, size_t n)
+	{
+		dispatch().skin_linear_blend_soa(skin, bones, weights, num_influences, pos, out_pos, normals, out_normals, stride, n);
+	}
+}
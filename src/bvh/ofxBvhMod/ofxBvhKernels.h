@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OFX_BVH_KERNELS_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OFX_BVH_KERNELS_NEON
+#endif
+
+// Batched math kernels used by ofxBvhSolver.
+// Array kernels are dispatched at runtime to the widest instruction set the
+// CPU supports (AVX2 > SSE2 on x86, NEON on ARM) with a scalar fallback.
+// Angles are in degrees, matching BVH channel data.
+namespace ofxBvhKernels
+{
+	enum ISA
+	{
+		ISA_SCALAR,
+		ISA_SSE2,
+		ISA_AVX2,
+		ISA_NEON
+	};
+	
+	ISA getBestIsa();
+	ISA getIsa();
+	// selects an instruction set for subsequent calls, clamped to what the CPU
+	// supports. Safe while other threads run kernels: each call picks up the
+	// current instruction set once, so a call in progress finishes on the old one.
+	void setIsa(ISA isa);
+	const char* getIsaName(ISA isa);
+	
+	// s[i] = sin(degrees[i]), c[i] = cos(degrees[i])
+	void sinCos(const float* degrees, float* s, float* c, size_t n);
+	
+	// q[i] = Ry(y[i]) * Rx(x[i]) * Rz(z[i]) as quaternions, structure-of-arrays in and out
+	void eulerYXZToQuat(const float* y, const float* x, const float* z,
+						float* qx, float* qy, float* qz, float* qw, size_t n);
+	
+	// Structure-of-arrays matrix batches: component c of lane i lives at m[c * stride + i].
+	// Components are the 9 rotation entries in row order followed by the translation:
+	// r00 r01 r02 r10 r11 r12 r20 r21 r22 tx ty tz (oF row-vector convention).
+	enum { SOA_COMPONENTS = 12 };
+	
+	// g = l * p lane by lane, see composeAffine
+	void composeAffineSoA(float* g, const float* l, const float* p, size_t stride, size_t n);
+	
+	// One YXZ joint for n lanes, lane i reading channels from data[i]: Euler
+	// angles at data[i][rot_channel..+2], position at data[i][pos_channel..+2]
+	// or zero if pos_channel < 0. Writes the local transform and, composed with
+	// parent (or copied if parent is null), the global transform.
+	void solveJointYXZSoA(const float* const* data, int rot_channel, int pos_channel,
+						  const float* parent, float* local, float* global, size_t stride, size_t n);
+	
+	// Linear blend skinning of n vertices. skin holds one matrix per bone as
+	// SOA_COMPONENTS consecutive floats (bone b at skin + b * SOA_COMPONENTS).
+	// Influence k of vertex i, for k < num_influences (at least 1), is bone
+	// bones[k * stride + i] with weight weights[k * stride + i]. Positions are
+	// pos[c * stride + i] for c = x, y, z, and likewise normals, which may be
+	// null and come out unnormalized. Each vertex is transformed by the
+	// weighted sum of its bones' matrices, several vertices per instruction.
+	void skinLinearBlendSoA(const float* skin, const uint16_t* bones, const float* weights, int num_influences,
+							const float* pos, float* out_pos, const float* normals, float* out_normals,
+							size_t stride, size_t n);
+	
+	// writes lane i of an SoA batch as a full oF 4x4 matrix to dst[i]
+	inline void storeSoA(float* const* dst, const float* m, size_t stride, size_t n)
+	{
+		size_t i = 0;
+#if defined(OFX_BVH_KERNELS_SSE2)
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+		for (; i + 4 <= n; i += 4)
+		{
+			for (int r = 0; r < 4; r++)
+			{
+				__m128 a = _mm_loadu_ps(m + (r * 3 + 0) * stride + i);
+				__m128 b = _mm_loadu_ps(m + (r * 3 + 1) * stride + i);
+				__m128 c = _mm_loadu_ps(m + (r * 3 + 2) * stride + i);
+				__m128 d = r == 3 ? one : zero;
+				_MM_TRANSPOSE4_PS(a, b, c, d);
+				_mm_storeu_ps(dst[i + 0] + r * 4, a);
+				_mm_storeu_ps(dst[i + 1] + r * 4, b);
+				_mm_storeu_ps(dst[i + 2] + r * 4, c);
+				_mm_storeu_ps(dst[i + 3] + r * 4, d);
+			}
+		}
+#endif
+		for (; i < n; i++)
+		{
+			float* o = dst[i];
+			for (int r = 0; r < 4; r++)
+			{
+				o[r * 4 + 0] = m[(r * 3 + 0) * stride + i];
+				o[r * 4 + 1] = m[(r * 3 + 1) * stride + i];
+				o[r * 4 + 2] = m[(r * 3 + 2) * stride + i];
+				o[r * 4 + 3] = r == 3 ? 1 : 0;
+			}
+		}
+	}
+	
+	// 3x4 rotation part of an oF (row-vector) matrix from a unit quaternion
+	inline void quatToMatrix(float* m, float x, float y, float z, float w)
+	{
+		const float x2 = x + x, y2 = y + y, z2 = z + z;
+		const float xx = x * x2, xy = x * y2, xz = x * z2;
+		const float yy = y * y2, yz = y * z2, zz = z * z2;
+		const float wx = w * x2, wy = w * y2, wz = w * z2;
+		
+		m[0] = 1 - (yy + zz); m[1] = xy + wz;       m[2] = xz - wy;        m[3] = 0;
+		m[4] = xy - wz;       m[5] = 1 - (xx + zz); m[6] = yz + wx;        m[7] = 0;
+		m[8] = xz + wy;       m[9] = yz - wx;       m[10] = 1 - (xx + yy); m[11] = 0;
+	}
+	
+	// g = l * p for rigid oF matrices; only the affine part is read, g is a full 4x4
+	inline void composeAffine(float* g, const float* l, const float* p)
+	{
+#if defined(OFX_BVH_KERNELS_SSE2)
+		const __m128 p0 = _mm_loadu_ps(p), p1 = _mm_loadu_ps(p + 4), p2 = _mm_loadu_ps(p + 8);
+		const __m128 p3 = _mm_loadu_ps(p + 12);
+		for (int r = 0; r < 3; r++)
+		{
+			__m128 v = _mm_mul_ps(_mm_set1_ps(l[r * 4 + 0]), p0);
+			v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(l[r * 4 + 1]), p1));
+			v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(l[r * 4 + 2]), p2));
+			_mm_storeu_ps(g + r * 4, v);
+		}
+		__m128 t = _mm_mul_ps(_mm_set1_ps(l[12]), p0);
+		t = _mm_add_ps(t, _mm_mul_ps(_mm_set1_ps(l[13]), p1));
+		t = _mm_add_ps(t, _mm_mul_ps(_mm_set1_ps(l[14]), p2));
+		_mm_storeu_ps(g + 12, _mm_add_ps(t, p3));
+#elif defined(OFX_BVH_KERNELS_NEON)
+		const float32x4_t p0 = vld1q_f32(p), p1 = vld1q_f32(p + 4), p2 = vld1q_f32(p + 8);
+		const float32x4_t p3 = vld1q_f32(p + 12);
+		for (int r = 0; r < 4; r++)
+		{
+			float32x4_t v = vmulq_n_f32(p0, l[r * 4 + 0]);
+			v = vmlaq_n_f32(v, p1, l[r * 4 + 1]);
+			v = vmlaq_n_f32(v, p2, l[r * 4 + 2]);
+			vst1q_f32(g + r * 4, r == 3 ? vaddq_f32(v, p3) : v);
+		}
+#else
+		for (int r = 0; r < 4; r++)
+		{
+			const float a = l[r * 4 + 0], b = l[r * 4 + 1], c = l[r * 4 + 2];
+			g[r * 4 + 0] = a * p[0] + b * p[4] + c * p[8];
+			g[r * 4 + 1] = a * p[1] + b * p[5] + c * p[9];
+			g[r * 4 + 2] = a * p[2] + b * p[6] + c * p[10];
+			g[r * 4 + 3] = a * p[3] + b * p[7] + c * p[11];
+		}
+		g[12] += p[12];
+		g[13] += p[13];
+		g[14] += p[14];
+		g[15] += p[15];
+#endif
+	}
+}
@@ -0,0 +1,202 @@
+#include "ofxBvhMappedFile.h"
+#include "ofxBvhParser.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+	struct SidecarHeader
+	{
+		char magic[8];
+		uint64_t file_size;
+		int64_t file_mtime;
+		uint32_t num_frames;
+		uint32_t num_channels;
+	};
+	
+	const char SIDECAR_MAGIC[8] = { 'B', 'V', 'H', 'I', 'D', 'X', '1', '\0' };
+	
+	// mtime only has second granularity, so a stale index can still match the
+	// header; the row offsets must at least stay inside the mapped file
+	bool checkOffsets(const uint64_t* offsets, uint32_t num_frames, size_t file_size)
+	{
+		for (uint32_t i = 0; i < num_frames; i++)
+			if (offsets[i + 1] < offsets[i]) return false;
+		return offsets[num_frames] <= file_size;
+	}
+}
+
+ofxBvhMappedFile::ofxBvhMappedFile() : data(NULL), size(0), num_frames(0), frame_time(0),
+	offsets(NULL), sidecar(NULL), sidecar_size(0)
+{
+}
+
+ofxBvhMappedFile::~ofxBvhMappedFile()
+{
+	close();
+}
+
+bool ofxBvhMappedFile::open(const string& path, bool use_sidecar)
+{
+	close();
+	
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		ofLogError("ofxBvh") << "can't open " << path;
+		return false;
+	}
+	
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		ofLogError("ofxBvh") << "can't open " << path;
+		return false;
+	}
+	
+	void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+	{
+		ofLogError("ofxBvh") << "can't map " << path;
+		return false;
+	}
+	data = (const char*)p;
+	size = st.st_size;
+	
+	// the hierarchy and MOTION header are at the start, so this only pages in the head of the file
+	const char* end = data + size;
+	const char* hierarchy_begin = ofxBvhParser::find(data, end, "HIERARCHY");
+	const char* motion_begin = ofxBvhParser::find(hierarchy_begin, end, "MOTION");
+	if (hierarchy_begin == end || motion_begin == end)
+	{
+		close();
+		ofLogError("ofxBvh", "invalid bvh format");
+		return false;
+	}
+	
+	hierarchy = ofxBvhHierarchy::parse(hierarchy_begin, motion_begin);
+	int declared_frames = 0;
+	const char* rows_begin = hierarchy ? ofxBvhParser::parseMotionHeader(motion_begin, end, declared_frames, frame_time) : NULL;
+	if (!rows_begin)
+	{
+		close();
+		return false;
+	}
+	
+	const int64_t mtime = st.st_mtime;
+	if (use_sidecar && mapSidecar(path, mtime))
+	{
+		madvise((void*)data, size, MADV_RANDOM);
+		return true;
+	}
+	
+	// one sequential pass over the rows, then let the kernel drop those pages again
+	madvise((void*)data, size, MADV_SEQUENTIAL);
+	built_offsets.reserve(declared_frames + 1);
+	num_frames = ofxBvhParser::indexRows(data, rows_begin, end, declared_frames, built_offsets);
+	built_offsets.push_back(size);
+	offsets = built_offsets.data();
+	madvise((void*)data, size, MADV_DONTNEED);
+	madvise((void*)data, size, MADV_RANDOM);
+	
+	if (num_frames != declared_frames)
+		ofLogWarning("ofxBvh") << "expected " << declared_frames << " frames, found " << num_frames;
+	
+	if (use_sidecar)
+		writeSidecar(path, mtime);
+	
+	return true;
+}
+
+void ofxBvhMappedFile::close()
+{
+	if (data) munmap((void*)data, size);
+	if (sidecar) munmap((void*)sidecar, sidecar_size);
+	
+	data = NULL;
+	size = 0;
+	sidecar = NULL;
+	sidecar_size = 0;
+	
+	hierarchy.reset();
+	num_frames = 0;
+	frame_time = 0;
+	offsets = NULL;
+	built_offsets.clear();
+}
+
+bool ofxBvhMappedFile::readFrame(int frame, float* out)
+{
+	if (frame < 0 || frame >= num_frames) return false;
+	
+	const char* row = data + offsets[frame];
+	const char* row_end = data + offsets[frame + 1];
+	return ofxBvhParser::parseRow(row, row_end, hierarchy->getNumChannels(), out) != NULL;
+}
+
+bool ofxBvhMappedFile::mapSidecar(const string& path, int64_t mtime)
+{
+	const string sidecar_path = getSidecarPath(path);
+	const int fd = ::open(sidecar_path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	
+	struct stat st;
+	void* p = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= off_t(sizeof(SidecarHeader)))
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED) return false;
+	
+	const SidecarHeader* header = (const SidecarHeader*)p;
+	const size_t expected_size = sizeof(SidecarHeader) + (size_t(header->num_frames) + 1) * sizeof(uint64_t);
+	if (memcmp(header->magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC)) != 0
+		|| header->file_size != size || header->file_mtime != mtime
+		|| header->num_channels != uint32_t(hierarchy->getNumChannels())
+		|| size_t(st.st_size) != expected_size
+		|| !checkOffsets((const uint64_t*)((const char*)p + sizeof(SidecarHeader)), header->num_frames, size))
+	{
+		munmap(p, st.st_size);
+		return false;
+	}
+	
+	sidecar = (const char*)p;
+	sidecar_size = st.st_size;
+	num_frames = header->num_frames;
+	offsets = (const uint64_t*)(sidecar + sizeof(SidecarHeader));
+	return true;
+}
+
+// best effort: written to a temporary file and renamed, failures are only logged
+void ofxBvhMappedFile::writeSidecar(const string& path, int64_t mtime)
+{
+	SidecarHeader header;
+	memcpy(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC));
+	header.file_size = size;
+	header.file_mtime = mtime;
+	header.num_frames = num_frames;
+	header.num_channels = hierarchy->getNumChannels();
+	
+	const string sidecar_path = getSidecarPath(path);
+	const string tmp_path = sidecar_path + ".tmp";
+	FILE* f = fopen(tmp_path.c_str(), "wb");
+	bool ok = f != NULL;
+	if (ok)
+	{
+		ok = fwrite(&header, sizeof(header), 1, f) == 1
+			&& fwrite(offsets, sizeof(uint64_t), num_frames + 1, f) == size_t(num_frames) + 1;
+		ok = fclose(f) == 0 && ok;
+	}
+	if (ok)
+		ok = rename(tmp_path.c_str(), sidecar_path.c_str()) == 0;
+	else if (f)
+		remove(tmp_path.c_str());
+	
+	if (!ok)
+		ofLogVerbose("ofxBvh") << "can't write frame index " << sidecar_path;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "ofxBvhFrameSource.h"
+
+// A BVH file mapped read-only, with frames parsed one row at a time when
+// read. Opening parses the hierarchy and an index of where each MOTION row
+// starts; the index is kept in a sidecar file next to the BVH, so later opens
+// map it instead of scanning, and only the rows actually read are paged in.
+// POSIX only.
+class ofxBvhMappedFile : public ofxBvhFrameSource
+{
+public:
+
+	ofxBvhMappedFile();
+	virtual ~ofxBvhMappedFile();
+	
+	// use_sidecar: read the index from, or write it to, getSidecarPath(path)
+	bool open(const string& path, bool use_sidecar = true);
+	void close();
+	bool isOpen() const { return data != NULL; }
+	
+	const ofxBvhHierarchyRef& getHierarchy() const { return hierarchy; }
+	int getNumFrames() const { return num_frames; }
+	float getFrameTime() const { return frame_time; }
+	
+	bool readFrame(int frame, float* out);
+	
+	static string getSidecarPath(const string& path) { return path + ".idx"; }
+
+protected:
+
+	const char* data;
+	size_t size;
+	
+	ofxBvhHierarchyRef hierarchy;
+	int num_frames;
+	float frame_time;
+	
+	// byte offset of each row, num_frames + 1 entries with the file size
+	// last; points into the mapped sidecar or at built_offsets
+	const uint64_t* offsets;
+	vector<uint64_t> built_offsets;
+	const char* sidecar;
+	size_t sidecar_size;
+	
+	bool mapSidecar(const string& path, int64_t mtime);
+	void writeSidecar(const string& path, int64_t mtime);
+};
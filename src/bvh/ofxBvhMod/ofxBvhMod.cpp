@@ -1,310 +1,342 @@
 #include "ofxBvhMod.h"
-
-static inline void billboard();
+#include "ofxBvhMappedFile.h"
 
 ofxBvh::~ofxBvh()
 {
 	unload();
 }
 
-void ofxBvh::load(const string& data)
+bool ofxBvh::load(const string& data)
 {
-	const size_t HIERARCHY_BEGIN = data.find("HIERARCHY", 0);
-	const size_t MOTION_BEGIN = data.find("MOTION", 0);
+	return load(data.data(), data.data() + data.size());
+}
+
+bool ofxBvh::load(const char* begin, const char* end)
+{
+	const char* hierarchy_begin = ofxBvhParser::find(begin, end, "HIERARCHY");
+	const char* motion_begin = ofxBvhParser::find(hierarchy_begin, end, "MOTION");
 	
-	if (HIERARCHY_BEGIN == string::npos
-		|| MOTION_BEGIN == string::npos)
+	if (hierarchy_begin == end
+		|| motion_begin == end)
 	{
+		unload();
 		ofLogError("ofxBvh", "invalid bvh format");
-		return;
+		return false;
 	}
 	
-	parseHierarchy(data.substr(HIERARCHY_BEGIN, MOTION_BEGIN));
+	setup(ofxBvhHierarchy::parse(hierarchy_begin, motion_begin));
+	if (joints.empty()) return false;
 	
-	frame_new = false;
+	// a bare MOTION keyword, as in a hierarchy template, means no frames
+	const char* p = motion_begin + strlen("MOTION");
+	while (p < end && isspace(*p)) p++;
+	if (p == end) return true;
+	
+	return ofxBvhParser::parseMotion(motion_begin, end, getHierarchy()->getNumChannels(),
+									 motion, num_frames, frame_time);
 }
 
-void ofxBvh::unload()
+bool ofxBvh::loadFile(const string& path)
 {
-	for (int i = 0; i < joints.size(); i++)
-		delete joints[i];
-	
-	joints.clear();
-	
-	root = NULL;
-	
-	frames.clear();
-	currentFrame.clear();
-	
-	num_frames = 0;
-	frame_time = 0;
-	
-	rate = 1;
-	play_head = 0;
-	playing = false;
-	loop = false;
+	if (ofxBvhCapture::isCaptureFile(ofToDataPath(path)))
+	{
+		ofxBvhCaptureReader reader;
+		if (!reader.open(ofToDataPath(path)))
+		{
+			unload();
+			return false;
+		}
+		
+		setup(reader.getHierarchy());
+		const int num_channels = getHierarchy()->getNumChannels();
+		motion.resize(size_t(reader.getNumFrames()) * num_channels);
+		for (int i = 0; i < reader.getNumFrames(); i++)
+		{
+			if (!reader.readFrame(i, &motion[size_t(i) * num_channels]))
+			{
+				unload();
+				ofLogError("ofxBvh") << "invalid capture " << path;
+				return false;
+			}
+		}
+		num_frames = reader.getNumFrames();
+		frame_time = reader.getFrameTime();
+		return true;
+	}
 	
-	need_update = false;
+	ofBuffer buffer = ofBufferFromFile(path);
+	if (buffer.size() == 0)
+	{
+		unload();
+		ofLogError("ofxBvh") << "can't load " << path;
+		return false;
+	}
+	return load(buffer.getData(), buffer.getData() + buffer.size());
 }
 
-void ofxBvh::updateJoint(int& index, const FrameData& frame_data, ofxBvhJoint *joint)
+bool ofxBvh::open(const shared_ptr<ofxBvhFrameSource>& source)
 {
-	ofVec3f translate;
-	ofQuaternion rotate;
-	
-	for (int i = 0; i < joint->channel_type.size(); i++)
+	if (!source || !source->getHierarchy())
 	{
-		float v = frame_data[index++];
-		ofxBvhJoint::CHANNEL t = joint->channel_type[i];
-		
-		if (t == ofxBvhJoint::X_POSITION)
-			translate.x = v;
-		else if (t == ofxBvhJoint::Y_POSITION)
-			translate.y = v;
-		else if (t == ofxBvhJoint::Z_POSITION)
-			translate.z = v;
-		else if (t == ofxBvhJoint::X_ROTATION)
-			rotate = ofQuaternion(v, ofVec3f(1, 0, 0)) * rotate;
-		else if (t == ofxBvhJoint::Y_ROTATION)
-			rotate = ofQuaternion(v, ofVec3f(0, 1, 0)) * rotate;
-		else if (t == ofxBvhJoint::Z_ROTATION)
-			rotate = ofQuaternion(v, ofVec3f(0, 0, 1)) * rotate;
+		unload();
+		return false;
 	}
 	
-	joint->matrix.makeIdentityMatrix();
-	joint->matrix.glTranslate(translate);
-	joint->matrix.glRotate(rotate);
-    
-//    translate += joint->initial_offset;
-	
-	joint->global_matrix = joint->matrix;
-	joint->offset = translate;
+	setup(source->getHierarchy());
+	this->source = source;
+	frame_buffer.resize(getHierarchy()->getNumChannels());
+	num_frames = source->getNumFrames();
+	frame_time = source->getFrameTime();
+	return true;
+}
+
+bool ofxBvh::openFile(const string& path)
+{
+	if (ofxBvhCapture::isCaptureFile(ofToDataPath(path)))
+	{
+		shared_ptr<ofxBvhCaptureReader> reader = make_shared<ofxBvhCaptureReader>();
+		if (!reader->open(ofToDataPath(path)))
+		{
+			unload();
+			return false;
+		}
+		return open(reader);
+	}
 	
-	if (joint->parent)
+	shared_ptr<ofxBvhMappedFile> file = make_shared<ofxBvhMappedFile>();
+	if (!file->open(ofToDataPath(path)))
 	{
-		joint->global_matrix.postMult(joint->parent->global_matrix);
+		unload();
+		return false;
 	}
+	return open(file);
+}
+
+bool ofxBvh::saveCapture(const string& path, const ofxBvhCaptureWriter::Settings& settings) const
+{
+	if (joints.empty()) return false;
+	
+	ofxBvhCaptureWriter writer;
+	if (!writer.open(ofToDataPath(path), getHierarchy(), frame_time, settings)) return false;
 	
-	for (int i = 0; i < joint->children.size(); i++)
+	vector<float> buffer(getHierarchy()->getNumChannels());
+	for (int i = 0; i < num_frames; i++)
 	{
-		updateJoint(index, frame_data, joint->children[i]);
+		const float* data = getFrameData(i);
+		if (!data && source && source->readFrame(i, buffer.data()))
+			data = buffer.data();
+		if (!data || !writer.addFrame(data)) return false;
 	}
+	return writer.close();
 }
 
-void ofxBvh::update(const vector<float>& data)
+const float* ofxBvh::getFrameData(int frame) const
 {
-    int index = 0;
-    updateJoint(index, data, root);
+	if (frame < 0 || frame >= num_frames || motion.empty()) return NULL;
+	return &motion[size_t(frame) * getHierarchy()->getNumChannels()];
 }
 
-void ofxBvh::draw()
+void ofxBvh::setFrame(int frame)
 {
-	ofPushStyle();
-	ofFill();
+	if (frame < 0 || frame >= num_frames) return;
+	
+	const float* data = getFrameData(frame);
+	if (!data && source && source->readFrame(frame, frame_buffer.data()))
+		data = frame_buffer.data();
+	
+	play_head = frame * frame_time;
+	need_update = false;
 	
-	for (int i = 0; i < joints.size(); i++)
+	if (data)
 	{
-		ofxBvhJoint *o = joints[i];
-		glPushMatrix();
-		glMultMatrixf(o->getGlobalMatrix().getPtr());
-		
-		if (o->isSite())
-		{
-			ofSetColor(ofColor::yellow);
-			billboard();
-			ofCircle(0, 0, 2);
-		}
-		else if (o->getChildren().size() == 1)
-		{
-			ofSetColor(ofColor::white);		
-			billboard();
-			ofCircle(0, 0, 2);
-		}
-		else if (o->getChildren().size() > 1)
-		{
-			if (o->isRoot())
-				ofSetColor(ofColor::cyan);
-			else
-				ofSetColor(ofColor::green);
-			
-			billboard();
-			ofCircle(0, 0, 2);
-		}
-        
-		glPopMatrix();
-        
-        if (o->getChildren().size() > 0) {
-            glPushMatrix();
-            glMultMatrixf(o->getGlobalMatrix().getPtr());
-            glLineWidth(2);
-            for (int i=0; i<o->getChildren().size(); ++i) {
-                ofSetColor(ofColor::gray);
-                ofVec3f v = o->getChildren()[i]->getOffset();
-                ofLine(0, 0, 0, v.x, v.y, v.z);
-            }
-            glPopMatrix();
-        }
+		solver.solve(data, getHierarchy()->getNumChannels());
+		current_frame = frame;
+		frame_new = true;
 	}
+}
+
+void ofxBvh::play()
+{
+	// restart from the beginning if the last play ran off the end
+	if (!loop && num_frames > 0 && (rate >= 0 ? play_head >= getDuration() : play_head <= 0))
+		setTime(rate >= 0 ? 0 : getDuration());
 	
-	ofPopStyle();
+	playing = true;
+	last_update = chrono::steady_clock::now();
+}
+
+void ofxBvh::stop()
+{
+	playing = false;
 }
 
-void ofxBvh::parseHierarchy(const string& data)
+void ofxBvh::togglePlaying()
 {
-	vector<string> tokens;
-	string token;
+	if (playing) stop();
+	else play();
+}
+
+void ofxBvh::setTime(double time)
+{
+	play_head = max(0.0, min(time, double(getDuration())));
+	need_update = true;
+}
+
+float ofxBvh::getPosition() const
+{
+	const float duration = getDuration();
+	return duration > 0 ? play_head / duration : 0;
+}
+
+void ofxBvh::update()
+{
+	frame_new = false;
+	if (num_frames == 0) return;
 	
-	total_channels = 0;
-	num_frames = 0;
-	frame_time = 0;
+	const chrono::steady_clock::time_point now = chrono::steady_clock::now();
 	
-	for (int i = 0; i < data.size(); i++)
+	if (playing)
 	{
-		char c = data[i];
+		play_head += chrono::duration<double>(now - last_update).count() * rate;
 		
-		if (isspace(c))
+		const double duration = getDuration();
+		if (loop && duration > 0)
 		{
-			if (!token.empty()) tokens.push_back(token);
-			token.clear();
+			play_head = fmod(play_head, duration);
+			if (play_head < 0) play_head += duration;
 		}
-		else
+		else if (rate >= 0 ? play_head >= duration : play_head <= 0)
 		{
-			token.push_back(c);
+			play_head = max(0.0, min(play_head, duration));
+			playing = false;
 		}
 	}
 	
-	int index = 0;
-	while (index < tokens.size())
+	last_update = now;
+	
+	// the end of the last frame still shows the last frame
+	const int frame = frame_time > 0 ? min(int(play_head / frame_time), num_frames - 1) : 0;
+	if (frame != current_frame || need_update)
 	{
-		if (tokens[index++] == "ROOT")
-		{
-			root = parseJoint(index, tokens, NULL);
-		}
+		const double time = play_head;
+		setFrame(frame);
+		play_head = time;
 	}
 }
 
-ofxBvhJoint* ofxBvh::parseJoint(int& index, vector<string> &tokens, ofxBvhJoint *parent)
+void ofxBvh::setup(const ofxBvhHierarchyRef& hierarchy)
+{
+	unload();
+	
+	frame_new = false;
+	
+	if (!hierarchy) return;
+	
+	solver.setHierarchy(hierarchy);
+	joints.reserve(hierarchy->getNumJoints());
+	for (int i = 0; i < hierarchy->getNumJoints(); i++)
+		joints.push_back(ofxBvhJoint(this, i));
+}
+
+void ofxBvh::unload()
 {
-	string name = tokens[index++];
-	ofxBvhJoint *joint = new ofxBvhJoint(name, parent);
-	if (parent) parent->children.push_back(joint);
+	joints.clear();
+	solver.clear();
+	
+	motion.clear();
+	source.reset();
+	frame_buffer.clear();
 	
-	joint->bvh = this;
+	num_frames = 0;
+	frame_time = 0;
 	
-	joints.push_back(joint);
-	jointMap[name] = joint;
+	rate = 1;
+	play_head = 0;
+	playing = false;
+	current_frame = -1;
+	loop = false;
 	
-	while (index < tokens.size())
+	need_update = false;
+}
+
+void ofxBvh::updateJoint(int index, const FrameData& frame_data)
+{
+	const ofxBvhHierarchy& h = *getHierarchy();
+	
+	ofVec3f translate;
+	ofQuaternion rotate;
+	
+	for (int i = 0; i < h.getNumJointChannels(index); i++)
 	{
-		string token = tokens[index++];
+		float v = frame_data[h.getChannelOffset(index) + i];
+		ofxBvhHierarchy::CHANNEL t = h.getChannel(index, i);
 		
-		if (token == "OFFSET")
-		{
-			joint->initial_offset.x = ofToFloat(tokens[index++]);
-			joint->initial_offset.y = ofToFloat(tokens[index++]);
-			joint->initial_offset.z = ofToFloat(tokens[index++]);
-			
-			joint->offset = joint->initial_offset;
-		}
-		else if (token == "CHANNELS")
-		{
-			int num = ofToInt(tokens[index++]);
-			
-			joint->channel_type.resize(num);
-			total_channels += num;
-			
-			for (int i = 0; i < num; i++)
-			{
-				string ch = tokens[index++];
-				
-				char axis = tolower(ch[0]);
-				char elem = tolower(ch[1]);
-				
-				if (elem == 'p')
-				{
-					if (axis == 'x')
-						joint->channel_type[i] = ofxBvhJoint::X_POSITION;
-					else if (axis == 'y')
-						joint->channel_type[i] = ofxBvhJoint::Y_POSITION;
-					else if (axis == 'z')
-						joint->channel_type[i] = ofxBvhJoint::Z_POSITION;
-					else
-					{
-						ofLogError("ofxBvh", "invalid bvh format");
-						return NULL;
-					}
-				}
-				else if (elem == 'r')
-				{
-					if (axis == 'x')
-						joint->channel_type[i] = ofxBvhJoint::X_ROTATION;
-					else if (axis == 'y')
-						joint->channel_type[i] = ofxBvhJoint::Y_ROTATION;
-					else if (axis == 'z')
-						joint->channel_type[i] = ofxBvhJoint::Z_ROTATION;
-					else
-					{
-						ofLogError("ofxBvh", "invalid bvh format");
-						return NULL;
-					}
-				}
-				else
-				{
-					ofLogError("ofxBvh", "invalid bvh format");
-					return NULL;
-				}
-			}
-		}
-		else if (token == "JOINT"
-				 || token == "End")
-		{
-			parseJoint(index, tokens, joint);
-		}
-		else if (token == "}")
-		{
-			break;
-		}
+		if (t == ofxBvhHierarchy::X_POSITION)
+			translate.x = v;
+		else if (t == ofxBvhHierarchy::Y_POSITION)
+			translate.y = v;
+		else if (t == ofxBvhHierarchy::Z_POSITION)
+			translate.z = v;
+		else if (t == ofxBvhHierarchy::X_ROTATION)
+			rotate = ofQuaternion(v, ofVec3f(1, 0, 0)) * rotate;
+		else if (t == ofxBvhHierarchy::Y_ROTATION)
+			rotate = ofQuaternion(v, ofVec3f(0, 1, 0)) * rotate;
+		else if (t == ofxBvhHierarchy::Z_ROTATION)
+			rotate = ofQuaternion(v, ofVec3f(0, 0, 1)) * rotate;
 	}
 	
-	return joint;
+	ofMatrix4x4& matrix = solver.matrices[index];
+	ofMatrix4x4& global_matrix = solver.global_matrices[index];
+	
+	matrix.makeIdentityMatrix();
+	matrix.glTranslate(translate);
+	matrix.glRotate(rotate);
+	
+	global_matrix = matrix;
+	solver.offsets[index] = translate;
+	
+	const int parent = h.getParent(index);
+	if (parent >= 0)
+	{
+		global_matrix.postMult(solver.global_matrices[parent]);
+	}
+	
+	for (int i = 0; i < h.getNumChildren(index); i++)
+	{
+		updateJoint(h.getChild(index, i), frame_data);
+	}
 }
 
-const ofxBvhJoint* ofxBvh::getJoint(int index)
+void ofxBvh::update(const vector<float>& data)
 {
-	return joints.at(index);
+    solver.solve(data.data(), data.size());
 }
 
-const ofxBvhJoint* ofxBvh::getJoint(string name)
+// reference implementation kept for validating and benchmarking ofxBvhSolver
+void ofxBvh::updateRecursive(const vector<float>& data)
 {
-	return jointMap[name];
+    if (joints.empty() || data.size() < size_t(getHierarchy()->getNumChannels())) return;
+    updateJoint(0, data);
+
+    // everything is current, so lazy reads must not re-solve older channels
+    solver.frame++;
+    fill(solver.solved_frames.begin(), solver.solved_frames.end(), solver.frame);
 }
 
-static inline void billboard()
+void ofxBvh::draw()
 {
-	GLfloat m[16];
-	glGetFloatv(GL_MODELVIEW_MATRIX, m);
-	
-	float inv_len;
-	
-	m[8] = -m[12];
-	m[9] = -m[13];
-	m[10] = -m[14];
-	inv_len = 1. / sqrt(m[8] * m[8] + m[9] * m[9] + m[10] * m[10]);
-	m[8] *= inv_len;
-	m[9] *= inv_len;
-	m[10] *= inv_len;
-	
-	m[0] = -m[14];
-	m[1] = 0.0;
-	m[2] = m[12];
-	inv_len = 1. / sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
-	m[0] *= inv_len;
-	m[1] *= inv_len;
-	m[2] *= inv_len;
-	
-	m[4] = m[9] * m[2] - m[10] * m[1];
-	m[5] = m[10] * m[0] - m[8] * m[2];
-	m[6] = m[8] * m[1] - m[9] * m[0];
-	
-	glLoadMatrixf(m);
-}
\ No newline at end of file
+	renderer.begin();
+	renderer.add(*this);
+	renderer.draw();
+}
+
+const ofxBvhJoint* ofxBvh::getJoint(int index) const
+{
+	return &joints.at(index);
+}
+
+const ofxBvhJoint* ofxBvh::getJoint(const string& name) const
+{
+	const int index = joints.empty() ? -1 : getHierarchy()->findJoint(name);
+	return index < 0 ? NULL : &joints[index];
+}
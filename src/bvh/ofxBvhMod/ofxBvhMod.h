@@ -1,90 +1,160 @@
 #pragma once
 
 #include "ofMain.h"
+#include "ofxBvhSolver.h"
+#include "ofxBvhFrameSource.h"
+#include "ofxBvhCapture.h"
+#include "ofxBvhRenderer.h"
+
+#include <chrono>
 
 class ofxBvh;
 
+// Handle to one joint of an ofxBvh. Names and structure come from the
+// shared ofxBvhHierarchy, pose from the owning ofxBvh's solver.
 class ofxBvhJoint
 {
 	friend class ofxBvh;
-	
+
 public:
+
+	ofxBvhJoint(ofxBvh* bvh, int index) : bvh(bvh), index(index) {}
 	
-	enum CHANNEL
-	{
-		X_ROTATION, Y_ROTATION, Z_ROTATION,
-		X_POSITION, Y_POSITION, Z_POSITION
-	};
-	
-	ofxBvhJoint(string name, ofxBvhJoint *parent) : name(name),  parent(parent), index(-1) {}
+	inline const string& getName() const;
+	inline int getIndex() const { return index; }
+	inline const ofVec3f& getInitialOffset() const;
+	inline const ofVec3f& getOffset() const;
 	
-	inline const string& getName() const { return name; }
-	inline const ofVec3f& getOffset() const { return offset; }
+	inline const ofMatrix4x4& getMatrix() const;
+	inline const ofMatrix4x4& getGlobalMatrix() const;
 	
-	inline const ofMatrix4x4& getMatrix() const { return matrix; }
-	inline const ofMatrix4x4& getGlobalMatrix() const { return global_matrix; }
+	inline ofVec3f getPosition() const { return getGlobalMatrix().getTranslation(); }
+	inline ofQuaternion getRotate() const { return getGlobalMatrix().getRotate(); }
 	
-	inline ofVec3f getPosition() const { return global_matrix.getTranslation(); }
-	inline ofQuaternion getRotate() const { return global_matrix.getRotate(); }
+	inline const ofxBvhJoint* getParent() const;
+	inline int getNumChildren() const;
+	inline const ofxBvhJoint* getChild(int i) const;
 	
-	inline ofxBvhJoint* getParent() const { return parent; }
-	inline const vector<ofxBvhJoint*>& getChildren() const { return children; }
-
-	inline bool isSite() const { return children.empty(); }
-	inline bool isRoot() const { return !parent; }
+	inline bool isSite() const { return getNumChildren() == 0; }
+	inline bool isRoot() const { return !getParent(); }
 	
 	inline ofxBvh* getBvh() const { return bvh; }
-	
-protected:
-    int index;
 
-	string name;
-	ofVec3f initial_offset;
-	ofVec3f offset;
-	
-	ofMatrix4x4 matrix;
-	ofMatrix4x4 global_matrix;
-	
+protected:
 	ofxBvh* bvh;
-	
-	vector<ofxBvhJoint*> children;
-	ofxBvhJoint* parent;
-	
-	vector<CHANNEL> channel_type;
+	int index;
 };
 
 class ofxBvh
 {
 public:
+
+	ofxBvh() : rate(1), loop(false),
+		playing(false), play_head(0), need_update(false)
+	{
+		unload();
+	}
+	
+	ofxBvh(const string& data) : rate(1), loop(false),
+		playing(false), play_head(0), need_update(false)
+	{
+		load(data);
+	}
 	
-	ofxBvh(const string& data) : root(NULL), total_channels(0), rate(1), loop(false),
+	// shares an already parsed hierarchy, e.g. between avatars
+	ofxBvh(const ofxBvhHierarchyRef& hierarchy) : rate(1), loop(false),
 		playing(false), play_head(0), need_update(false)
-    {
-        load(data);
-    }
+	{
+		setup(hierarchy);
+	}
 	
 	virtual ~ofxBvh();
 	
-    void update(const vector<float>& data);
+	// Parses BVH text: the hierarchy and, if present, every MOTION frame into
+	// one contiguous matrix. Rows are parsed on all cores for large files.
+	bool load(const string& data);
+	bool load(const char* begin, const char* end);
+	// BVH text or an ofxBvhCapture file
+	bool loadFile(const string& path);
+	
+	// Plays frames from a source instead of loading them; each frame is read
+	// when it is shown. openFile memory-maps the file, see ofxBvhMappedFile
+	// and ofxBvhCaptureReader.
+	bool open(const shared_ptr<ofxBvhFrameSource>& source);
+	bool openFile(const string& path);
+	
+	// writes every frame as a compact binary capture, see ofxBvhCapture.h
+	bool saveCapture(const string& path, const ofxBvhCaptureWriter::Settings& settings = ofxBvhCaptureWriter::Settings()) const;
+	
+	int getNumFrames() const { return num_frames; }
+	float getFrameTime() const { return frame_time; }
+	// getHierarchy()->getNumChannels() values per frame, frames back to back;
+	// empty when playing from a source
+	const vector<float>& getMotion() const { return motion; }
+	const float* getFrameData(int frame) const;
+	// seeks to a frame and solves its pose
+	void setFrame(int frame);
+	int getFrame() const { return current_frame; }
+	
+	// advances playback by the wall-clock time since the last call and
+	// solves the pose if the frame changed
+	void update();
+	void update(const vector<float>& data);
+	void updateRecursive(const vector<float>& data);
+	
+	// see ofxBvhSolver::setLazy: joints are only solved when read
+	void setLazy(bool lazy) { solver.setLazy(lazy); }
+	bool isLazy() const { return solver.isLazy(); }
+	
+	// one mesh and one draw call for the whole skeleton, facing the current
+	// view; the renderer is this ofxBvh's own, e.g. to set its style
 	void draw();
-		
+	ofxBvhRenderer& getRenderer() { return renderer; }
+	
+	void play();
+	void stop();
+	void togglePlaying();
+	bool isPlaying() const { return playing; }
+	
+	void setLoop(bool loop) { this->loop = loop; }
+	bool isLoop() const { return loop; }
+	
+	// playback speed, negative plays backwards
+	void setRate(float rate) { this->rate = rate; }
+	float getRate() const { return rate; }
+	
+	// seconds, or 0..1 of the duration for setPosition/getPosition
+	void setTime(double time);
+	double getTime() const { return play_head; }
+	float getDuration() const { return num_frames * frame_time; }
+	void setPosition(float pos) { setTime(pos * getDuration()); }
+	float getPosition() const;
+	
+	// true if the last update() showed a different frame
+	bool isFrameNew() const { return frame_new; }
+	
 	const int getNumJoints() const { return joints.size(); }
-	const ofxBvhJoint* getJoint(int index);
-	const ofxBvhJoint* getJoint(string name);
+	const ofxBvhJoint* getJoint(int index) const;
+	const ofxBvhJoint* getJoint(const string& name) const;
+	
+	const ofxBvhHierarchyRef& getHierarchy() const { return solver.getHierarchy(); }
+	const ofxBvhSolver& getSolver() const { return solver; }
 protected:
-    void load(const string& data);
-    void unload();
+	void setup(const ofxBvhHierarchyRef& hierarchy);
+	void unload();
 	
 	typedef vector<float> FrameData;
 	
-	int total_channels;
+	vector<ofxBvhJoint> joints;
+	
+	// hierarchy and pose storage for all joints, see ofxBvhJoint accessors
+	ofxBvhSolver solver;
+	ofxBvhRenderer renderer;
 	
-	ofxBvhJoint* root;
-	vector<ofxBvhJoint*> joints;
-	map<string, ofxBvhJoint*> jointMap;
+	vector<float> motion;
 	
-	vector<FrameData> frames;
-	FrameData currentFrame;
+	shared_ptr<ofxBvhFrameSource> source;
+	vector<float> frame_buffer;
 	
 	int num_frames;
 	float frame_time;
@@ -92,14 +162,33 @@ protected:
 	float rate;
 	
 	bool playing;
-	float play_head;
+	double play_head;
+	chrono::steady_clock::time_point last_update;
+	int current_frame;
 	
 	bool loop;
 	bool need_update;
 	bool frame_new;
 	
-	void parseHierarchy(const string& data);
-	ofxBvhJoint* parseJoint(int& index, vector<string> &tokens, ofxBvhJoint *parent);
-	void updateJoint(int& index, const FrameData& frame_data, ofxBvhJoint *joint);
-	
-};
\ No newline at end of file
+	void updateJoint(int index, const FrameData& frame_data);
+
+private:
+	// joints point back at their ofxBvh
+	ofxBvh(const ofxBvh&);
+	ofxBvh& operator=(const ofxBvh&);
+};
+
+inline const string& ofxBvhJoint::getName() const { return bvh->getHierarchy()->getName(index); }
+inline const ofVec3f& ofxBvhJoint::getInitialOffset() const { return bvh->getHierarchy()->getInitialOffset(index); }
+inline const ofVec3f& ofxBvhJoint::getOffset() const { return bvh->getSolver().getOffset(index); }
+inline const ofMatrix4x4& ofxBvhJoint::getMatrix() const { return bvh->getSolver().getMatrix(index); }
+inline const ofMatrix4x4& ofxBvhJoint::getGlobalMatrix() const { return bvh->getSolver().getGlobalMatrix(index); }
+
+inline const ofxBvhJoint* ofxBvhJoint::getParent() const
+{
+	const int p = bvh->getHierarchy()->getParent(index);
+	return p < 0 ? NULL : bvh->getJoint(p);
+}
+
+inline int ofxBvhJoint::getNumChildren() const { return bvh->getHierarchy()->getNumChildren(index); }
+inline const ofxBvhJoint* ofxBvhJoint::getChild(int i) const { return bvh->getJoint(bvh->getHierarchy()->getChild(index, i)); }
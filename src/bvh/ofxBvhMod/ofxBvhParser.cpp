@@ -0,0 +1,336 @@
+#include "ofxBvhParser.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+namespace ofxBvhParser
+{
+	// below this many bytes per thread, MOTION rows are parsed on the calling thread
+	static const size_t MIN_BYTES_PER_THREAD = 1 << 20;
+	
+	static inline bool isSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+	}
+	
+	static inline bool isDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+	
+	void tokenize(const char* begin, const char* end, vector<Token>& tokens)
+	{
+		const char* p = begin;
+		while (p < end)
+		{
+			while (p < end && isSpace(*p)) p++;
+			const char* s = p;
+			while (p < end && !isSpace(*p)) p++;
+			if (p > s) tokens.push_back(Token(s, p - s));
+		}
+	}
+	
+	const char* find(const char* begin, const char* end, const char* s)
+	{
+		return search(begin, end, s, s + strlen(s));
+	}
+	
+	// Exact powers of ten in double. A decimal with at most 19 significant
+	// digits and a power of ten in this table converts with one correctly
+	// rounded double operation (Clinger's fast path), then rounds to float.
+	static const double POW10[] =
+	{
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	
+	const char* parseFloat(const char* p, const char* end, float& value)
+	{
+		const char* start = p;
+		
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+		
+		uint64_t mantissa = 0;
+		int digits = 0;
+		int exp10 = 0;
+		bool any = false;
+		
+		for (; p < end && isDigit(*p); p++, any = true)
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa) digits++;
+			}
+			else
+				exp10++;
+		}
+		
+		if (p < end && *p == '.')
+		{
+			for (p++; p < end && isDigit(*p); p++, any = true)
+			{
+				if (digits < 19)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					if (mantissa) digits++;
+					exp10--;
+				}
+			}
+		}
+		
+		if (!any) return NULL;
+		
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			const char* q = p + 1;
+			bool negative_exp = false;
+			if (q < end && (*q == '-' || *q == '+'))
+				negative_exp = *q++ == '-';
+			if (q < end && isDigit(*q))
+			{
+				int e = 0;
+				for (; q < end && isDigit(*q); q++)
+					if (e < 10000) e = e * 10 + (*q - '0');
+				exp10 += negative_exp ? -e : e;
+				p = q;
+			}
+		}
+		
+		double v;
+		if (mantissa < (1ull << 53) && exp10 >= -22 && exp10 <= 22)
+		{
+			v = exp10 < 0 ? mantissa / POW10[-exp10] : mantissa * POW10[exp10];
+		}
+		else
+		{
+			// rare: too many digits or a large exponent
+			char buf[64];
+			const size_t n = p - start;
+			if (n < sizeof(buf))
+			{
+				memcpy(buf, start, n);
+				buf[n] = '\0';
+				v = fabs(strtod(buf, NULL));
+			}
+			else
+				v = mantissa * pow(10.0, exp10);
+		}
+		
+		value = float(negative ? -v : v);
+		return p;
+	}
+	
+	const char* parseInt(const char* p, const char* end, int& value)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+		
+		if (p == end || !isDigit(*p)) return NULL;
+		
+		int64_t v = 0;
+		for (; p < end && isDigit(*p); p++)
+			if (v <= INT32_MAX) v = v * 10 + (*p - '0');
+		
+		v = negative ? -v : v;
+		value = int(max<int64_t>(INT32_MIN, min<int64_t>(INT32_MAX, v)));
+		return p;
+	}
+	
+	static inline const char* nextLine(const char* p, const char* end)
+	{
+		const char* n = (const char*)memchr(p, '\n', end - p);
+		return n ? n + 1 : end;
+	}
+	
+	static inline bool isBlank(const char* p, const char* line_end)
+	{
+		for (; p < line_end; p++)
+			if (!isSpace(*p)) return false;
+		return true;
+	}
+	
+	static int countRows(const char* begin, const char* end)
+	{
+		int rows = 0;
+		for (const char* p = begin; p < end; )
+		{
+			const char* next = nextLine(p, end);
+			if (!isBlank(p, next)) rows++;
+			p = next;
+		}
+		return rows;
+	}
+	
+	const char* parseRow(const char* p, const char* end, int num_channels, float* out)
+	{
+		const char* next = nextLine(p, end);
+		for (int c = 0; c < num_channels; c++)
+		{
+			while (p < next && isSpace(*p)) p++;
+			p = parseFloat(p, next, out[c]);
+			if (!p) return NULL;
+		}
+		return next;
+	}
+	
+	// parses up to max_rows non-blank rows of [begin, end) into out
+	static bool parseRows(const char* begin, const char* end, int num_channels, float* out, int max_rows)
+	{
+		int rows = 0;
+		for (const char* p = begin; p < end && rows < max_rows; )
+		{
+			const char* next = nextLine(p, end);
+			if (isBlank(p, next))
+			{
+				p = next;
+				continue;
+			}
+			
+			if (!parseRow(p, next, num_channels, out)) return false;
+			out += num_channels;
+			
+			rows++;
+			p = next;
+		}
+		return true;
+	}
+	
+	int indexRows(const char* base, const char* begin, const char* end, int max_rows, vector<uint64_t>& offsets)
+	{
+		int rows = 0;
+		for (const char* p = begin; p < end && rows < max_rows; )
+		{
+			const char* next = nextLine(p, end);
+			if (!isBlank(p, next))
+			{
+				offsets.push_back(p - base);
+				rows++;
+			}
+			p = next;
+		}
+		return rows;
+	}
+	
+	const char* parseMotionHeader(const char* begin, const char* end, int& num_frames, float& frame_time)
+	{
+		num_frames = 0;
+		frame_time = 0;
+		
+		// [MOTION] Frames: n Frame Time: t
+		const char* p = begin;
+		Token header[5];
+		int found = 0;
+		while (found < 5 && p < end)
+		{
+			while (p < end && isSpace(*p)) p++;
+			const char* s = p;
+			while (p < end && !isSpace(*p)) p++;
+			if (p == s) break;
+			const Token t(s, p - s);
+			if (found == 0 && t == "MOTION") continue;
+			header[found++] = t;
+		}
+		
+		if (found < 5 || header[0] != "Frames:" || !parseInt(header[1], num_frames)
+			|| header[2] != "Frame" || header[3] != "Time:" || !parseFloat(header[4], frame_time)
+			|| num_frames < 0)
+		{
+			ofLogError("ofxBvh", "invalid bvh format");
+			num_frames = 0;
+			frame_time = 0;
+			return NULL;
+		}
+		
+		return nextLine(p, end);
+	}
+	
+	bool parseMotion(const char* begin, const char* end, int num_channels,
+					 vector<float>& motion, int& num_frames, float& frame_time, int num_threads)
+	{
+		motion.clear();
+		
+		int declared_frames = 0;
+		const char* rows_begin = parseMotionHeader(begin, end, declared_frames, frame_time);
+		if (!rows_begin)
+		{
+			num_frames = 0;
+			return false;
+		}
+		
+		if (num_channels <= 0)
+		{
+			num_frames = declared_frames;
+			return true;
+		}
+		
+		// split at line starts, count rows per chunk, then parse each chunk
+		// straight into its rows of the matrix
+		if (num_threads <= 0) num_threads = max(1u, std::thread::hardware_concurrency());
+		const size_t bytes = end - rows_begin;
+		const int num_chunks = max<int>(1, min<size_t>(num_threads, bytes / MIN_BYTES_PER_THREAD));
+		
+		vector<const char*> bounds(num_chunks + 1, end);
+		bounds[0] = rows_begin;
+		for (int i = 1; i < num_chunks; i++)
+			bounds[i] = nextLine(max(bounds[i - 1], rows_begin + bytes * i / num_chunks), end);
+		
+		vector<int> rows(num_chunks + 1, 0);
+		{
+			vector<std::thread> threads;
+			for (int i = 1; i < num_chunks; i++)
+				threads.push_back(std::thread([&, i]() { rows[i + 1] = countRows(bounds[i], bounds[i + 1]); }));
+			rows[1] = countRows(bounds[0], bounds[1]);
+			for (size_t i = 0; i < threads.size(); i++)
+				threads[i].join();
+		}
+		for (int i = 0; i < num_chunks; i++)
+			rows[i + 1] += rows[i];
+		
+		num_frames = min(declared_frames, rows[num_chunks]);
+		if (num_frames != declared_frames)
+			ofLogWarning("ofxBvh") << "expected " << declared_frames << " frames, found " << rows[num_chunks];
+		
+		motion.resize(size_t(num_frames) * num_channels);
+		
+		// the last chunk is parsed on the calling thread
+		vector<char> ok(num_chunks, 1);
+		{
+			vector<std::thread> threads;
+			for (int i = 0; i < num_chunks; i++)
+			{
+				const int first = rows[i];
+				const int count = min(rows[i + 1], num_frames) - first;
+				if (count <= 0) continue;
+				
+				float* out = &motion[size_t(first) * num_channels];
+				if (i + 1 < num_chunks)
+					threads.push_back(std::thread([&, i, out, count]() {
+						ok[i] = parseRows(bounds[i], bounds[i + 1], num_channels, out, count);
+					}));
+				else
+					ok[i] = parseRows(bounds[i], bounds[i + 1], num_channels, out, count);
+			}
+			for (size_t i = 0; i < threads.size(); i++)
+				threads[i].join();
+		}
+		
+		for (int i = 0; i < num_chunks; i++)
+		{
+			if (!ok[i])
+			{
+				ofLogError("ofxBvh", "invalid bvh format");
+				motion.clear();
+				num_frames = 0;
+				return false;
+			}
+		}
+		
+		return true;
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "ofMain.h"
+
+// Text parsing for BVH files. Tokens point into the source text instead of
+// copying it, and MOTION rows are parsed straight into one contiguous float
+// matrix, split across threads for large files.
+namespace ofxBvhParser
+{
+	// a run of non-whitespace characters in the source text
+	struct Token
+	{
+		const char* data;
+		size_t size;
+		
+		Token() : data(NULL), size(0) {}
+		Token(const char* data, size_t size) : data(data), size(size) {}
+		
+		inline bool operator==(const char* s) const { return strlen(s) == size && memcmp(data, s, size) == 0; }
+		inline bool operator!=(const char* s) const { return !(*this == s); }
+		inline string str() const { return string(data, size); }
+	};
+	
+	// appends the whitespace separated tokens of [begin, end) to tokens
+	void tokenize(const char* begin, const char* end, vector<Token>& tokens);
+	
+	// first occurrence of s in [begin, end), or end
+	const char* find(const char* begin, const char* end, const char* s);
+	
+	// Parses a decimal number at p, like strtof but locale independent and
+	// without needing a terminator. Returns the end of the number, or NULL
+	// if p doesn't start one.
+	const char* parseFloat(const char* p, const char* end, float& value);
+	const char* parseInt(const char* p, const char* end, int& value);
+	
+	inline bool parseFloat(const Token& t, float& value) { return parseFloat(t.data, t.data + t.size, value) == t.data + t.size; }
+	inline bool parseInt(const Token& t, int& value) { return parseInt(t.data, t.data + t.size, value) == t.data + t.size; }
+	
+	// Parses the MOTION header ("Frames:" and "Frame Time:"); returns the
+	// start of the first row, or NULL on error.
+	const char* parseMotionHeader(const char* begin, const char* end, int& num_frames, float& frame_time);
+	
+	// parses one row of num_channels values at p; returns the start of the next line, or NULL
+	const char* parseRow(const char* p, const char* end, int num_channels, float* out);
+	
+	// appends the offsets from base of up to max_rows non-blank rows of
+	// [begin, end); returns the number found
+	int indexRows(const char* base, const char* begin, const char* end, int max_rows, vector<uint64_t>& offsets);
+	
+	// Parses a MOTION section ("Frames:", "Frame Time:", then one row of
+	// num_channels values per frame) into motion, row major. Rows are parsed
+	// on up to num_threads threads, 0 for one per core.
+	bool parseMotion(const char* begin, const char* end, int num_channels,
+					 vector<float>& motion, int& num_frames, float& frame_time, int num_threads = 0);
+}
@@ -0,0 +1,138 @@
+#include "ofxBvhRenderer.h"
+#include "ofxBvhMod.h"
+
+static inline ofVec3f cross(const ofVec3f& a, const ofVec3f& b)
+{
+	return ofVec3f(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+// unit box corners, and its edges as corner pairs
+static const float box_corners[8][3] = {
+	{-0.5f, -0.5f, -0.5f}, {0.5f, -0.5f, -0.5f}, {0.5f, 0.5f, -0.5f}, {-0.5f, 0.5f, -0.5f},
+	{-0.5f, -0.5f, 0.5f}, {0.5f, -0.5f, 0.5f}, {0.5f, 0.5f, 0.5f}, {-0.5f, 0.5f, 0.5f},
+};
+static const int box_edges[12][2] = {
+	{0, 1}, {1, 2}, {2, 3}, {3, 0},
+	{4, 5}, {5, 6}, {6, 7}, {7, 4},
+	{0, 4}, {1, 5}, {2, 6}, {3, 7},
+};
+
+ofxBvhRenderer::ofxBvhRenderer()
+{
+	mesh.setMode(OF_PRIMITIVE_TRIANGLES);
+	mesh.setUsage(GL_STREAM_DRAW);
+	begin(ofMatrix4x4());
+}
+
+void ofxBvhRenderer::begin(const ofMatrix4x4& camera_transform)
+{
+	// clear() keeps the vectors' capacity, so steady state doesn't allocate
+	mesh.clear();
+	const float* m = camera_transform.getPtr();
+	// normalized, as an inverted modelview can carry scale
+	right.set(m[0], m[1], m[2]);
+	right.normalize();
+	up.set(m[4], m[5], m[6]);
+	up.normalize();
+	eye.set(m[12], m[13], m[14]);
+	
+	// the marker outline only depends on the camera, so it's computed once per frame
+	const int n = max(style.marker_segments, 3);
+	marker_ring.resize(n);
+	for (int i = 0; i < n; i++)
+	{
+		const float a = TWO_PI * i / n;
+		marker_ring[i] = right * cosf(a) + up * sinf(a);
+	}
+}
+
+ofVec3f ofxBvhRenderer::transform(const ofMatrix4x4& m, const ofVec3f& p)
+{
+	const float* r = m.getPtr();
+	return ofVec3f(p.x * r[0] + p.y * r[4] + p.z * r[8] + r[12],
+				   p.x * r[1] + p.y * r[5] + p.z * r[9] + r[13],
+				   p.x * r[2] + p.y * r[6] + p.z * r[10] + r[14]);
+}
+
+// a quad along a-b, turned about that line to face the eye
+void ofxBvhRenderer::addRibbon(const ofVec3f& a, const ofVec3f& b, float width, const ofFloatColor& color)
+{
+	ofVec3f side = cross(b - a, (a + b) * 0.5f - eye);
+	const float length = side.length();
+	side = length > 1e-12f ? side * (width * 0.5f / length) : right * (width * 0.5f);
+	
+	vector<ofVec3f>& vertices = mesh.getVertices();
+	vector<ofFloatColor>& colors = mesh.getColors();
+	vector<ofIndexType>& indices = mesh.getIndices();
+	const unsigned base = vertices.size();
+	vertices.push_back(a - side);
+	vertices.push_back(a + side);
+	vertices.push_back(b + side);
+	vertices.push_back(b - side);
+	colors.insert(colors.end(), 4, color);
+	const unsigned quad[6] = { 0, 1, 2, 0, 2, 3 };
+	for (int i = 0; i < 6; i++)
+		indices.push_back(base + quad[i]);
+}
+
+void ofxBvhRenderer::addBox(const ofMatrix4x4& m, float size, const ofFloatColor& color)
+{
+	ofVec3f corners[8];
+	for (int i = 0; i < 8; i++)
+		corners[i] = transform(m, ofVec3f(box_corners[i][0], box_corners[i][1], box_corners[i][2]) * size);
+	for (int i = 0; i < 12; i++)
+		addRibbon(corners[box_edges[i][0]], corners[box_edges[i][1]], style.line_width, color);
+}
+
+void ofxBvhRenderer::addAxes(const ofMatrix4x4& m, float length)
+{
+	const ofVec3f o = transform(m, ofVec3f());
+	addRibbon(o, transform(m, ofVec3f(length, 0, 0)), style.line_width, ofFloatColor(1, 0, 0));
+	addRibbon(o, transform(m, ofVec3f(0, length, 0)), style.line_width, ofFloatColor(0, 1, 0));
+	addRibbon(o, transform(m, ofVec3f(0, 0, length)), style.line_width, ofFloatColor(0, 0, 1));
+}
+
+// a disc in the camera's image plane
+void ofxBvhRenderer::addMarker(const ofVec3f& center, float radius, const ofFloatColor& color)
+{
+	vector<ofVec3f>& vertices = mesh.getVertices();
+	vector<ofFloatColor>& colors = mesh.getColors();
+	vector<ofIndexType>& indices = mesh.getIndices();
+	const unsigned base = vertices.size();
+	const int n = marker_ring.size();
+	vertices.push_back(center);
+	for (int i = 0; i < n; i++)
+		vertices.push_back(center + marker_ring[i] * radius);
+	colors.insert(colors.end(), n + 1, color);
+	for (int i = 0; i < n; i++)
+	{
+		indices.push_back(base);
+		indices.push_back(base + 1 + i);
+		indices.push_back(base + 1 + (i + 1) % n);
+	}
+}
+
+void ofxBvhRenderer::add(const ofxBvh& bvh)
+{
+	for (int i = 0; i < bvh.getNumJoints(); i++)
+	{
+		const ofxBvhJoint* joint = bvh.getJoint(i);
+		const ofMatrix4x4& m = joint->getGlobalMatrix();
+		const ofVec3f o = transform(m, ofVec3f());
+		
+		const ofFloatColor* color = &style.joint_color;
+		if (joint->isSite())
+			color = &style.site_color;
+		else if (joint->getNumChildren() > 1)
+			color = joint->isRoot() ? &style.root_color : &style.branch_color;
+		addMarker(o, style.marker_radius, *color);
+		
+		for (int c = 0; c < joint->getNumChildren(); c++)
+			addRibbon(o, transform(m, joint->getChild(c)->getOffset()), style.bone_width, style.bone_color);
+	}
+}
+
+void ofxBvhRenderer::draw()
+{
+	mesh.draw();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "ofMain.h"
+
+class ofxBvh;
+
+// Builds skeleton geometry as triangles in one persistent ofVboMesh, drawn
+// in a single call: joint markers as discs in the image plane, and lines as
+// ribbons turned to face the camera. Billboards are worked out from the
+// camera transform, so there are no per-joint GL state reads, and
+// begin(camera_transform)/add() is plain CPU work that runs without a GL
+// context. Each frame, begin() with the camera, add() every skeleton, then draw().
+class ofxBvhRenderer
+{
+public:
+
+	struct Style
+	{
+		float box_size = 10;
+		float axis_length = 15;
+		// joints drawn small, e.g. hands and End Sites
+		float small_box_size = 1;
+		float small_axis_length = 1.5;
+		float line_width = 0.5; // world units, for box edges, axes and bones
+		float bone_width = 1;
+		float marker_radius = 2; // ofxBvh joints
+		int marker_segments = 12;
+		
+		ofFloatColor box_color = ofFloatColor(1, 1, 1);
+		ofFloatColor bone_color = ofFloatColor(0.5, 0.5, 0.5);
+		ofFloatColor site_color = ofFloatColor(1, 1, 0);
+		ofFloatColor joint_color = ofFloatColor(1, 1, 1);
+		ofFloatColor root_color = ofFloatColor(0, 1, 1);
+		ofFloatColor branch_color = ofFloatColor(0, 1, 0);
+	};
+	
+	ofxBvhRenderer();
+	
+	// takes effect from the next begin()
+	void setStyle(const Style& style) { this->style = style; }
+	const Style& getStyle() const { return style; }
+	
+	// Starts a frame. camera_transform is the camera's global transform,
+	// e.g. ofCamera::getGlobalTransformMatrix(), in the space the poses are in.
+	void begin(const ofMatrix4x4& camera_transform);
+	void begin(const ofCamera& camera) { begin(camera.getGlobalTransformMatrix()); }
+	// the same for whatever view is current, including pushed transforms:
+	// the modelview matrix is read once per frame
+	void begin() { begin(ofGetCurrentMatrix(OF_MATRIX_MODELVIEW).getInverse()); }
+	
+	// markers and bones, as ofxBvh::draw
+	void add(const ofxBvh& bvh);
+	
+	// uploads and draws the frame in one call; the mesh is kept until the next begin()
+	void draw();
+	
+	const ofVboMesh& getMesh() const { return mesh; }
+	size_t getNumTriangles() const { return mesh.getIndices().size() / 3; }
+
+protected:
+
+	Style style;
+	ofVboMesh mesh;
+	
+	ofVec3f eye, right, up;
+	vector<ofVec3f> marker_ring; // unit circle in the image plane
+	
+	static ofVec3f transform(const ofMatrix4x4& m, const ofVec3f& p);
+	void addRibbon(const ofVec3f& a, const ofVec3f& b, float width, const ofFloatColor& color);
+	void addBox(const ofMatrix4x4& m, float size, const ofFloatColor& color);
+	void addAxes(const ofMatrix4x4& m, float length);
+	void addMarker(const ofVec3f& center, float radius, const ofFloatColor& color);
+};
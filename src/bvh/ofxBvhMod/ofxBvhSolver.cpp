@@ -0,0 +1,291 @@
+#include "ofxBvhSolver.h"
+#include "ofxBvhKernels.h"
+
+static inline void setTranslation(float* m, const ofVec3f& t)
+{
+	m[12] = t.x;
+	m[13] = t.y;
+	m[14] = t.z;
+	m[15] = 1;
+}
+
+void ofxBvhSolver::setHierarchy(const ofxBvhHierarchyRef& hierarchy)
+{
+	clear();
+	this->hierarchy = hierarchy;
+	if (!hierarchy) return;
+	
+	const int n = hierarchy->getNumJoints();
+	for (int i = 0; i < 7; i++)
+		rot_scratch[i].assign(hierarchy->getNumRotations() + 1, i == 6 ? 1 : 0);
+	
+	offsets.resize(n);
+	matrices.resize(n);
+	global_matrices.resize(n);
+	for (int i = 0; i < n; i++)
+		offsets[i] = hierarchy->getInitialOffset(i);
+	
+	solved_frames.assign(n, frame);
+	chain.reserve(n);
+}
+
+void ofxBvhSolver::clear()
+{
+	hierarchy.reset();
+	
+	for (int i = 0; i < 7; i++)
+		rot_scratch[i].clear();
+	
+	batch_local.clear();
+	batch_global.clear();
+	
+	offsets.clear();
+	matrices.clear();
+	global_matrices.clear();
+	
+	channels.clear();
+	solved_frames.clear();
+	chain.clear();
+}
+
+void ofxBvhSolver::solve(const float* data, size_t size)
+{
+	if (!hierarchy || size < size_t(hierarchy->getNumChannels())) return;
+	const ofxBvhHierarchy& h = *hierarchy;
+	
+	if (lazy)
+	{
+		channels.assign(data, data + h.getNumChannels());
+		frame++;
+		return;
+	}
+	
+	// YXZ rotations of all joints are converted to quaternions in one batch
+	const int num_rot = h.getNumRotations();
+	float* ry = rot_scratch[0].data();
+	float* rx = rot_scratch[1].data();
+	float* rz = rot_scratch[2].data();
+	float* qx = rot_scratch[3].data();
+	float* qy = rot_scratch[4].data();
+	float* qz = rot_scratch[5].data();
+	float* qw = rot_scratch[6].data();
+	for (int k = 0; k < num_rot; k++)
+	{
+		const float* v = data + h.getRotationChannel(k);
+		ry[k] = v[0];
+		rx[k] = v[1];
+		rz[k] = v[2];
+	}
+	ofxBvhKernels::eulerYXZToQuat(ry, rx, rz, qx, qy, qz, qw, num_rot);
+	
+	solveJoints(data, NULL, h.getNumJoints());
+}
+
+// Solves count joints, parents first: joints order[0..count), or 0..count
+// if order is null. YXZ rotations are read as quaternions from rot_scratch.
+void ofxBvhSolver::solveJoints(const float* data, const int* order, int count) const
+{
+	const ofxBvhHierarchy& h = *hierarchy;
+	const float* qx = rot_scratch[3].data();
+	const float* qy = rot_scratch[4].data();
+	const float* qz = rot_scratch[5].data();
+	const float* qw = rot_scratch[6].data();
+	const int num_rot = h.getNumRotations();
+	
+	for (int c = 0; c < count; c++)
+	{
+		const int i = order ? order[c] : c;
+		const float* v = data + h.getChannelOffset(i);
+		float* m = matrices[i].getPtr();
+		ofVec3f& t = offsets[i];
+		
+		// joints without a YXZ rotation read the identity in the spare last slot
+		const int slot = h.getRotationSlot(i);
+		const int k = slot < 0 ? num_rot : slot;
+		
+		const ofxBvhHierarchy::PROGRAM program = h.getProgram(i);
+		switch (program)
+		{
+			case ofxBvhHierarchy::PROGRAM_POS_ROT_YXZ:
+			case ofxBvhHierarchy::PROGRAM_ROT_YXZ:
+			{
+				if (program == ofxBvhHierarchy::PROGRAM_POS_ROT_YXZ)
+				{
+					t.x = v[0];
+					t.y = v[1];
+					t.z = v[2];
+				}
+				else
+					t = ofVec3f();
+				ofxBvhKernels::quatToMatrix(m, qx[k], qy[k], qz[k], qw[k]);
+				break;
+			}
+				
+			case ofxBvhHierarchy::PROGRAM_NONE:
+				t = ofVec3f();
+				ofxBvhKernels::quatToMatrix(m, 0, 0, 0, 1);
+				break;
+				
+			default:
+			{
+				ofQuaternion rotate;
+				t = ofVec3f();
+				for (int ch = 0; ch < h.getNumJointChannels(i); ch++)
+				{
+					const ofxBvhHierarchy::CHANNEL type = h.getChannel(i, ch);
+					if (type >= ofxBvhHierarchy::X_POSITION)
+						t[type - ofxBvhHierarchy::X_POSITION] = v[ch];
+					else
+					{
+						ofVec3f axis;
+						axis[type - ofxBvhHierarchy::X_ROTATION] = 1;
+						rotate = ofQuaternion(v[ch], axis) * rotate;
+					}
+				}
+				ofxBvhKernels::quatToMatrix(m, rotate.x(), rotate.y(), rotate.z(), rotate.w());
+				break;
+			}
+		}
+		setTranslation(m, t);
+		
+		const int p = h.getParent(i);
+		if (p < 0)
+			global_matrices[i] = matrices[i];
+		else
+			ofxBvhKernels::composeAffine(global_matrices[i].getPtr(), m, global_matrices[p].getPtr());
+	}
+}
+
+void ofxBvhSolver::setLazy(bool lazy)
+{
+	if (!lazy)
+		resolveAll();
+	this->lazy = lazy;
+}
+
+// Walks up from joint i to the first ancestor that is current, then solves
+// the stale chain back down. Untouched branches stay stale.
+void ofxBvhSolver::resolveChain(int i) const
+{
+	const ofxBvhHierarchy& h = *hierarchy;
+	
+	chain.clear();
+	for (int j = i; j >= 0 && solved_frames[j] != frame; j = h.getParent(j))
+		chain.push_back(j);
+	
+	// parents first, each joint's rotation converted on its own
+	reverse(chain.begin(), chain.end());
+	const float* data = channels.data();
+	for (size_t c = 0; c < chain.size(); c++)
+	{
+		const int j = chain[c];
+		const int k = h.getRotationSlot(j);
+		if (k >= 0)
+		{
+			const float* r = data + h.getRotationChannel(k);
+			ofxBvhKernels::eulerYXZToQuat(r, r + 1, r + 2, &rot_scratch[3][k], &rot_scratch[4][k],
+										  &rot_scratch[5][k], &rot_scratch[6][k], 1);
+		}
+		solved_frames[j] = frame;
+	}
+	solveJoints(data, chain.data(), chain.size());
+}
+
+void ofxBvhSolver::resolveAll() const
+{
+	for (size_t i = 0; i < solved_frames.size(); i++)
+		resolve(i);
+}
+
+void ofxBvhSolver::solveBatchLanes(const float* const* data, int num, float* out, BATCH_LAYOUT layout,
+								   int first, int total)
+{
+	const ofxBvhHierarchy& h = *hierarchy;
+	const int nj = h.getNumJoints();
+	const size_t block = ofxBvhKernels::SOA_COMPONENTS * num;
+	
+	if (batch_local.size() < block) batch_local.resize(block);
+	if (batch_global.size() < nj * block) batch_global.resize(nj * block);
+	
+	float* dst[BATCH_LANES];
+	float* l = &batch_local[0];
+	
+	for (int i = 0; i < nj; i++)
+	{
+		float* g = &batch_global[i * block];
+		const int p = h.getParent(i);
+		const float* pg = p < 0 ? NULL : &batch_global[p * block];
+		
+		const ofxBvhHierarchy::PROGRAM program = h.getProgram(i);
+		switch (program)
+		{
+			case ofxBvhHierarchy::PROGRAM_POS_ROT_YXZ:
+			case ofxBvhHierarchy::PROGRAM_ROT_YXZ:
+			{
+				const int c = h.getRotationChannel(h.getRotationSlot(i));
+				ofxBvhKernels::solveJointYXZSoA(data, c, program == ofxBvhHierarchy::PROGRAM_POS_ROT_YXZ ? c - 3 : -1,
+												pg, l, g, num, num);
+				break;
+			}
+				
+			case ofxBvhHierarchy::PROGRAM_NONE:
+			{
+				for (int e = 0; e < ofxBvhKernels::SOA_COMPONENTS; e++)
+					fill(l + e * num, l + (e + 1) * num, (e == 0 || e == 4 || e == 8) ? 1.f : 0.f);
+				if (pg)
+					copy(pg, pg + block, g);
+				else
+					copy(l, l + block, g);
+				break;
+			}
+				
+			default:
+			{
+				for (int a = 0; a < num; a++)
+				{
+					const float* v = data[a] + h.getChannelOffset(i);
+					ofQuaternion rotate;
+					ofVec3f translate;
+					for (int ch = 0; ch < h.getNumJointChannels(i); ch++)
+					{
+						const ofxBvhHierarchy::CHANNEL type = h.getChannel(i, ch);
+						if (type >= ofxBvhHierarchy::X_POSITION)
+							translate[type - ofxBvhHierarchy::X_POSITION] = v[ch];
+						else
+						{
+							ofVec3f axis;
+							axis[type - ofxBvhHierarchy::X_ROTATION] = 1;
+							rotate = ofQuaternion(v[ch], axis) * rotate;
+						}
+					}
+					float m[12];
+					ofxBvhKernels::quatToMatrix(m, rotate.x(), rotate.y(), rotate.z(), rotate.w());
+					for (int e = 0; e < 9; e++)
+						l[e * num + a] = m[(e / 3) * 4 + e % 3];
+					for (int e = 0; e < 3; e++)
+						l[(9 + e) * num + a] = translate[e];
+				}
+				if (pg)
+					ofxBvhKernels::composeAffineSoA(g, l, pg, num, num);
+				else
+					copy(l, l + block, g);
+				break;
+			}
+		}
+		
+		// emit this joint while it is still in cache
+		for (int a = 0; a < num; a++)
+		{
+			const size_t index = layout == BATCH_AVATAR_MAJOR ? (first + a) * nj + i : i * total + first + a;
+			dst[a] = out + index * 16;
+		}
+		ofxBvhKernels::storeSoA(dst, g, num, num);
+	}
+}
+
+void ofxBvhSolver::solveBatch(const float* const* data, int num, float* out, BATCH_LAYOUT layout)
+{
+	if (!hierarchy) return;
+	for (int first = 0; first < num; first += BATCH_LANES)
+		solveBatchLanes(data + first, min<int>(BATCH_LANES, num - first), out, layout, first, num);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxBvhHierarchy.h"
+
+// Flattened forward kinematics for a BVH hierarchy.
+// Joints are stored as parallel arrays in parent-before-child order, each
+// with a channel program precompiled by ofxBvhHierarchy, so a whole pose is
+// solved in one linear pass without recursion or per-channel branching on
+// the common layouts. The hierarchy is shared; a solver only owns its pose.
+class ofxBvhSolver
+{
+	friend class ofxBvh;
+	
+public:
+	
+	enum BATCH_LAYOUT
+	{
+		BATCH_AVATAR_MAJOR, // out[(avatar * num_joints + joint) * 16]
+		BATCH_JOINT_MAJOR   // out[(joint * num_avatars + avatar) * 16]
+	};
+	
+	ofxBvhSolver() {}
+	explicit ofxBvhSolver(const ofxBvhHierarchyRef& hierarchy) { setHierarchy(hierarchy); }
+	
+	// shares the hierarchy and resets the pose to its initial offsets
+	void setHierarchy(const ofxBvhHierarchyRef& hierarchy);
+	const ofxBvhHierarchyRef& getHierarchy() const { return hierarchy; }
+	void clear();
+	
+	// solves all local and global transforms. data must hold getNumChannels() values.
+	void solve(const float* data, size_t size);
+	
+	// Solves num poses sharing this hierarchy in one sweep, joint by joint with
+	// avatars in SIMD lanes. data[a] must hold getNumChannels() values each.
+	// Global matrices are written to out as oF 4x4 matrices in the given layout.
+	// Local matrices are not kept, which is why DataReader doesn't use this:
+	// its skeletons expose both, so it still solves each avatar on its own.
+	void solveBatch(const float* const* data, int num, float* out, BATCH_LAYOUT layout);
+	
+	inline int getNumJoints() const { return offsets.size(); }
+	inline int getNumChannels() const { return hierarchy ? hierarchy->getNumChannels() : 0; }
+	
+	// Lazy mode: solve() only stores the channels, and a joint is solved, with
+	// any stale ancestors, the first time one of its transforms is read, then
+	// cached until the next solve(). Reads then write to the cache, so a lazy
+	// solver must not be read from several threads at once.
+	void setLazy(bool lazy);
+	bool isLazy() const { return lazy; }
+	
+	inline const ofVec3f& getOffset(int i) const { resolve(i); return offsets[i]; }
+	inline const ofMatrix4x4& getMatrix(int i) const { resolve(i); return matrices[i]; }
+	inline const ofMatrix4x4& getGlobalMatrix(int i) const { resolve(i); return global_matrices[i]; }
+	
+protected:
+	
+	ofxBvhHierarchyRef hierarchy;
+	
+	// batched YXZ rotations, one entry per hierarchy rotation slot plus an
+	// identity at the end: y, x, z, qx, qy, qz, qw
+	mutable vector<float> rot_scratch[7];
+	
+	// Batches are solved BATCH_LANES poses at a time so the SoA scratch (see
+	// ofxBvhKernels) stays in cache: one joint's local transforms, and the
+	// global transforms of every joint for parent lookups.
+	enum { BATCH_LANES = 16 };
+	void solveBatchLanes(const float* const* data, int num, float* out, BATCH_LAYOUT layout,
+						 int first, int total);
+	vector<float> batch_local;
+	vector<float> batch_global;
+	
+	void solveJoints(const float* data, const int* order, int count) const;
+	
+	// lazy mode: channels of the last solve(), numbered by solve() calls, and
+	// the frame each joint was last solved for
+	bool lazy = false;
+	uint32_t frame = 0;
+	vector<float> channels;
+	mutable vector<uint32_t> solved_frames;
+	mutable vector<int> chain;
+	
+	inline void resolve(int i) const { if (lazy && solved_frames[i] != frame) resolveChain(i); }
+	void resolveChain(int i) const;
+	void resolveAll() const;
+	
+	// pose, written by lazy reads too
+	mutable vector<ofVec3f> offsets;
+	mutable vector<ofMatrix4x4> matrices;
+	mutable vector<ofMatrix4x4> global_matrices;
+};
@@ -3,73 +3,287 @@
 //
 #include "ofxPerceptionNeuron.h"
 
-#define __OS_XUN__
-#define NEURONDATAREADER_EXPORTS
-
-#include "NeuronDataReader.h"
-#include "ofxBvhMod.h"
-#include "BvhTemplate.h"
+#include "StreamClient.h"
+#include "TripleBuffer.h"
+#include "NeuronSkeleton.h"
+#include "HistoryRing.h"
+#include "LatencyHistogram.h"
+#include "SkeletonRenderer.h"
+#include "ofxBvhKernels.h"
 
 namespace ofxPerceptionNeuron
 {
     struct BvhData
     {
-        int avater_index = 0;
-        string avater_name;
+        uint32_t avater_index = 0;
+        uint32_t frame_index = 0;
+        uint64_t timestamp = 0; // DataReader::now() at receive
+        uint64_t sequence = 0; // receive count for this avatar
+        uint8_t avater_name[32];
         bool with_disp = false;
         bool with_ref = false;
         vector<float> raw_data;
     };
     
+    struct CalcData
+    {
+        CalcFrame frame;
+        uint8_t avater_name[32];
+    };
+    
+    // defined for uses that bind them to a reference, e.g. std::min
+    const int CalcFrame::MAX_JOINTS;
+    const int CalcFrame::VALUES_PER_JOINT;
+    
+    void CalcFrame::set(const float* data, int n)
+    {
+        num_joints = n;
+        for (int k=0; k<n; ++k) {
+            const float* v = data + k * VALUES_PER_JOINT;
+            position[k].set(v[0], v[1], v[2]);
+            velocity[k].set(v[3], v[4], v[5]);
+            quaternion[k].set(v[7], v[8], v[9], v[6]);
+            acceleration[k].set(v[10], v[11], v[12]);
+            gyro[k].set(v[13], v[14], v[15]);
+        }
+    }
+
 #pragma mark - DataReader::Impl
     class DataReader::Impl
     {
     public:
-        SOCKET_REF sock = nullptr;
+        // AvatarIndex values at or above this are dropped
+        static const size_t MAX_AVATARS = 128;
+        // one slot per source and AvatarIndex
+        static const size_t MAX_SLOTS = StreamClient::MAX_SOURCES * MAX_AVATARS;
+        static const size_t DEFAULT_HISTORY_LENGTH = 128;
+        // a FrameIndex this far behind the last one means the server restarted
+        static const int32_t RESTART_FRAMES = 256;
+        static const uint64_t DEFAULT_MAX_PREDICTION = 50000000; // 50ms
         
-        FrameDataReceived f;
-        SocketStatusChanged s;
+        StreamClient client;
+        Recorder recorder;
+        SkeletonRenderer renderer; // main thread
         
-        std::mutex data_lock;
+        // Per-avatar pipeline counters. Each half has a single writer thread;
+        // anyone may read them via getLatencyStats().
+        struct AvatarStats
+        {
+            // receive thread
+            std::atomic<uint64_t> num_received;
+            std::atomic<uint64_t> num_missing;
+            std::atomic<uint64_t> num_out_of_order;
+            std::atomic<uint64_t> num_discarded;
+            std::atomic<uint64_t> num_unsupported;
+            ConcurrentLatencyHistogram arrival_interval;
+            ConcurrentLatencyHistogram frame_gap;
+            uint64_t last_timestamp = 0;
+            uint32_t last_frame_index = 0;
+            
+            // update() thread
+            std::atomic<uint64_t> num_consumed;
+            std::atomic<uint64_t> num_overwritten;
+            ConcurrentLatencyHistogram receive_to_update;
+            ConcurrentLatencyHistogram solve;
+            uint64_t last_sequence = 0;
+            
+            AvatarStats() : num_received(0), num_missing(0), num_out_of_order(0), num_discarded(0), num_unsupported(0), num_consumed(0), num_overwritten(0) {}
+            
+            static void increment(std::atomic<uint64_t>& a, uint64_t v = 1) {
+                a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+            }
+            
+            // receive thread: true if frame_index is not newer than the last
+            // frame's, short of a restart
+            bool isStale(uint32_t frame_index) const {
+                const int32_t step = int32_t(frame_index - last_frame_index);
+                return num_received.load(std::memory_order_relaxed) > 0 && step <= 0 && step > -RESTART_FRAMES;
+            }
+            
+            void frameDiscarded() {
+                increment(num_out_of_order);
+                increment(num_discarded);
+            }
+            
+            void frameUnsupported() {
+                increment(num_unsupported);
+            }
+            
+            // receive thread: returns the frame's sequence number
+            uint64_t frameReceived(uint64_t now, uint32_t frame_index) {
+                const uint64_t n = num_received.load(std::memory_order_relaxed);
+                if (n > 0) {
+                    arrival_interval.record(now - last_timestamp);
+                    const int32_t step = int32_t(frame_index - last_frame_index);
+                    if (step > 0) {
+                        frame_gap.record(step);
+                        increment(num_missing, step - 1);
+                    } else {
+                        increment(num_out_of_order);
+                    }
+                }
+                last_timestamp = now;
+                last_frame_index = frame_index;
+                num_received.store(n + 1, std::memory_order_relaxed);
+                return n + 1;
+            }
+            
+            // update() thread
+            void frameConsumed(uint64_t now, const BvhData& b) {
+                receive_to_update.record(now - b.timestamp);
+                if (b.sequence > last_sequence + 1) {
+                    increment(num_overwritten, b.sequence - last_sequence - 1);
+                }
+                last_sequence = b.sequence;
+                increment(num_consumed);
+            }
+            
+            void get(LatencyStats& out) const {
+                out.frames_received = num_received.load(std::memory_order_relaxed);
+                out.frames_missing = num_missing.load(std::memory_order_relaxed);
+                out.frames_out_of_order = num_out_of_order.load(std::memory_order_relaxed);
+                out.frames_discarded = num_discarded.load(std::memory_order_relaxed);
+                out.frames_unsupported = num_unsupported.load(std::memory_order_relaxed);
+                out.frames_consumed = num_consumed.load(std::memory_order_relaxed);
+                out.frames_overwritten = num_overwritten.load(std::memory_order_relaxed);
+                arrival_interval.snapshot(out.arrival_interval);
+                frame_gap.snapshot(out.frame_gap);
+                receive_to_update.snapshot(out.receive_to_update);
+                solve.snapshot(out.solve);
+            }
+        };
         
         struct SwappableBvhData
         {
-            BvhData back;
-            BvhData front;
-            void swap() {
-                std::swap(back, front);
+            TripleBuffer<BvhData> frames;
+            HistoryRing history; // written by the receive thread only
+            unique_ptr<AvatarStats> stats; // created at first sight
+            // created by the receive thread with the first calculation frame
+            unique_ptr<TripleBuffer<CalcData>> calc_storage;
+            std::atomic<TripleBuffer<CalcData>*> calc;
+            const CalcFrame* calc_front = nullptr; // main thread
+            unique_ptr<NeuronSkeleton::Pose> pose;
+            string name;
+            uint64_t generation = 0;
+            uint64_t last_sampled = 0;
+            int64_t sample_offset = 0; // see DataReader::getSampleOffset
+            bool seen = false; // receive thread only
+            bool warned_layout = false; // main thread
+            int source = 0;
+            uint32_t avatar_index = 0;
+            
+            const BvhData& front() const {
+                return frames.front();
             }
-            bool newdata = false;
-            shared_ptr<ofxBvh> bvh;
             
-            SwappableBvhData() {
-                bvh = make_shared<ofxBvh>(bvh_header_template);
+            // receive thread, first sight only: size every slot so later frames copy in place
+            void allocate(size_t data_count, size_t history_length) {
+                for (int i=0; i<3; ++i) {
+                    // frames without displacement are expanded to the full layout
+                    frames.slot(i).raw_data.reserve(std::max<size_t>(data_count, NeuronSkeleton::NUM_CHANNELS));
+                }
+                if (history_length > 0) {
+                    history.allocate(history_length, NeuronSkeleton::NUM_CHANNELS);
+                }
+                stats.reset(new AvatarStats());
+            }
+            
+            SwappableBvhData() : calc(nullptr) {}
+            
+            // consumer side: picks up the newest calculation frame, if any
+            bool updateCalc() {
+                TripleBuffer<CalcData>* c = calc.load(std::memory_order_acquire);
+                if (!c || !c->update()) {
+                    return false;
+                }
+                calc_front = &c->front().frame;
+                if (!pose) {
+                    // calculation only: skeletons still need a pose to view, so show the rest pose
+                    pose.reset(new NeuronSkeleton::Pose());
+                    pose->setRest();
+                }
+                updateName(c->front().avater_name);
+                return true;
             }
             
-            void update() {
-                bvh->update(front.raw_data);
+            void updateName(const uint8_t* avater_name) {
+                if (strncmp(name.c_str(), (const char*)avater_name, 32) != 0) {
+                    name.assign((const char*)avater_name, strnlen((const char*)avater_name, 32));
+                }
+            }
+            
+            // consumer side: returns true if a new frame was picked up, and
+            // solves it unless the pose is sampled from history instead
+            bool update(bool solve) {
+                if (!frames.update()) {
+                    return false;
+                }
+                const BvhData& b = frames.front();
+                stats->frameConsumed(DataReader::now(), b);
+                if (b.raw_data.size() < NeuronSkeleton::NUM_CHANNELS) {
+                    if (!warned_layout) {
+                        ofLogWarning("ofxPerceptionNeuron") << "avatar " << b.avater_index << ": can't pose frames of "
+                            << b.raw_data.size() << " channels, see LatencyStats::frames_unsupported";
+                        warned_layout = true;
+                    }
+                    return false;
+                }
+                if (!pose) {
+                    pose.reset(new NeuronSkeleton::Pose());
+                }
+                updateName(b.avater_name);
+                if (solve) {
+                    const uint64_t t0 = DataReader::now();
+                    pose->solve(b.raw_data.data());
+                    stats->solve.record(DataReader::now() - t0);
+                    ++generation;
+                }
+                return true;
             }
             
-            void draw() {
-                bvh->draw();
+            // consumer side, sampled output: solves the pose at time t from history
+            bool sample(uint64_t t, uint64_t max_prediction) {
+                if (!pose) {
+                    return false;
+                }
+                const uint64_t t0 = DataReader::now();
+                uint64_t sampled, newest;
+                if (!sampleAt(*this, t, max_prediction, *pose, &sampled, &newest)) {
+                    return false;
+                }
+                stats->solve.record(DataReader::now() - t0);
+                sample_offset = int64_t(sampled - newest);
+                if (sampled != last_sampled) {
+                    last_sampled = sampled;
+                    ++generation;
+                }
+                return true;
             }
         };
         
-        map<uint32_t, SwappableBvhData> data;
+        // slot table indexed by AvatarIndex. Slots are only activated by the
+        // receive thread; the main thread walks them in order of first sight.
+        unique_ptr<SwappableBvhData[]> slots;
+        uint32_t active_indices[MAX_SLOTS];
+        std::atomic<size_t> num_active;
+        std::atomic<uint64_t> num_dropped;
+        std::atomic<size_t> history_length; // read by the receive thread at first sight
+        
+        // main thread, OUTPUT_SAMPLED
+        OutputMode output_mode = OUTPUT_NEWEST;
+        int64_t sample_delay = 0;
+        uint64_t max_prediction = DEFAULT_MAX_PREDICTION;
+        
+        // main thread
+        vector<SwappableBvhData*> avatars;
         bool newframe = false;
         uint64_t lastframe = 0;
     public:
-        Impl()
+        Impl() : slots(new SwappableBvhData[MAX_SLOTS]), num_active(0), num_dropped(0), history_length(DEFAULT_HISTORY_LENGTH)
         {
-            f = FrameDataReceived(frameDataReceived);
-            if (f) {
-                BRRegisterFrameDataCallback(this, f);
-            }
-
-            s = SocketStatusChanged(socketStatusChanged);
-            if (s) {
-                BRRegisterSocketStatusCallback(this, s);
-            }
+            client.setBvhFrameHandler(frameDataReceived, this);
+            client.setCalcFrameHandler(calcDataReceived, this);
+            client.setStatusHandler(socketStatusChanged, this);
         }
         
         ~Impl()
@@ -77,83 +291,294 @@ namespace ofxPerceptionNeuron
             disconnect();
         }
         
-        static void frameDataReceived(void * customObject, SOCKET_REF sockRef, BvhDataHeader * header, float * data)
+        // receive thread. Steady state does no allocation: the slot is found by
+        // index and the payload is copied into storage reserved at first sight.
+        static void frameDataReceived(void * customObject, int source, uint64_t now, const BvhDataHeader * header, const float * data)
         {
             Impl* self = reinterpret_cast<Impl*>(customObject);
             
-            self->data_lock.lock();
-            SwappableBvhData& d = self->data[header->AvatarIndex];
-            BvhData& b = d.back;
-            b.avater_index = header->AvatarIndex;
-            b.avater_name = (string)((const char*)header->AvatarName);
+            const uint32_t index = header->AvatarIndex;
+            if (index >= MAX_AVATARS) {
+                self->num_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            const uint32_t slot = source * MAX_AVATARS + index;
+            
+            SwappableBvhData& d = self->slots[slot];
+            BvhData& b = d.frames.back();
+            const bool first_sight = self->activate(d, source, index, header->DataCount);
+            // datagrams can arrive late or reordered; never step a UDP avatar backwards
+            if (self->client.isUdp(source) && d.stats->isStale(header->FrameIndex)) {
+                d.stats->frameDiscarded();
+                return;
+            }
+            
+            // recorded with the arrival time, after stale datagrams are filtered out
+            if (self->recorder.isRecording()) {
+                if (source == 0) {
+                    self->recorder.push(header, data, now);
+                } else {
+                    // keep avatars of different servers in different files
+                    BvhDataHeader h = *header;
+                    h.AvatarIndex = slot;
+                    self->recorder.push(&h, data, now);
+                }
+            }
+            
+            b.avater_index = index;
+            b.frame_index = header->FrameIndex;
+            b.timestamp = now;
+            b.sequence = d.stats->frameReceived(now, header->FrameIndex);
+            memcpy(b.avater_name, header->AvatarName, sizeof(b.avater_name));
             b.with_disp = header->WithDisp;
             b.with_ref = header->WithReference;
-            d.newdata = true;
-            b.raw_data.clear();
-            b.raw_data.insert(b.raw_data.end(), data, data + header->DataCount);
-            self->data_lock.unlock();
+            if (!header->WithDisp && header->DataCount == NeuronSkeleton::NUM_CHANNELS_NO_DISP) {
+                b.raw_data.resize(NeuronSkeleton::NUM_CHANNELS);
+                NeuronSkeleton::expandChannels(data, b.raw_data.data());
+            } else {
+                b.raw_data.assign(data, data + header->DataCount);
+                if (header->DataCount < NeuronSkeleton::NUM_CHANNELS) {
+                    d.stats->frameUnsupported();
+                }
+            }
+            if (d.history.isAllocated() && b.raw_data.size() >= NeuronSkeleton::NUM_CHANNELS) {
+                d.history.push(now, header->FrameIndex, b.raw_data.data(), NeuronSkeleton::NUM_CHANNELS);
+            }
+            d.frames.publish();
+            
+            if (first_sight) {
+                self->publishActive(slot);
+            }
         }
         
-        static void socketStatusChanged(void * customObject, SOCKET_REF sockeRef, SocketStatus status, char * message)
+        // receive thread: transposes the packet into the back buffer's arrays
+        static void calcDataReceived(void * customObject, int source, uint64_t now, const CalcDataHeader * header, const float * data)
         {
-            ofLogVerbose("ofxPerceptionNeuron") << message << endl;
+            Impl* self = reinterpret_cast<Impl*>(customObject);
+            const uint32_t index = header->AvatarIndex;
+            if (index >= MAX_AVATARS) {
+                self->num_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            const uint32_t slot = source * MAX_AVATARS + index;
+            SwappableBvhData& d = self->slots[slot];
+            const bool first_sight = self->activate(d, source, index, NeuronSkeleton::NUM_CHANNELS);
+            
+            if (!d.calc_storage) {
+                d.calc_storage.reset(new TripleBuffer<CalcData>());
+                d.calc.store(d.calc_storage.get(), std::memory_order_release);
+            }
+            CalcData& c = d.calc_storage->back();
+            c.frame.frame_index = header->FrameIndex;
+            c.frame.timestamp = now;
+            memcpy(c.avater_name, header->AvatarName, sizeof(c.avater_name));
+            c.frame.set(data, std::min<int>(header->DataCount / CalcFrame::VALUES_PER_JOINT, CalcFrame::MAX_JOINTS));
+            d.calc_storage->publish();
+            
+            if (first_sight) {
+                self->publishActive(slot);
+            }
         }
-
         
-        void connect(string ip, int port)
+        // receive thread: sets a slot up the first time either stream uses it
+        bool activate(SwappableBvhData& d, int source, uint32_t index, size_t data_count)
         {
-            if (sock == nullptr) {
-                sock = BRConnectTo(const_cast<char*>(ip.c_str()), port);
+            if (d.seen) {
+                return false;
             }
+            d.allocate(data_count, history_length.load(std::memory_order_relaxed));
+            d.source = source;
+            d.avatar_index = index;
+            d.seen = true;
+            return true;
+        }
+        
+        // receive thread: makes an activated slot visible to update(), once its first frame is published
+        void publishActive(uint32_t slot)
+        {
+            size_t n = num_active.load(std::memory_order_relaxed);
+            active_indices[n] = slot;
+            num_active.store(n + 1, std::memory_order_release);
+        }
+        
+        static void socketStatusChanged(void *, int source, SocketStatus status, const char * message)
+        {
+            static const char * names[] = { "running", "starting", "off work" };
+            const char * name = status >= CS_Running && status <= CS_OffWork ? names[status] : "unknown";
+            ofLogVerbose("ofxPerceptionNeuron") << "source " << source << " " << name << ": " << message << endl;
+        }
+        
+        
+        int connect(string ip, int port)
+        {
+            return client.connect(ip, port);
+        }
+        
+        int listenUdp(int port, string ip)
+        {
+            return client.listenUdp(port, ip);
         }
         
         bool isConnected() const {
-            if (sock == nullptr) {
-                return false;
-            }
-            SocketStatus ss = BRGetSocketStatus(sock);
-            return ss == CS_Running;
+            return client.getStatus() == CS_Running;
         }
         
         void disconnect()
         {
-            if (sock != nullptr) {
-                BRCloseSocket(sock);
-                sock = nullptr;
-            }
+            client.close();
         }
         
-        void update()
+        void update(uint64_t presentation_time)
         {
             uint64_t frame = ofGetFrameNum();
             if (frame != lastframe) {
                 newframe = false;
                 lastframe = frame;
             }
-            data_lock.lock();
-            for (auto& p : data) {
-                if (p.second.newdata) {
-                    p.second.swap();
-                    p.second.update();
-                    p.second.newdata = false;
+            const size_t n = num_active.load(std::memory_order_acquire);
+            while (avatars.size() < n) {
+                avatars.push_back(&slots[active_indices[avatars.size()]]);
+            }
+            const bool sampled = output_mode == OUTPUT_SAMPLED && history_length.load(std::memory_order_relaxed) > 0;
+            const uint64_t t = presentation_time - sample_delay;
+            for (auto* d : avatars) {
+                if (d->update(!sampled)) {
                     newframe = true;
                 }
+                d->updateCalc();
+                if (sampled) {
+                    d->sample(t, max_prediction);
+                }
             }
-            data_lock.unlock();
         }
         
-        void draw()
+        bool isFrameNew() const {
+            return newframe;
+        }
+        
+        // any thread: the pose at time t, interpolated between the two frames
+        // around it. Past the newest frame it is extrapolated from the last
+        // two at their angular and linear velocity, for up to max_prediction
+        // ns, then held. sampled receives the time the pose stands for and
+        // newest the newest frame's.
+        static bool sampleAt(const SwappableBvhData& d, uint64_t t, uint64_t max_prediction, NeuronSkeleton::Pose& pose,
+                             uint64_t* sampled = nullptr, uint64_t* newest = nullptr)
         {
-            for (auto& p : data) {
-                p.second.draw();
+            const HistoryRing& h = d.history;
+            float a[NeuronSkeleton::NUM_CHANNELS], b[NeuronSkeleton::NUM_CHANNELS];
+            uint64_t i, ta, tb;
+            uint32_t fa, fb;
+            if (!h.findAtOrBefore(t, i)) {
+                return false;
+            }
+            const uint64_t last = h.getEnd() - 1;
+            if (i == last) {
+                if (!h.read(i, tb, fb, b)) {
+                    return false;
+                }
+                if (newest) {
+                    *newest = tb;
+                }
+                t = std::min(t, tb + max_prediction);
+                if (t == tb || i == h.getBegin() || !h.read(i - 1, ta, fa, a) || tb <= ta) {
+                    if (sampled) {
+                        *sampled = tb;
+                    }
+                    pose.solve(b);
+                    return true;
+                }
+            } else {
+                if (!h.read(i, ta, fa, a) || !h.read(i + 1, tb, fb, b)) {
+                    return false;
+                }
+                if (newest && !h.read(last, *newest, fb, nullptr)) {
+                    *newest = tb;
+                }
+                if (t == ta || tb <= ta) {
+                    if (sampled) {
+                        *sampled = ta;
+                    }
+                    pose.solve(a);
+                    return true;
+                }
+            }
+            if (sampled) {
+                *sampled = t;
+            }
+            
+            // alpha > 1 when predicting: slerp's weights extrapolate along the same great circle
+            const float alpha = double(int64_t(t - ta)) / double(tb - ta);
+            for (int k=0; k<NeuronSkeleton::NUM_ROTATIONS; ++k) {
+                float* pa = a + k * NeuronSkeleton::CHANNELS_PER_JOINT;
+                const float* pb = b + k * NeuronSkeleton::CHANNELS_PER_JOINT;
+                for (int c=0; c<3; ++c) {
+                    pa[c] += (pb[c] - pa[c]) * alpha;
+                }
             }
+            NeuronSkeleton::Rotations ra, rb, r;
+            ra.set(a);
+            rb.set(b);
+            r.slerp(ra, rb, alpha);
+            pose.solve(a, r);
+            return true;
         }
         
-        bool isFrameNew() const {
-            return newframe;
+        // any thread: global transforms of one joint over the newest window
+        // ns of history, oldest first. Only the joint's chain to the root is solved.
+        static size_t getHistory(const SwappableBvhData& d, int joint, uint64_t window, vector<JointSample>& samples)
+        {
+            samples.clear();
+            const HistoryRing& h = d.history;
+            
+            int chain[NeuronSkeleton::NUM_JOINTS];
+            int chain_length = 0;
+            for (int j=joint; j>=0; j=NeuronSkeleton::parents[j]) {
+                chain[chain_length++] = j;
+            }
+            
+            float data[NeuronSkeleton::NUM_CHANNELS];
+            uint64_t newest = 0;
+            for (uint64_t i=h.getEnd(); i-- > h.getBegin(); ) {
+                JointSample s;
+                if (!h.read(i, s.timestamp, s.frame_index, data)) {
+                    break;
+                }
+                if (samples.empty()) {
+                    newest = s.timestamp;
+                } else if (newest - s.timestamp > window) {
+                    break;
+                }
+                
+                ofMatrix4x4& g = s.global_transform;
+                for (int c=chain_length; c-- > 0; ) {
+                    const int j = chain[c];
+                    const int channel = NeuronSkeleton::channel_offsets[j];
+                    if (channel < 0) {
+                        continue; // End Site: identity local transform
+                    }
+                    const float* v = data + channel;
+                    float qx, qy, qz, qw;
+                    ofxBvhKernels::eulerYXZToQuat(v + 3, v + 4, v + 5, &qx, &qy, &qz, &qw, 1);
+                    ofMatrix4x4 local;
+                    float* m = local.getPtr();
+                    ofxBvhKernels::quatToMatrix(m, qx, qy, qz, qw);
+                    m[12] = v[0];
+                    m[13] = v[1];
+                    m[14] = v[2];
+                    m[15] = 1;
+                    if (c == chain_length - 1) {
+                        g = local;
+                    } else {
+                        ofxBvhKernels::composeAffine(g.getPtr(), local.getPtr(), ofMatrix4x4(g).getPtr());
+                    }
+                }
+                samples.push_back(s);
+            }
+            reverse(samples.begin(), samples.end());
+            return samples.size();
         }
     };
-    
+
 #pragma mark - Skeleton
     void Skeleton::debugDraw() const
     {
@@ -161,18 +586,19 @@ namespace ofxPerceptionNeuron
         ofPushStyle();
         ofNoFill();
         for (auto & p : joints) {
+            const string& name = getJointName(p);
             ofPushMatrix();
-            ofMultMatrix(p.global_transform);
-            if (p.name.find("Hand") == string::npos &&
-                p.name.find("Site") == string::npos) {
+            ofMultMatrix(p.getGlobalTransform());
+            if (name.find("Hand") == string::npos &&
+                name.find("Site") == string::npos) {
                 ofDrawBox(10);
                 ofDrawAxis(15);
             } else {
                 ofDrawBox(1);
                 ofDrawAxis(1.5);
             }
-            for (auto & q : p.children) {
-                ofVec3f& v = q->offset;
+            for (int i=0; i<getNumChildren(p); ++i) {
+                const ofVec3f& v = getChild(p, i).getOffset();
                 ofDrawLine(vn, v);
             }
             ofPopMatrix();
@@ -180,16 +606,31 @@ namespace ofxPerceptionNeuron
         }
         ofPopStyle();
     }
-    
+
 #pragma mark - DataReader
     DataReader::DataReader()
     {
         impl = make_shared<Impl>();
     }
     
-    void DataReader::connect(string ip, int port)
+    int DataReader::connect(string ip, int port)
+    {
+        return impl->connect(ip, port);
+    }
+    
+    int DataReader::listenUdp(int port, string ip)
+    {
+        return impl->listenUdp(port, ip);
+    }
+    
+    int DataReader::getNumSources() const
+    {
+        return impl->client.getNumSources();
+    }
+    
+    SourceStatus DataReader::getSourceStatus(int source) const
     {
-        impl->connect(ip, port);
+        return impl->client.getSourceStatus(source);
     }
     
     bool DataReader::isConnected() const
@@ -204,50 +645,82 @@ namespace ofxPerceptionNeuron
     
     void DataReader::update()
     {
-        impl->update();
+        update(now());
+    }
+    
+    void DataReader::update(uint64_t presentation_time)
+    {
+        impl->update(presentation_time);
         
-        // copy
-        if (skeletons.size() != impl->data.size()) {
-            skeletons.resize(impl->data.size());
+        // skeletons are views, so only new avatars and renames need work here
+        if (skeletons.size() != impl->avatars.size()) {
+            skeletons.resize(impl->avatars.size());
         }
+        bool renamed = false;
         for (int i=0; i<skeletons.size(); ++i) {
-            auto & bvh = impl->data[i].bvh;
+            const auto* d = impl->avatars[i];
+            const NeuronSkeleton::Pose* pose = d->pose.get();
+            if (!pose) {
+                continue;
+            }
             auto & s = skeletons[i];
-            skeletons_map[impl->data[i].front.avater_name] = &s;
-            if (s.joints.size() != bvh->getNumJoints()) {
-                s.name = impl->data[i].front.avater_name;
-                s.joints.resize(bvh->getNumJoints());
+            if (!s.hierarchy) {
+                s.hierarchy = NeuronSkeleton::getHierarchy();
+                s.generation = &d->generation;
+                s.joints.resize(NeuronSkeleton::NUM_JOINTS);
                 for (int j=0; j<s.joints.size(); ++j) {
-                    auto* bvhj = bvh->getJoint(j);
                     auto& sj = s.joints[j];
-                    sj.name = bvhj->getName();
-                    s.joints_map[bvhj->getName()] = &sj;
-
-                }
-                for (int j=0; j<s.joints.size(); ++j) {
-                    auto* bvhj = bvh->getJoint(j);
-                    auto& sj = s.joints[j];
-                    if (bvhj->getParent()) {
-                        string pname = bvhj->getParent()->getName();
-                        sj.parent = s.joints_map[pname];
-                    }
-                    sj.children.clear();
-                    for (auto& c : bvhj->getChildren()) {
-                        if (c) {
-                            string cname = c->getName();
-                            if (s.joints_map.find(cname) != s.joints_map.end()) {
-                                sj.children.push_back(s.joints_map[cname]);
-                            }
-                        }
-                    }
+                    sj.index = j;
+                    sj.offset = &pose->offsets[j];
+                    sj.transform = &pose->matrices[j];
+                    sj.global_transform = &pose->global_matrices[j];
                 }
+                s.name = d->name;
+                s.source = d->source;
+                s.avatar_index = d->avatar_index;
+                renamed = true;
+            } else if (s.name != d->name) {
+                s.name = d->name;
+                renamed = true;
             }
-            for (int j=0; j<s.joints.size(); ++j) {
-                auto* bvhj = bvh->getJoint(j);
-                auto& sj = s.joints[j];
-                sj.global_transform = bvhj->getGlobalMatrix();
-                sj.transform = bvhj->getMatrix();
-                sj.offset = bvhj->getOffset();
+            s.frame_new = d->generation != s.last_generation;
+            s.last_generation = d->generation;
+        }
+        if (renamed) {
+            buildSkeletonTable();
+        }
+    }
+    
+    // FNV-1a
+    static uint32_t hashSkeletonName(const char* name, size_t length)
+    {
+        uint32_t h = 2166136261u;
+        for (size_t i=0; i<length; ++i) {
+            h = (h ^ uint8_t(name[i])) * 16777619u;
+        }
+        return h;
+    }
+    
+    // at most half full, so probes are short and always reach an empty slot.
+    // Later skeletons win a shared name, as in the map this replaces.
+    void DataReader::buildSkeletonTable()
+    {
+        size_t size = 8;
+        while (size < skeletons.size() * 2) {
+            size *= 2;
+        }
+        skeleton_table.assign(size, -1);
+        skeleton_names.resize(skeletons.size());
+        skeleton_hashes.resize(skeletons.size());
+        for (size_t i=0; i<skeletons.size(); ++i) {
+            const string& name = skeleton_names[i] = skeletons[i].getQualifiedName();
+            const uint32_t h = skeleton_hashes[i] = hashSkeletonName(name.data(), name.size());
+            for (size_t p = h & (size - 1); ; p = (p + 1) & (size - 1)) {
+                const int j = skeleton_table[p];
+                if (j < 0 || (skeleton_hashes[j] == h && skeleton_names[j] == name)) {
+                    skeleton_table[p] = int(i);
+                    break;
+                }
             }
         }
     }
@@ -257,20 +730,178 @@ namespace ofxPerceptionNeuron
         impl->disconnect();
     }
     
+    void DataReader::receiveFrame(int source, const BvhDataHeader& header, const float* data)
+    {
+        receiveFrame(source, header, data, now());
+    }
+    
+    void DataReader::receiveFrame(int source, const BvhDataHeader& header, const float* data, uint64_t timestamp)
+    {
+        if (source >= 0 && source < StreamClient::MAX_SOURCES) {
+            Impl::frameDataReceived(impl.get(), source, timestamp, &header, data);
+        }
+    }
+    
+    bool DataReader::startRecording(const Recorder::Settings& settings)
+    {
+        return impl->recorder.start(settings);
+    }
+    
+    void DataReader::stopRecording()
+    {
+        impl->recorder.stop();
+    }
+    
+    bool DataReader::isRecording() const
+    {
+        return impl->recorder.isRecording();
+    }
+    
+    Recorder::Stats DataReader::getRecordingStats() const
+    {
+        return impl->recorder.getStats();
+    }
+    
+    uint64_t DataReader::now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+    void DataReader::setHistoryLength(size_t frames)
+    {
+        impl->history_length.store(frames, std::memory_order_relaxed);
+    }
+    
+    size_t DataReader::getHistoryLength() const
+    {
+        return impl->history_length.load(std::memory_order_relaxed);
+    }
+    
+    int DataReader::getAvatarSlot(const Skeleton& skeleton) const
+    {
+        if (!skeleton.hierarchy || skeleton.source < 0 || skeleton.source >= StreamClient::MAX_SOURCES ||
+            skeleton.avatar_index >= Impl::MAX_AVATARS) {
+            return -1;
+        }
+        const int slot = skeleton.source * Impl::MAX_AVATARS + skeleton.avatar_index;
+        return impl->slots[slot].pose ? slot : -1;
+    }
+    
+    bool DataReader::getSkeletonAt(const Skeleton& skeleton, uint64_t timestamp, NeuronSkeleton::Pose& pose) const
+    {
+        const int i = getAvatarSlot(skeleton);
+        return i >= 0 && Impl::sampleAt(impl->slots[i], timestamp, 0, pose);
+    }
+    
+    size_t DataReader::getHistory(const Skeleton& skeleton, const Joint& joint, uint64_t window, vector<JointSample>& samples) const
+    {
+        const int i = getAvatarSlot(skeleton);
+        if (i < 0) {
+            samples.clear();
+            return 0;
+        }
+        return Impl::getHistory(impl->slots[i], joint.getIndex(), window, samples);
+    }
+    
+    const CalcFrame* DataReader::getCalcFrame(const Skeleton& skeleton) const
+    {
+        const int i = getAvatarSlot(skeleton);
+        return i < 0 ? nullptr : impl->slots[i].calc_front;
+    }
+    
+    bool DataReader::getLatencyStats(const Skeleton& skeleton, LatencyStats& stats) const
+    {
+        const int i = getAvatarSlot(skeleton);
+        if (i < 0) {
+            return false;
+        }
+        impl->slots[i].stats->get(stats);
+        return true;
+    }
+    
+    void DataReader::setOutputMode(OutputMode mode)
+    {
+        impl->output_mode = mode;
+    }
+    
+    DataReader::OutputMode DataReader::getOutputMode() const
+    {
+        return impl->output_mode;
+    }
+    
+    void DataReader::setSampleDelay(int64_t ns)
+    {
+        impl->sample_delay = ns;
+    }
+    
+    int64_t DataReader::getSampleDelay() const
+    {
+        return impl->sample_delay;
+    }
+    
+    void DataReader::setMaxPrediction(uint64_t ns)
+    {
+        impl->max_prediction = ns;
+    }
+    
+    uint64_t DataReader::getMaxPrediction() const
+    {
+        return impl->max_prediction;
+    }
+    
+    int64_t DataReader::getSampleOffset(const Skeleton& skeleton) const
+    {
+        const int i = getAvatarSlot(skeleton);
+        return i < 0 ? 0 : impl->slots[i].sample_offset;
+    }
+    
     void DataReader::debugDraw() const
     {
-//        impl->draw();
+        SkeletonRenderer& r = impl->renderer;
+        r.begin();
         for (auto & p : skeletons) {
-            p.debugDraw();
+            r.add(p);
         }
+        r.draw();
     }
-
-    const Skeleton& DataReader::getSkeletonByName(string name) const
+    
+    void DataReader::debugDraw(const ofCamera& camera) const
     {
-        const auto& it = skeletons_map.find(name);
-        if (it != skeletons_map.end()) {
-            return *it->second;
+        SkeletonRenderer& r = impl->renderer;
+        r.begin(camera);
+        for (auto & p : skeletons) {
+            r.add(p);
         }
+        r.draw();
     }
-
+    
+    int DataReader::findSkeleton(NameRef name) const
+    {
+        if (skeleton_table.empty()) {
+            return -1;
+        }
+        const uint32_t h = hashSkeletonName(name.data(), name.size());
+        const size_t mask = skeleton_table.size() - 1;
+        for (size_t p = h & mask; ; p = (p + 1) & mask) {
+            const int i = skeleton_table[p];
+            if (i < 0) {
+                return -1;
+            }
+            const string& s = skeleton_names[i];
+            if (skeleton_hashes[i] == h && s.size() == name.size() && memcmp(s.data(), name.data(), s.size()) == 0) {
+                return i;
+            }
+        }
+    }
+    
+    const Skeleton& DataReader::getSkeletonByName(NameRef name) const
+    {
+        const int i = findSkeleton(name);
+        if (i < 0) {
+            throw std::out_of_range("ofxPerceptionNeuron: no skeleton named " + string(name));
+        }
+        return skeletons[i];
+    }
+    
 }
\ No newline at end of file
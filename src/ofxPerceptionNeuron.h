@@ -4,58 +4,244 @@
 #pragma once
 
 #include "ofMain.h"
+#include "ofxBvhHierarchy.h"
+#include "Recorder.h"
+#include "NeuronSkeleton.h"
+#include "LatencyHistogram.h"
+#include "StreamClient.h"
 
 namespace ofxPerceptionNeuron
 {
     class DataReader;
     
-    struct Joint
+    // View of one joint's pose. Its name, parent and children are looked up
+    // through the Skeleton, whose hierarchy is shared with every other skeleton.
+    class Joint
     {
-        string name;
-        ofVec3f offset;
-        
-        ofMatrix4x4 transform;
-        ofMatrix4x4 global_transform;
-        
-        vector<Joint*> children;
-        Joint* parent = nullptr;
+    protected:
+        friend class DataReader;
+        int index = -1;
+        const ofVec3f* offset = nullptr;
+        const ofMatrix4x4* transform = nullptr;
+        const ofMatrix4x4* global_transform = nullptr;
+    public:
+        int getIndex() const { return index; }
+        const ofVec3f& getOffset() const { return *offset; }
+        const ofMatrix4x4& getTransform() const { return *transform; }
+        const ofMatrix4x4& getGlobalTransform() const { return *global_transform; }
     };
     
+    // A view over the pose buffers the DataReader solves into: nothing is
+    // copied per frame, and the pose changes in place on DataReader::update().
+    // Copy out what you need to keep, e.g. only when isFrameNew().
     class Skeleton
     {
     protected:
         friend class DataReader;
         string name;
+        int source = 0;
+        uint32_t avatar_index = 0;
+        ofxBvhHierarchyRef hierarchy;
         vector<Joint> joints;
-        map<string, Joint*> joints_map;
+        const uint64_t* generation = nullptr;
+        uint64_t last_generation = 0;
+        bool frame_new = false;
     public:
         void debugDraw() const;
         string getName() const { return name; }
+        // the DataReader::connect() the avatar arrived through, and its AvatarIndex there
+        int getSource() const { return source; }
+        uint32_t getAvatarIndex() const { return avatar_index; }
+        // the name getSkeletonByName() knows it by: the avatar name, prefixed
+        // with "<source>/" for servers after the first so names can't collide
+        string getQualifiedName() const { return source == 0 ? name : ofToString(source) + "/" + name; }
+        const ofxBvhHierarchyRef& getHierarchy() const { return hierarchy; }
         const vector<Joint>& getJoints() const { return joints; }
-        const Joint& getJointByName(string name) const {
-            const auto& it = joints_map.find(name);
-            if (it != joints_map.end()) {
-                return *it->second;
+        // number of frames solved into this skeleton so far
+        uint64_t getGeneration() const { return generation ? *generation : 0; }
+        // true if the last DataReader::update() solved a new frame for this skeleton
+        bool isFrameNew() const { return frame_new; }
+        const string& getJointName(const Joint& joint) const {
+            return hierarchy->getName(joint.getIndex());
+        }
+        const Joint* getParent(const Joint& joint) const {
+            const int p = hierarchy->getParent(joint.getIndex());
+            return p < 0 ? nullptr : &joints[p];
+        }
+        int getNumChildren(const Joint& joint) const {
+            return hierarchy->getNumChildren(joint.getIndex());
+        }
+        const Joint& getChild(const Joint& joint, int i) const {
+            return joints[hierarchy->getChild(joint.getIndex(), i)];
+        }
+        // O(1) by id, e.g. getJoint(NeuronSkeleton::LeftHand)
+        const Joint& getJoint(NeuronSkeleton::JointId id) const { return joints[id]; }
+        // index into getJoints(), -1 if none; see NeuronSkeleton::findJoint
+        int findJoint(NameRef name) const {
+            return joints.empty() ? -1 : NeuronSkeleton::findJoint(name);
+        }
+        // throws std::out_of_range if there is no such joint
+        const Joint& getJointByName(NameRef name) const {
+            const int index = findJoint(name);
+            if (index < 0) {
+                throw std::out_of_range("ofxPerceptionNeuron: no joint named " + string(name));
             }
+            return joints[index];
         }
     };
     
+    // one frame of a joint's history, see DataReader::getHistory
+    struct JointSample
+    {
+        uint64_t timestamp = 0;
+        uint32_t frame_index = 0;
+        ofMatrix4x4 global_transform;
+    };
+    
+    // One frame of Axis Neuron's calculation stream (Broadcasting > Calculation).
+    // Joint k is NeuronSkeleton::rotation_joints[k]; each quantity is its own
+    // contiguous array, gathered straight out of the packet on the receive thread.
+    struct CalcFrame
+    {
+        static const int MAX_JOINTS = NeuronSkeleton::NUM_ROTATIONS;
+        // position, velocity, quaternion (w x y z), acceleration, gyro
+        static const int VALUES_PER_JOINT = 16;
+        
+        uint32_t frame_index = 0;
+        uint64_t timestamp = 0; // DataReader::now() at receive
+        int num_joints = 0;
+        ofVec3f position[MAX_JOINTS];
+        ofVec3f velocity[MAX_JOINTS];
+        ofQuaternion quaternion[MAX_JOINTS];
+        ofVec3f acceleration[MAX_JOINTS];
+        ofVec3f gyro[MAX_JOINTS];
+        
+        // data holds num_joints * VALUES_PER_JOINT values as sent
+        void set(const float* data, int num_joints);
+    };
+    
+    // one avatar's pipeline, from the socket to update(); see DataReader::getLatencyStats
+    struct LatencyStats
+    {
+        uint64_t frames_received = 0;
+        uint64_t frames_missing = 0; // skipped FrameIndex values, i.e. lost before reaching us
+        uint64_t frames_out_of_order = 0; // FrameIndex repeated or went backwards
+        uint64_t frames_discarded = 0; // out of order frames dropped, UDP only
+        uint64_t frames_unsupported = 0; // channel layout that can't be posed
+        uint64_t frames_consumed = 0; // picked up by update()
+        uint64_t frames_overwritten = 0; // received, then replaced by a newer frame before update()
+        
+        LatencyHistogram arrival_interval; // ns between packets
+        LatencyHistogram frame_gap; // FrameIndex step between packets, 1 when nothing is lost
+        LatencyHistogram receive_to_update; // ns from the packet arriving to update() picking it up
+        LatencyHistogram solve; // ns spent in forward kinematics
+    };
+    
     class DataReader
     {
     protected:
         class Impl;
         shared_ptr<Impl> impl;
         vector<Skeleton> skeletons;
-        map<string, Skeleton*> skeletons_map;
+        // findSkeleton(): an open-addressed table of indices into skeletons,
+        // keyed by a hash of the qualified name and rebuilt when a skeleton is
+        // added or renamed, so lookups build no strings and compare one name
+        vector<string> skeleton_names;
+        vector<uint32_t> skeleton_hashes;
+        vector<int> skeleton_table;
+        void buildSkeletonTable();
+        // the slot of the skeleton's source and AvatarIndex, so copies of a
+        // Skeleton resolve too; -1 if update() hasn't posed that avatar
+        int getAvatarSlot(const Skeleton& skeleton) const;
     public:
+        enum OutputMode
+        {
+            OUTPUT_NEWEST, // skeletons show the newest frame received
+            OUTPUT_SAMPLED // skeletons show the pose at the presentation time, from history
+        };
+        
         DataReader();
-        void connect(string ip, int port);
+        // Adds a server; call again to merge several into one set of skeletons,
+        // all received on one thread. Returns its source id, or -1 if
+        // StreamClient::MAX_SOURCES are connected already.
+        int connect(string ip, int port);
+        // Adds a UDP port to receive on (Axis Neuron's UDP broadcast), on all
+        // interfaces unless ip is given. Datagrams are read in batches and
+        // timed by the kernel; frames older than the newest seen are dropped.
+        int listenUdp(int port, string ip = "");
+        // disconnects every server
         void disconnect();
+        // Hands over a frame as if it had arrived from source, e.g. to replay
+        // packets from another transport or to benchmark ingest. This is the
+        // receive thread's path: call it from one thread at a time, and only
+        // while no server is connected.
+        void receiveFrame(int source, const BvhDataHeader& header, const float* data);
+        // the same, arrived at timestamp in now() nanoseconds, e.g. to replay
+        // recorded receive times into the history
+        void receiveFrame(int source, const BvhDataHeader& header, const float* data, uint64_t timestamp);
+        // Poses every avatar with a new frame, one avatar at a time with
+        // NeuronSkeleton::Pose (see ofxBvhSolver::solveBatch for why).
         void update();
+        // presentation_time in now() nanoseconds, e.g. when the frame being drawn will be on screen
+        void update(uint64_t presentation_time);
+        // true if any server is connected
         bool isConnected() const;
+        int getNumSources() const;
+        SourceStatus getSourceStatus(int source) const;
         bool isFrameNew() const;
+        // every skeleton in one draw call, see SkeletonRenderer, facing the current view
         void debugDraw() const;
+        // the same for camera, without reading the modelview matrix
+        void debugDraw(const ofCamera& camera) const;
         const vector<Skeleton>& getSkeletons() const { return skeletons; }
-        const Skeleton& getSkeletonByName(string name) const;
+        // index into getSkeletons() by Skeleton::getQualifiedName(), -1 if none.
+        // Skeletons are only ever appended, so the index stays valid.
+        int findSkeleton(NameRef name) const;
+        // throws std::out_of_range if there is no such skeleton
+        const Skeleton& getSkeletonByName(NameRef name) const;
+        
+        // records every frame received from now on; see Recorder
+        bool startRecording(const Recorder::Settings& settings);
+        void stopRecording();
+        bool isRecording() const;
+        Recorder::Stats getRecordingStats() const;
+        
+        // Pose history. The last getHistoryLength() frames of every avatar are
+        // kept with their FrameIndex and receive time, in now() nanoseconds,
+        // and can be queried without holding up the stream.
+        // The length applies to avatars first seen after it is set.
+        static uint64_t now();
+        void setHistoryLength(size_t frames);
+        size_t getHistoryLength() const;
+        // solves the pose at timestamp, slerped between the frames received
+        // around it and clamped to the newest; false if it's older than the history
+        bool getSkeletonAt(const Skeleton& skeleton, uint64_t timestamp, NeuronSkeleton::Pose& pose) const;
+        // the joint's global transform for each frame in the newest window ns
+        // of history, oldest first; returns the number of samples
+        size_t getHistory(const Skeleton& skeleton, const Joint& joint, uint64_t window, vector<JointSample>& samples) const;
+        
+        // The newest calculation frame picked up by update(), or nullptr if the
+        // avatar sends none. Valid until the next update().
+        const CalcFrame* getCalcFrame(const Skeleton& skeleton) const;
+        
+        // counters and histograms accumulated since the avatar was first seen,
+        // e.g. receive_to_update.getValueAtPercentile(99) against a latency budget
+        bool getLatencyStats(const Skeleton& skeleton, LatencyStats& stats) const;
+        
+        // Render-rate output. In OUTPUT_SAMPLED, update() poses each skeleton
+        // at presentation_time - sample delay: slerped between the two frames
+        // around it, or, past the newest frame, extrapolated from the last two
+        // for at most the max prediction. A positive delay adds latency for
+        // smooth interpolation (about one frame interval plus jitter); a
+        // negative one predicts ahead to hide pipeline latency. Needs history.
+        void setOutputMode(OutputMode mode);
+        OutputMode getOutputMode() const;
+        void setSampleDelay(int64_t ns);
+        int64_t getSampleDelay() const;
+        void setMaxPrediction(uint64_t ns);
+        uint64_t getMaxPrediction() const;
+        // ns the shown pose is ahead of (positive, predicted) or behind
+        // (negative, latency added) the newest frame received, as of the last update()
+        int64_t getSampleOffset(const Skeleton& skeleton) const;
     };
 }
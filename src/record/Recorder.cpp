@@ -0,0 +1,416 @@
+#include "Recorder.h"
+
+#include <chrono>
+#include <string.h>
+
+#include "NeuronSkeleton.h"
+#include "ofxBvhCapture.h"
+
+namespace ofxPerceptionNeuron
+{
+    static const int IDLE_SLEEP_MS = 2;
+    static const uint64_t FLUSH_INTERVAL_NS = 1000000000ull;
+    static const uint64_t REPORT_INTERVAL_NS = 1000000000ull;
+    static const size_t FILE_BUFFER_SIZE = 1 << 18;
+    static const char RAW_MAGIC[8] = { 'P', 'N', 'R', 'A', 'W', '0', '1', '\0' };
+    
+    // BVH values are written with 4 decimals; this is several times faster
+    // than printf and keeps the writer well ahead of many avatars at 120 Hz
+    static char* formatFixed(char* p, float v)
+    {
+        if (!(v > -1e9f && v < 1e9f)) {
+            return p + snprintf(p, 32, "%g", v);
+        }
+        int64_t n = llround(double(v) * 10000.0);
+        if (n < 0) {
+            *p++ = '-';
+            n = -n;
+        }
+        char digits[24];
+        int len = 0;
+        do {
+            digits[len++] = '0' + n % 10;
+            n /= 10;
+        } while (n > 0 || len < 5);
+        while (len > 4) {
+            *p++ = digits[--len];
+        }
+        *p++ = '.';
+        while (len > 0) {
+            *p++ = digits[--len];
+        }
+        return p;
+    }
+    
+    // fixed width, so it can be rewritten in place as rows are flushed and when the file is closed
+    static int writeMotionHeader(FILE* f, uint64_t num_frames, double frame_time)
+    {
+        return fprintf(f, "Frames: %-10llu\nFrame Time: %-12.8f\n",
+                       (unsigned long long)num_frames, min(max(frame_time, 0.0), 9.0));
+    }
+    
+    Recorder::Recorder() : recording(false), running(false), active_pushes(0),
+        frames_received(0), frames_written(0), frames_dropped(0),
+        frames_skipped(0), bytes_written(0), files_written(0)
+    {
+    }
+    
+    Recorder::~Recorder()
+    {
+        stop();
+    }
+    
+    uint64_t Recorder::now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+    bool Recorder::start(const Settings& settings)
+    {
+        stop();
+        if (settings.path.empty()) {
+            ofLogError("ofxPerceptionNeuron") << "recorder: no output path";
+            return false;
+        }
+        this->settings = settings;
+        hierarchy_text = NeuronSkeleton::getHierarchy()->toString();
+        
+        // fill every slot once up front so push() never allocates
+        queue.reset(max<size_t>(settings.queue_size, 2));
+        for (size_t i=0; i<queue.capacity(); ++i) {
+            queue.slot(i).data.reserve(NeuronSkeleton::NUM_CHANNELS);
+        }
+        
+        frames_received = 0;
+        frames_written = 0;
+        frames_dropped = 0;
+        frames_skipped = 0;
+        bytes_written = 0;
+        files_written = 0;
+        reported_drops = 0;
+        outputs.clear();
+        
+        running = true;
+        thread = std::thread(&Recorder::threadedFunction, this);
+        recording = true;
+        return true;
+    }
+    
+    void Recorder::stop()
+    {
+        if (!thread.joinable()) {
+            return;
+        }
+        // wait out any push() in flight, then let the writer drain the queue
+        recording = false;
+        while (active_pushes.load() > 0) {
+            std::this_thread::yield();
+        }
+        running = false;
+        thread.join();
+    }
+    
+    bool Recorder::push(const BvhDataHeader* header, const float* data, uint64_t timestamp)
+    {
+        active_pushes.fetch_add(1);
+        if (!recording.load()) {
+            active_pushes.fetch_sub(1);
+            return false;
+        }
+        
+        frames_received.fetch_add(1, std::memory_order_relaxed);
+        Frame* f = queue.beginPush();
+        if (f) {
+            f->timestamp = timestamp;
+            f->header = *header;
+            f->data.assign(data, data + header->DataCount);
+            queue.commitPush();
+        } else {
+            frames_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        
+        active_pushes.fetch_sub(1, std::memory_order_release);
+        return f != nullptr;
+    }
+    
+    Recorder::Stats Recorder::getStats() const
+    {
+        Stats s;
+        s.frames_received = frames_received.load(std::memory_order_relaxed);
+        s.frames_written = frames_written.load(std::memory_order_relaxed);
+        s.frames_dropped = frames_dropped.load(std::memory_order_relaxed);
+        s.frames_skipped = frames_skipped.load(std::memory_order_relaxed);
+        s.bytes_written = bytes_written.load(std::memory_order_relaxed);
+        s.files_written = files_written.load(std::memory_order_relaxed);
+        return s;
+    }
+    
+    void Recorder::threadedFunction()
+    {
+        uint64_t last_flush = now();
+        uint64_t last_report = 0;
+        for (;;) {
+            // read before draining: once stopped, nothing more can be queued
+            const bool stopping = !running.load(std::memory_order_acquire);
+            while (Frame* f = queue.front()) {
+                write(*f);
+                queue.pop();
+            }
+            
+            // idle: push buffered rows out now and then, with BVH frame counts
+            // to match, so a crash loses at most about a second
+            const uint64_t t = now();
+            if (t - last_flush >= FLUSH_INTERVAL_NS) {
+                for (auto& out : outputs) {
+                    if (out.file && settings.format == FORMAT_BVH) {
+                        patchMotionHeader(out);
+                    }
+                    if (out.file) fflush(out.file);
+                    if (out.index) fflush(out.index);
+                }
+                last_flush = t;
+            }
+            if (stopping || t - last_report >= REPORT_INTERVAL_NS) {
+                reportDrops();
+                last_report = t;
+            }
+            
+            if (stopping) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_SLEEP_MS));
+        }
+        
+        for (auto& out : outputs) {
+            closeFile(out);
+        }
+    }
+    
+    void Recorder::reportDrops()
+    {
+        const uint64_t dropped = frames_dropped.load(std::memory_order_relaxed);
+        if (dropped != reported_drops) {
+            ofLogWarning("ofxPerceptionNeuron") << "recorder: dropped " << dropped - reported_drops
+                << " frames under backpressure (" << dropped << " in total)";
+            reported_drops = dropped;
+        }
+    }
+    
+    void Recorder::write(const Frame& frame)
+    {
+        if (settings.format == FORMAT_RAW) {
+            writeRaw(frame);
+        } else {
+            writeAvatar(frame);
+        }
+    }
+    
+    bool Recorder::needsRotation(const OutputFile& out, const Frame& frame) const
+    {
+        if (settings.max_file_bytes > 0 && out.bytes >= settings.max_file_bytes) {
+            return true;
+        }
+        return settings.max_file_seconds > 0 &&
+            frame.timestamp - out.first_timestamp >= uint64_t(settings.max_file_seconds * 1e9);
+    }
+    
+    void Recorder::writeAvatar(const Frame& frame)
+    {
+        // without displacement, bones are written at the template lengths
+        const float* data = frame.data.data();
+        if (!frame.header.WithDisp && frame.data.size() == NeuronSkeleton::NUM_CHANNELS_NO_DISP) {
+            expanded.resize(NeuronSkeleton::NUM_CHANNELS);
+            NeuronSkeleton::expandChannels(data, expanded.data());
+            data = expanded.data();
+        } else if (frame.data.size() < NeuronSkeleton::NUM_CHANNELS) {
+            frames_skipped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        
+        OutputFile* out = nullptr;
+        for (auto& o : outputs) {
+            if (o.avatar_index == frame.header.AvatarIndex) {
+                out = &o;
+                break;
+            }
+        }
+        if (!out) {
+            outputs.push_back(OutputFile());
+            out = &outputs.back();
+            out->avatar_index = frame.header.AvatarIndex;
+        }
+        
+        if (out->open && needsRotation(*out, frame)) {
+            closeFile(*out);
+        }
+        if (!out->open && !openFile(*out, frame)) {
+            frames_skipped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        
+        size_t n = 0;
+        if (out->capture) {
+            // the capture writer codes whole chunks, so its size grows in steps
+            const uint64_t before = out->capture->getNumBytes();
+            out->capture->addFrame(data);
+            n = out->capture->getNumBytes() - before;
+        } else {
+            // worst case per value is the %g fallback, well under 32 bytes
+            line.resize(NeuronSkeleton::NUM_CHANNELS * 32 + 1);
+            char* p = line.data();
+            for (int i=0; i<NeuronSkeleton::NUM_CHANNELS; ++i) {
+                if (i > 0) {
+                    *p++ = ' ';
+                }
+                p = formatFixed(p, data[i]);
+            }
+            *p++ = '\n';
+            n = p - line.data();
+            fwrite(line.data(), 1, n, out->file);
+        }
+        fprintf(out->index, "%llu,%u,%llu\n", (unsigned long long)out->num_frames,
+                frame.header.FrameIndex, (unsigned long long)frame.timestamp);
+        
+        out->num_frames++;
+        out->bytes += n;
+        out->last_timestamp = frame.timestamp;
+        frames_written.fetch_add(1, std::memory_order_relaxed);
+        bytes_written.fetch_add(n, std::memory_order_relaxed);
+    }
+    
+    void Recorder::writeRaw(const Frame& frame)
+    {
+        if (outputs.empty()) {
+            outputs.push_back(OutputFile());
+        }
+        OutputFile& out = outputs[0];
+        if (out.open && needsRotation(out, frame)) {
+            closeFile(out);
+        }
+        if (!out.open && !openFile(out, frame)) {
+            frames_skipped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        
+        RecordHeader record;
+        record.timestamp = frame.timestamp;
+        record.header = frame.header;
+        record.header.DataCount = frame.data.size();
+        fwrite(&record, sizeof(record), 1, out.file);
+        fwrite(frame.data.data(), sizeof(float), frame.data.size(), out.file);
+        
+        const size_t n = sizeof(record) + frame.data.size() * sizeof(float);
+        out.num_frames++;
+        out.bytes += n;
+        out.last_timestamp = frame.timestamp;
+        frames_written.fetch_add(1, std::memory_order_relaxed);
+        bytes_written.fetch_add(n, std::memory_order_relaxed);
+    }
+    
+    bool Recorder::openFile(OutputFile& out, const Frame& frame)
+    {
+        static const char* extensions[] = { ".bvh", ".bvhcap", ".pnr" };
+        char suffix[64];
+        if (settings.format == FORMAT_RAW) {
+            snprintf(suffix, sizeof(suffix), "_%03d", out.sequence);
+        } else {
+            snprintf(suffix, sizeof(suffix), "_avatar%u_%03d", out.avatar_index, out.sequence);
+        }
+        const std::string base = settings.path + suffix;
+        out.path = base + extensions[settings.format];
+        
+        bool ok;
+        if (settings.format == FORMAT_CAPTURE) {
+            if (!out.capture) {
+                out.capture = std::make_shared<ofxBvhCaptureWriter>();
+            }
+            ok = out.capture->open(out.path, NeuronSkeleton::getHierarchy(), 0);
+        } else {
+            out.file = fopen(out.path.c_str(), "wb");
+            ok = out.file != nullptr;
+        }
+        if (ok && settings.format != FORMAT_RAW) {
+            out.index = fopen((base + ".csv").c_str(), "wb");
+            ok = out.index != nullptr;
+        }
+        out.open = true;
+        if (!ok) {
+            ofLogError("ofxPerceptionNeuron") << "recorder: can't open " << out.path;
+            closeFile(out);
+            return false;
+        }
+        if (out.file) {
+            setvbuf(out.file, nullptr, _IOFBF, FILE_BUFFER_SIZE);
+        }
+        
+        out.sequence++;
+        out.num_frames = 0;
+        out.first_timestamp = frame.timestamp;
+        out.last_timestamp = frame.timestamp;
+        
+        if (settings.format == FORMAT_BVH) {
+            fwrite(hierarchy_text.data(), 1, hierarchy_text.size(), out.file);
+            out.frames_pos = ftell(out.file);
+            writeMotionHeader(out.file, 0, 0);
+        } else if (settings.format == FORMAT_RAW) {
+            FileHeader header;
+            memcpy(header.magic, RAW_MAGIC, sizeof(header.magic));
+            header.hierarchy_size = hierarchy_text.size();
+            header.reserved = 0;
+            fwrite(&header, sizeof(header), 1, out.file);
+            fwrite(hierarchy_text.data(), 1, hierarchy_text.size(), out.file);
+        }
+        if (out.index) {
+            fputs("frame,frame_index,timestamp_ns\n", out.index);
+        }
+        out.bytes = out.file ? ftell(out.file) : out.capture->getNumBytes();
+        bytes_written.fetch_add(out.bytes, std::memory_order_relaxed);
+        return true;
+    }
+    
+    // rows are as received, so the frame time is taken from the span of the take
+    static double getFrameTime(uint64_t num_frames, uint64_t first_timestamp, uint64_t last_timestamp)
+    {
+        const double seconds = (last_timestamp - first_timestamp) * 1e-9;
+        return num_frames > 1 ? seconds / (num_frames - 1) : 0;
+    }
+    
+    // rewrites the BVH motion header with the rows written so far
+    void Recorder::patchMotionHeader(OutputFile& out)
+    {
+        const long end = ftell(out.file);
+        fseek(out.file, out.frames_pos, SEEK_SET);
+        writeMotionHeader(out.file, out.num_frames, getFrameTime(out.num_frames, out.first_timestamp, out.last_timestamp));
+        fseek(out.file, end, SEEK_SET);
+    }
+    
+    void Recorder::closeFile(OutputFile& out)
+    {
+        const double frame_time = getFrameTime(out.num_frames, out.first_timestamp, out.last_timestamp);
+        bool ok = true;
+        if (out.file && settings.format == FORMAT_BVH) {
+            patchMotionHeader(out);
+        }
+        if (out.file) {
+            ok = fclose(out.file) == 0;
+        } else if (out.capture && out.capture->isOpen()) {
+            const uint64_t before = out.capture->getNumBytes();
+            out.capture->setFrameTime(frame_time);
+            ok = out.capture->close();
+            bytes_written.fetch_add(out.capture->getNumBytes() - before, std::memory_order_relaxed);
+        }
+        if (out.open) {
+            if (!ok) {
+                ofLogError("ofxPerceptionNeuron") << "recorder: error writing " << out.path;
+            }
+            files_written.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (out.index) {
+            fclose(out.index);
+        }
+        out.file = nullptr;
+        out.index = nullptr;
+        out.open = false;
+    }
+}
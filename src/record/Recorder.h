@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DataType.h"
+#include "SpscQueue.h"
+
+class ofxBvhCaptureWriter;
+
+namespace ofxPerceptionNeuron
+{
+    // Records frames as they arrive from the stream.
+    // push() copies a frame into a bounded wait-free queue and returns; a
+    // dedicated thread drains it to disk. If the disk falls behind, frames
+    // are dropped and counted rather than ever blocking the receive thread.
+    // One producer thread at a time.
+    //
+    // FORMAT_BVH writes one BVH file per avatar, using the Axis Neuron
+    // hierarchy, plus a .csv next to it with the FrameIndex and receive time
+    // of every row. Frames sent without displacement are written with the
+    // template offsets as positions (see NeuronSkeleton::expandChannels);
+    // other layouts short of NeuronSkeleton::NUM_CHANNELS are skipped.
+    //
+    // FORMAT_CAPTURE is the same per avatar, as compact ofxBvhCapture files
+    // (15-20x smaller than BVH text for smooth motion, see ofxBvhCapture.h).
+    //
+    // FORMAT_RAW writes every avatar to one file, frames verbatim:
+    //   FileHeader, hierarchy text (FileHeader::hierarchy_size bytes), then
+    //   per frame a RecordHeader followed by header.DataCount floats.
+    class Recorder
+    {
+    public:
+        enum Format
+        {
+            FORMAT_BVH,
+            FORMAT_CAPTURE,
+            FORMAT_RAW,
+        };
+        
+        struct Settings
+        {
+            // file name prefix, e.g. "captures/take1"; files are named
+            // take1_avatar<index>_<n>.bvh/.bvhcap or take1_<n>.pnr
+            std::string path;
+            Format format = FORMAT_BVH;
+            // frames the queue can hold before dropping
+            size_t queue_size = 1024;
+            // start the next file once one reaches this size or covers this
+            // much receive time; 0 never rotates
+            uint64_t max_file_bytes = 0;
+            double max_file_seconds = 0;
+        };
+        
+        struct Stats
+        {
+            uint64_t frames_received = 0;
+            uint64_t frames_written = 0;
+            uint64_t frames_dropped = 0; // queue full
+            uint64_t frames_skipped = 0; // not writable in this format
+            uint64_t bytes_written = 0;
+            uint64_t files_written = 0;
+        };
+
+#pragma pack(push, 1)
+        struct FileHeader
+        {
+            char magic[8]; // "PNRAW01"
+            uint32_t hierarchy_size;
+            uint32_t reserved;
+        };
+        
+        struct RecordHeader
+        {
+            uint64_t timestamp; // receive time, ns since the epoch
+            BvhDataHeader header; // as received
+        };
+#pragma pack(pop)
+
+        Recorder();
+        ~Recorder();
+        
+        bool start(const Settings& settings);
+        // writes out everything queued so far, then closes the files
+        void stop();
+        bool isRecording() const { return recording.load(std::memory_order_relaxed); }
+        
+        // producer side: returns false if not recording or the frame was dropped
+        bool push(const BvhDataHeader* header, const float* data, uint64_t timestamp);
+        
+        Stats getStats() const;
+        
+        // steady clock ns, the clock of DataReader::now(). DataReader pushes
+        // frames with their arrival time, so the .csv times line up with
+        // getLatencyStats() and the pose history.
+        static uint64_t now();
+    
+    protected:
+        struct Frame
+        {
+            uint64_t timestamp = 0;
+            BvhDataHeader header;
+            std::vector<float> data;
+        };
+        
+        // writer thread
+        struct OutputFile
+        {
+            bool open = false;
+            FILE* file = nullptr;
+            FILE* index = nullptr;
+            std::shared_ptr<ofxBvhCaptureWriter> capture;
+            std::string path;
+            uint32_t avatar_index = 0;
+            int sequence = 0;
+            long frames_pos = 0;
+            uint64_t num_frames = 0;
+            uint64_t bytes = 0;
+            uint64_t first_timestamp = 0;
+            uint64_t last_timestamp = 0;
+        };
+        
+        void threadedFunction();
+        void write(const Frame& frame);
+        void writeAvatar(const Frame& frame);
+        void writeRaw(const Frame& frame);
+        bool openFile(OutputFile& out, const Frame& frame);
+        void closeFile(OutputFile& out);
+        void patchMotionHeader(OutputFile& out);
+        bool needsRotation(const OutputFile& out, const Frame& frame) const;
+        void reportDrops();
+        
+        Settings settings;
+        std::string hierarchy_text;
+        
+        SpscQueue<Frame> queue;
+        std::thread thread;
+        std::atomic<bool> recording;
+        std::atomic<bool> running;
+        std::atomic<int> active_pushes;
+        
+        std::atomic<uint64_t> frames_received;
+        std::atomic<uint64_t> frames_written;
+        std::atomic<uint64_t> frames_dropped;
+        std::atomic<uint64_t> frames_skipped;
+        std::atomic<uint64_t> bytes_written;
+        std::atomic<uint64_t> files_written;
+        
+        // writer thread
+        std::vector<OutputFile> outputs; // per avatar for BVH, one for raw
+        std::vector<char> line;
+        std::vector<float> expanded; // frames sent without displacement
+        uint64_t reported_drops = 0;
+    };
+}
@@ -0,0 +1,35 @@
+#include "SkeletonRenderer.h"
+
+#include "ofxPerceptionNeuron.h"
+
+namespace ofxPerceptionNeuron
+{
+    void SkeletonRenderer::add(const Skeleton& skeleton)
+    {
+        const ofxBvhHierarchyRef& hierarchy = skeleton.getHierarchy();
+        if (!hierarchy) {
+            return;
+        }
+        // names don't change, so classify joints once per hierarchy rather than per frame
+        if (hierarchy != small_joints_hierarchy) {
+            small_joints_hierarchy = hierarchy;
+            small_joints.resize(hierarchy->getNumJoints());
+            for (int i=0; i<hierarchy->getNumJoints(); ++i) {
+                const string& name = hierarchy->getName(i);
+                small_joints[i] = name.find("Hand") != string::npos || name.find("Site") != string::npos;
+            }
+        }
+        
+        const auto& joints = skeleton.getJoints();
+        for (const auto& joint : joints) {
+            const ofMatrix4x4& m = joint.getGlobalTransform();
+            const bool small = small_joints[joint.getIndex()];
+            addBox(m, small ? style.small_box_size : style.box_size, style.box_color);
+            addAxes(m, small ? style.small_axis_length : style.axis_length);
+            const ofVec3f o = transform(m, ofVec3f());
+            for (int i=0; i<skeleton.getNumChildren(joint); ++i) {
+                addRibbon(o, transform(m, skeleton.getChild(joint, i).getOffset()), style.line_width, style.box_color);
+            }
+        }
+    }
+}
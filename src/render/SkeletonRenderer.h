@@ -0,0 +1,30 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxBvhHierarchy.h"
+#include "ofxBvhRenderer.h"
+
+namespace ofxPerceptionNeuron
+{
+    class Skeleton;
+    
+    // Draws any number of skeletons with one draw call.
+    // Each frame, begin() with the camera, add() every skeleton, then draw().
+    // The geometry is ofxBvhRenderer's: boxes and axes like
+    // Skeleton::debugDraw, markers like ofxBvh::draw, and bone lines as
+    // ribbons turned to face the camera, all in one persistent ofVboMesh.
+    class SkeletonRenderer : public ofxBvhRenderer
+    {
+    public:
+        using ofxBvhRenderer::add;
+        
+        // boxes, axes and bones, as Skeleton::debugDraw; joints whose name
+        // contains "Hand" or "Site" are drawn small
+        void add(const Skeleton& skeleton);
+    
+    protected:
+        // per joint of the last hierarchy seen: true if drawn small
+        ofxBvhHierarchyRef small_joints_hierarchy;
+        vector<bool> small_joints;
+    };
+}
@@ -0,0 +1,174 @@
+#include "SkinnedMesh.h"
+
+#include "ofxPerceptionNeuron.h"
+#include "ofxBvhKernels.h"
+
+namespace ofxPerceptionNeuron
+{
+    bool SkinnedMesh::setup(const ofMesh& bind_mesh, const vector<uint16_t>& bones, const vector<float>& weights,
+                            int influences_per_vertex, const ofxBvhHierarchy& hierarchy)
+    {
+        num_vertices = 0;
+        const size_t n = bind_mesh.getNumVertices();
+        if (n == 0 || influences_per_vertex <= 0
+            || bones.size() < n * influences_per_vertex || weights.size() < n * influences_per_vertex) {
+            ofLogError("ofxPerceptionNeuron") << "skinned mesh: " << n << " vertices need "
+                << influences_per_vertex << " bones and weights each";
+            return false;
+        }
+        for (size_t i=0; i<n * influences_per_vertex; ++i) {
+            if (bones[i] >= hierarchy.getNumJoints()) {
+                ofLogError("ofxPerceptionNeuron") << "skinned mesh: bone " << bones[i] << " isn't in the hierarchy";
+                return false;
+            }
+        }
+        
+        stride = (n + LANES - 1) / LANES * LANES;
+        has_normals = bind_mesh.getNumNormals() == n;
+        bind_positions.assign(3 * stride, 0);
+        bind_normals.assign(has_normals ? 3 * stride : 0, 0);
+        out_positions.assign(3 * stride, 0);
+        out_normals.assign(has_normals ? 3 * stride : 0, 0);
+        for (size_t i=0; i<n; ++i) {
+            const ofVec3f& v = bind_mesh.getVertices()[i];
+            bind_positions[i] = v.x;
+            bind_positions[stride + i] = v.y;
+            bind_positions[2 * stride + i] = v.z;
+            if (has_normals) {
+                const ofVec3f& nv = bind_mesh.getNormals()[i];
+                bind_normals[i] = nv.x;
+                bind_normals[stride + i] = nv.y;
+                bind_normals[2 * stride + i] = nv.z;
+            }
+        }
+        
+        // heaviest influences first, so trailing slots that are zero for every vertex can be dropped
+        vector<pair<float, uint16_t> > sorted(influences_per_vertex);
+        vector<pair<float, uint16_t> > kept(n * MAX_INFLUENCES);
+        num_influences = 1;
+        for (size_t i=0; i<n; ++i) {
+            for (int k=0; k<influences_per_vertex; ++k) {
+                sorted[k] = make_pair(max(weights[i * influences_per_vertex + k], 0.f), bones[i * influences_per_vertex + k]);
+            }
+            sort(sorted.begin(), sorted.end(), [](const pair<float, uint16_t>& a, const pair<float, uint16_t>& b) {
+                return a.first > b.first;
+            });
+            const int count = min(influences_per_vertex, int(MAX_INFLUENCES));
+            float sum = 0;
+            for (int k=0; k<count; ++k) {
+                sum += sorted[k].first;
+            }
+            for (int k=0; k<count; ++k) {
+                // a vertex with no weight follows its first bone rigidly
+                const float w = sum > 0 ? sorted[k].first / sum : (k == 0 ? 1 : 0);
+                kept[i * MAX_INFLUENCES + k] = make_pair(w, sorted[k].second);
+                if (w > 0) {
+                    num_influences = max(num_influences, k + 1);
+                }
+            }
+        }
+        bone_indices.assign(num_influences * stride, 0);
+        bone_weights.assign(num_influences * stride, 0);
+        for (size_t i=0; i<n; ++i) {
+            for (int k=0; k<num_influences; ++k) {
+                bone_weights[k * stride + i] = kept[i * MAX_INFLUENCES + k].first;
+                bone_indices[k * stride + i] = kept[i * MAX_INFLUENCES + k].second;
+            }
+        }
+        
+        // the rest pose has no rotation, so each joint's global transform is
+        // the sum of the offsets down to it and its inverse is the negation
+        const int num_joints = hierarchy.getNumJoints();
+        vector<ofVec3f> rest(num_joints);
+        inverse_bind.resize(num_joints);
+        for (int j=0; j<num_joints; ++j) {
+            const int parent = hierarchy.getParent(j);
+            rest[j] = hierarchy.getInitialOffset(j) + (parent < 0 ? ofVec3f() : rest[parent]);
+            inverse_bind[j].makeTranslationMatrix(-rest[j]);
+        }
+        skin_matrices.assign(num_joints * ofxBvhKernels::SOA_COMPONENTS, 0);
+        
+        mesh = bind_mesh;
+        mesh.setUsage(GL_STREAM_DRAW);
+        num_vertices = n;
+        return true;
+    }
+    
+    void SkinnedMesh::setBindPose(const vector<ofMatrix4x4>& bind_globals)
+    {
+        const size_t n = min(bind_globals.size(), inverse_bind.size());
+        for (size_t j=0; j<n; ++j) {
+            inverse_bind[j] = bind_globals[j].getInverse();
+        }
+    }
+    
+    void SkinnedMesh::update(const Skeleton& skeleton)
+    {
+        setPose(skeleton);
+        skin(0, num_vertices);
+    }
+    
+    void SkinnedMesh::setPose(const Skeleton& skeleton)
+    {
+        const auto& joints = skeleton.getJoints();
+        const size_t n = min(joints.size(), inverse_bind.size());
+        for (size_t j=0; j<n; ++j) {
+            setSkinMatrix(j, joints[j].getGlobalTransform());
+        }
+        mesh_vertices = mesh.getVertices().data();
+        mesh_normals = has_normals ? mesh.getNormals().data() : nullptr;
+    }
+    
+    void SkinnedMesh::setPose(const ofMatrix4x4* globals, size_t num_joints)
+    {
+        const size_t n = min(num_joints, inverse_bind.size());
+        for (size_t j=0; j<n; ++j) {
+            setSkinMatrix(j, globals[j]);
+        }
+        mesh_vertices = mesh.getVertices().data();
+        mesh_normals = has_normals ? mesh.getNormals().data() : nullptr;
+    }
+    
+    void SkinnedMesh::setSkinMatrix(size_t joint, const ofMatrix4x4& global)
+    {
+        float g[16];
+        ofxBvhKernels::composeAffine(g, inverse_bind[joint].getPtr(), global.getPtr());
+        float* m = &skin_matrices[joint * ofxBvhKernels::SOA_COMPONENTS];
+        for (int r=0; r<3; ++r) {
+            m[r * 3 + 0] = g[r * 4 + 0];
+            m[r * 3 + 1] = g[r * 4 + 1];
+            m[r * 3 + 2] = g[r * 4 + 2];
+        }
+        m[9] = g[12];
+        m[10] = g[13];
+        m[11] = g[14];
+    }
+    
+    void SkinnedMesh::skin(size_t begin, size_t end)
+    {
+        end = min(end, num_vertices);
+        if (begin >= end || !mesh_vertices) {
+            return;
+        }
+        ofxBvhKernels::skinLinearBlendSoA(skin_matrices.data(), bone_indices.data() + begin, bone_weights.data() + begin,
+                                          num_influences, bind_positions.data() + begin, out_positions.data() + begin,
+                                          has_normals ? bind_normals.data() + begin : nullptr,
+                                          has_normals ? out_normals.data() + begin : nullptr, stride, end - begin);
+        
+        const float* x = out_positions.data();
+        const float* y = x + stride;
+        const float* z = y + stride;
+        for (size_t i=begin; i<end; ++i) {
+            mesh_vertices[i].set(x[i], y[i], z[i]);
+        }
+        if (mesh_normals) {
+            const float* nx = out_normals.data();
+            const float* ny = nx + stride;
+            const float* nz = ny + stride;
+            for (size_t i=begin; i<end; ++i) {
+                mesh_normals[i].set(nx[i], ny[i], nz[i]);
+                mesh_normals[i].normalize();
+            }
+        }
+    }
+}
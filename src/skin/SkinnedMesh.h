@@ -0,0 +1,82 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxBvhHierarchy.h"
+
+namespace ofxPerceptionNeuron
+{
+    class Skeleton;
+    
+    // A mesh bound to a skeleton and deformed on the CPU by linear blend skinning.
+    // Bones are joint indices in hierarchy order, i.e. as Skeleton::getJoints()
+    // numbers them (NeuronSkeleton order for the Axis Neuron template).
+    // Bind data is kept as structure of arrays so ofxBvhKernels can skin
+    // several vertices per instruction; the result is written in place into a
+    // persistent ofVboMesh, so skinning doesn't allocate after setup().
+    //
+    // update() does everything on the calling thread. To split the work,
+    // setPose() once, then skin() disjoint vertex ranges from any threads,
+    // as SkinningPool does.
+    class SkinnedMesh
+    {
+    public:
+        static const int MAX_INFLUENCES = 4;
+        
+        // bind_mesh is in the hierarchy's rest pose: no rotation, every joint
+        // at its offset. bones and weights hold influences_per_vertex entries
+        // per vertex, vertex after vertex. Weights are normalized; beyond
+        // MAX_INFLUENCES the heaviest are kept. Returns false if a bone
+        // isn't in the hierarchy or the arrays are too short.
+        bool setup(const ofMesh& bind_mesh, const vector<uint16_t>& bones, const vector<float>& weights,
+                   int influences_per_vertex, const ofxBvhHierarchy& hierarchy);
+        // replaces the inverse bind matrices for a mesh bound in another pose,
+        // given each joint's global transform in that pose; joints past the
+        // end of bind_globals keep the rest pose. Call after setup().
+        void setBindPose(const vector<ofMatrix4x4>& bind_globals);
+        
+        // setPose() and skin() of every vertex
+        void update(const Skeleton& skeleton);
+        
+        // bone matrices for the pose; num_joints must cover every bone
+        void setPose(const Skeleton& skeleton);
+        void setPose(const ofMatrix4x4* globals, size_t num_joints);
+        // skins vertices [begin, end) with the last pose
+        void skin(size_t begin, size_t end);
+        
+        bool isSetup() const { return num_vertices > 0; }
+        size_t getNumVertices() const { return num_vertices; }
+        // largest number of bones any vertex uses
+        int getNumInfluences() const { return num_influences; }
+        const ofMatrix4x4& getInverseBindMatrix(int joint) const { return inverse_bind[joint]; }
+        
+        // the bind mesh with skinned vertices and normals
+        const ofVboMesh& getMesh() const { return mesh; }
+        ofVboMesh& getMesh() { return mesh; }
+    
+    protected:
+        enum { LANES = 8 }; // widest SIMD batch, for the SoA stride
+        
+        size_t num_vertices = 0;
+        size_t stride = 0;
+        int num_influences = 0;
+        bool has_normals = false;
+        
+        // component c of vertex i at [c * stride + i]
+        vector<float> bind_positions, bind_normals;
+        vector<float> out_positions, out_normals;
+        // influence k of vertex i at [k * stride + i]
+        vector<uint16_t> bone_indices;
+        vector<float> bone_weights;
+        
+        vector<ofMatrix4x4> inverse_bind;
+        // per joint, affine part of inverse bind * global (ofxBvhKernels::SOA_COMPONENTS each)
+        vector<float> skin_matrices;
+        
+        ofVboMesh mesh;
+        // taken from mesh in setPose() so skin() can run on other threads
+        ofVec3f* mesh_vertices = nullptr;
+        ofVec3f* mesh_normals = nullptr;
+        
+        void setSkinMatrix(size_t joint, const ofMatrix4x4& global);
+    };
+}
@@ -0,0 +1,94 @@
+#include "SkinningPool.h"
+
+#include "SkinnedMesh.h"
+
+namespace ofxPerceptionNeuron
+{
+    SkinningPool::SkinningPool(int num_workers) : next_job(0)
+    {
+        if (num_workers < 0) {
+            num_workers = int(std::max(1u, std::thread::hardware_concurrency())) - 1;
+        }
+        for (int i=0; i<num_workers; ++i) {
+            workers.push_back(std::thread(&SkinningPool::threadedFunction, this));
+        }
+    }
+    
+    SkinningPool::~SkinningPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : workers) {
+            t.join();
+        }
+    }
+    
+    void SkinningPool::add(SkinnedMesh& mesh, const Skeleton& skeleton)
+    {
+        mesh.setPose(skeleton);
+        add(mesh);
+    }
+    
+    void SkinningPool::add(SkinnedMesh& mesh)
+    {
+        const size_t n = mesh.getNumVertices();
+        for (size_t begin=0; begin<n; begin+=chunk_size) {
+            jobs.push_back(Job{&mesh, begin, std::min(begin + chunk_size, n)});
+        }
+    }
+    
+    void SkinningPool::run()
+    {
+        if (jobs.empty()) {
+            return;
+        }
+        next_job.store(0, std::memory_order_relaxed);
+        // waking threads costs more than a small job, so only when there's more than one
+        if (!workers.empty() && jobs.size() > 1) {
+            std::unique_lock<std::mutex> lock(mutex);
+            busy = int(workers.size());
+            ++generation;
+            lock.unlock();
+            wake.notify_all();
+            work();
+            lock.lock();
+            finished.wait(lock, [this]() { return busy == 0; });
+        } else {
+            work();
+        }
+        jobs.clear();
+    }
+    
+    void SkinningPool::work()
+    {
+        for (;;) {
+            const size_t i = next_job.fetch_add(1, std::memory_order_relaxed);
+            if (i >= jobs.size()) {
+                return;
+            }
+            jobs[i].mesh->skin(jobs[i].begin, jobs[i].end);
+        }
+    }
+    
+    void SkinningPool::threadedFunction()
+    {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            lock.unlock();
+            work();
+            lock.lock();
+            if (--busy == 0) {
+                finished.notify_one();
+            }
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ofxPerceptionNeuron
+{
+    class Skeleton;
+    class SkinnedMesh;
+    
+    // Skins many meshes at once on a fixed set of worker threads.
+    // Each frame, add() every mesh with its skeleton, then run(). Meshes are
+    // cut into jobs of at most getChunkSize() vertices, so one large avatar
+    // spreads over every thread as well as many small ones. The workers sleep
+    // between frames and nothing is allocated once the job list has grown.
+    // Use from one thread.
+    class SkinningPool
+    {
+    public:
+        // worker threads in addition to the caller of run(); -1 uses one per core
+        explicit SkinningPool(int num_workers = -1);
+        ~SkinningPool();
+        
+        // poses mesh on the calling thread and queues its vertices
+        void add(SkinnedMesh& mesh, const Skeleton& skeleton);
+        // queues a mesh already posed with SkinnedMesh::setPose()
+        void add(SkinnedMesh& mesh);
+        // skins everything added since the last run(), helping on the calling
+        // thread, and returns once it's all done
+        void run();
+        
+        int getNumWorkers() const { return int(workers.size()); }
+        void setChunkSize(size_t vertices) { chunk_size = std::max<size_t>(vertices, 64); }
+        size_t getChunkSize() const { return chunk_size; }
+    
+    protected:
+        struct Job
+        {
+            SkinnedMesh* mesh;
+            size_t begin, end;
+        };
+        
+        void threadedFunction();
+        void work();
+        
+        std::vector<Job> jobs;
+        size_t chunk_size = 4096;
+        std::atomic<size_t> next_job;
+        
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wake; // workers wait for a new generation
+        std::condition_variable finished; // run() waits for busy to reach 0
+        uint64_t generation = 0;
+        int busy = 0;
+        bool stopping = false;
+    };
+}
@@ -0,0 +1,588 @@
+#include "StreamClient.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace ofxPerceptionNeuron
+{
+    static const int POLL_TIMEOUT_MS = 100;
+    static const int RECONNECT_INTERVAL_MS = 500;
+    static const size_t DATAGRAM_SIZE = StreamDecoder::MAX_PACKET_SIZE;
+    static const int UDP_RECEIVE_BUFFER = 1 << 20;
+    
+    static uint64_t steadyNow()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+    struct StreamClient::Source
+    {
+        StreamClient* owner = nullptr;
+        int id = 0;
+        std::string ip;
+        int port = 0;
+        bool udp = false;
+        
+        // receive thread only
+        int fd = -1;
+        bool connecting = false;
+        int next_address = 0; // tried in turn, one per attempt
+        uint64_t retry_at = 0;
+        StreamDecoder decoder;
+        uint64_t receive_time = 0; // of the bytes being decoded
+        std::unique_ptr<uint8_t[]> datagrams; // UDP_BATCH * DATAGRAM_SIZE
+        
+        // written by the receive thread, read by getSourceStatus()
+        std::atomic<int> status;
+        std::atomic<uint64_t> num_connects;
+        std::atomic<uint64_t> num_bytes;
+        std::atomic<uint64_t> num_datagrams;
+        std::atomic<uint64_t> num_packets;
+        std::atomic<uint64_t> num_skipped_bytes;
+        std::atomic<uint64_t> last_receive_time;
+        
+        Source() : status(CS_OffWork), num_connects(0), num_bytes(0), num_datagrams(0), num_packets(0), num_skipped_bytes(0), last_receive_time(0) {}
+    };
+
+#pragma mark - Poller
+    // readiness notification over the sources' sockets
+    class StreamClient::Poller
+    {
+    public:
+        enum
+        {
+            READ = 1,
+            WRITE = 2
+        };
+        
+        struct Event
+        {
+            Source* source;
+            bool error;
+        };
+
+#ifdef __linux__
+        Poller() : epfd(epoll_create1(EPOLL_CLOEXEC)) {}
+        ~Poller() { ::close(epfd); }
+        
+        void add(Source& s, int events) { control(EPOLL_CTL_ADD, s, events); }
+        void modify(Source& s, int events) { control(EPOLL_CTL_MOD, s, events); }
+        void remove(Source& s) { epoll_ctl(epfd, EPOLL_CTL_DEL, s.fd, nullptr); }
+        
+        int wait(Event* out, int max, int timeout_ms)
+        {
+            epoll_event events[MAX_SOURCES];
+            const int n = epoll_wait(epfd, events, std::min(max, int(MAX_SOURCES)), timeout_ms);
+            for (int i=0; i<n; ++i) {
+                out[i].source = static_cast<Source*>(events[i].data.ptr);
+                out[i].error = (events[i].events & (EPOLLERR | EPOLLHUP)) && !(events[i].events & EPOLLIN);
+            }
+            return std::max(n, 0);
+        }
+    
+    protected:
+        int epfd;
+        
+        void control(int op, Source& s, int events)
+        {
+            epoll_event e;
+            memset(&e, 0, sizeof(e));
+            e.events = (events & READ ? uint32_t(EPOLLIN) : 0u) | (events & WRITE ? uint32_t(EPOLLOUT) : 0u);
+            e.data.ptr = &s;
+            epoll_ctl(epfd, op, s.fd, &e);
+        }
+#else
+        void add(Source& s, int events)
+        {
+            fds.push_back(pollfd());
+            fds.back().fd = s.fd;
+            sources.push_back(&s);
+            modify(s, events);
+        }
+        
+        void modify(Source& s, int events)
+        {
+            for (auto& p : fds) {
+                if (p.fd == s.fd) {
+                    p.events = (events & READ ? POLLIN : 0) | (events & WRITE ? POLLOUT : 0);
+                }
+            }
+        }
+        
+        void remove(Source& s)
+        {
+            for (size_t i=0; i<fds.size(); ++i) {
+                if (fds[i].fd == s.fd) {
+                    fds.erase(fds.begin() + i);
+                    sources.erase(sources.begin() + i);
+                    return;
+                }
+            }
+        }
+        
+        int wait(Event* out, int max, int timeout_ms)
+        {
+            if (fds.empty()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+                return 0;
+            }
+            if (poll(fds.data(), fds.size(), timeout_ms) <= 0) {
+                return 0;
+            }
+            int n = 0;
+            for (size_t i=0; i<fds.size() && n<max; ++i) {
+                if (fds[i].revents) {
+                    out[n].source = sources[i];
+                    out[n].error = (fds[i].revents & (POLLERR | POLLHUP)) && !(fds[i].revents & POLLIN);
+                    ++n;
+                }
+            }
+            return n;
+        }
+    
+    protected:
+        std::vector<pollfd> fds;
+        std::vector<Source*> sources;
+#endif
+    };
+
+#pragma mark - StreamClient
+    StreamClient::StreamClient() : num_sources(0), running(false)
+    {
+    }
+    
+    StreamClient::~StreamClient()
+    {
+        close();
+    }
+    
+    void StreamClient::setBvhFrameHandler(BvhFrameHandler handler, void* user)
+    {
+        bvh_handler = handler;
+        bvh_user = user;
+    }
+    
+    void StreamClient::setCalcFrameHandler(CalcFrameHandler handler, void* user)
+    {
+        calc_handler = handler;
+        calc_user = user;
+    }
+    
+    void StreamClient::setStatusHandler(StatusHandler handler, void* user)
+    {
+        status_handler = handler;
+        status_user = user;
+    }
+    
+    int StreamClient::connect(const std::string& ip, int port)
+    {
+        return addSource(ip, port, false);
+    }
+    
+    int StreamClient::listenUdp(int port, const std::string& ip)
+    {
+        return addSource(ip, port, true);
+    }
+    
+    int StreamClient::addSource(const std::string& ip, int port, bool udp)
+    {
+        const size_t n = num_sources.load(std::memory_order_relaxed);
+        if (n >= MAX_SOURCES) {
+            return -1;
+        }
+        Source* s = new Source();
+        s->owner = this;
+        s->id = int(n);
+        s->ip = ip;
+        s->port = port;
+        s->udp = udp;
+        s->decoder.setBvhFrameHandler(bvhFrameReceived, s);
+        s->decoder.setCalcFrameHandler(calcFrameReceived, s);
+        sources[n].reset(s);
+        setStatus(*s, CS_Starting, "connecting");
+        // the receive thread picks the new source up on its next wakeup
+        num_sources.store(n + 1, std::memory_order_release);
+        
+        if (!isOpen()) {
+            running = true;
+            thread = std::thread(&StreamClient::threadedFunction, this);
+        }
+        return s->id;
+    }
+    
+    void StreamClient::close()
+    {
+        running = false;
+        if (thread.joinable()) {
+            thread.join();
+        }
+        const size_t n = num_sources.load(std::memory_order_relaxed);
+        for (size_t i=0; i<n; ++i) {
+            if (sources[i]->status.load() != CS_OffWork) {
+                setStatus(*sources[i], CS_OffWork, "closed");
+            }
+            sources[i].reset();
+        }
+        num_sources.store(0, std::memory_order_release);
+    }
+    
+    SocketStatus StreamClient::getStatus() const
+    {
+        SocketStatus result = CS_OffWork;
+        const size_t n = num_sources.load(std::memory_order_acquire);
+        for (size_t i=0; i<n; ++i) {
+            const int s = sources[i]->status.load(std::memory_order_relaxed);
+            if (s == CS_Running) {
+                return CS_Running;
+            }
+            if (s == CS_Starting) {
+                result = CS_Starting;
+            }
+        }
+        return result;
+    }
+    
+    SourceStatus StreamClient::getSourceStatus(int source) const
+    {
+        SourceStatus status;
+        if (source < 0 || source >= getNumSources()) {
+            return status;
+        }
+        const Source& s = *sources[source];
+        status.ip = s.ip;
+        status.port = s.port;
+        status.udp = s.udp;
+        status.status = SocketStatus(s.status.load(std::memory_order_relaxed));
+        status.num_connects = s.num_connects.load(std::memory_order_relaxed);
+        status.num_bytes = s.num_bytes.load(std::memory_order_relaxed);
+        status.num_datagrams = s.num_datagrams.load(std::memory_order_relaxed);
+        status.num_packets = s.num_packets.load(std::memory_order_relaxed);
+        status.num_skipped_bytes = s.num_skipped_bytes.load(std::memory_order_relaxed);
+        status.last_receive_time = s.last_receive_time.load(std::memory_order_relaxed);
+        return status;
+    }
+    
+    bool StreamClient::isUdp(int source) const
+    {
+        return source >= 0 && source < getNumSources() && sources[source]->udp;
+    }
+    
+    void StreamClient::setStatus(Source& s, SocketStatus status, const char* message)
+    {
+        s.status = status;
+        if (status_handler) {
+            status_handler(status_user, s.id, status, message);
+        }
+    }
+    
+    void StreamClient::bvhFrameReceived(void* user, const BvhDataHeader* header, const float* data)
+    {
+        const Source* s = static_cast<const Source*>(user);
+        if (s->owner->bvh_handler) {
+            s->owner->bvh_handler(s->owner->bvh_user, s->id, s->receive_time, header, data);
+        }
+    }
+    
+    void StreamClient::calcFrameReceived(void* user, const CalcDataHeader* header, const float* data)
+    {
+        const Source* s = static_cast<const Source*>(user);
+        if (s->owner->calc_handler) {
+            s->owner->calc_handler(s->owner->calc_user, s->id, s->receive_time, header, data);
+        }
+    }
+    
+    // starts a non-blocking connect; completion is reported by the poller
+    void StreamClient::openSocket(Source& s)
+    {
+        if (s.udp) {
+            openUdpSocket(s);
+            return;
+        }
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        
+        addrinfo* res = nullptr;
+        const std::string service = std::to_string(s.port);
+        if (getaddrinfo(s.ip.c_str(), service.c_str(), &hints, &res) != 0) {
+            s.retry_at = steadyNow() + RECONNECT_INTERVAL_MS * 1000000ull;
+            return;
+        }
+        int num_addresses = 0;
+        for (addrinfo* ai = res; ai != nullptr; ai = ai->ai_next) {
+            ++num_addresses;
+        }
+        addrinfo* ai = res;
+        for (int i = s.next_address++ % num_addresses; i > 0; --i) {
+            ai = ai->ai_next;
+        }
+        
+        int r = -1;
+        const int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+            r = ::connect(fd, ai->ai_addr, ai->ai_addrlen);
+        }
+        freeaddrinfo(res);
+        
+        if (r < 0 && errno != EINPROGRESS) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            s.retry_at = steadyNow() + RECONNECT_INTERVAL_MS * 1000000ull;
+            return;
+        }
+        s.fd = fd;
+        s.connecting = true;
+        poller->add(s, Poller::WRITE);
+        if (r == 0) {
+            finishConnect(s);
+        }
+    }
+    
+    void StreamClient::finishConnect(Source& s)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(s.fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+            closeSocket(s, nullptr);
+            return;
+        }
+        s.connecting = false;
+        s.decoder.reset();
+        poller->modify(s, Poller::READ);
+        s.num_connects.fetch_add(1, std::memory_order_relaxed);
+        setStatus(s, CS_Running, "connected");
+    }
+    
+    // message is null for a failed connect, which leaves the status alone
+    void StreamClient::closeSocket(Source& s, const char* message)
+    {
+        if (s.fd >= 0) {
+            poller->remove(s);
+            ::close(s.fd);
+            s.fd = -1;
+        }
+        s.connecting = false;
+        s.retry_at = steadyNow() + RECONNECT_INTERVAL_MS * 1000000ull;
+        if (message) {
+            setStatus(s, CS_Starting, message);
+        } else if (s.status.load() != CS_Starting) {
+            setStatus(s, CS_Starting, "reconnecting");
+        }
+    }
+    
+    void StreamClient::openUdpSocket(Source& s)
+    {
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_flags = AI_PASSIVE;
+        
+        addrinfo* res = nullptr;
+        const std::string service = std::to_string(s.port);
+        int fd = -1;
+        if (getaddrinfo(s.ip.empty() ? nullptr : s.ip.c_str(), service.c_str(), &hints, &res) == 0) {
+            fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+            if (fd >= 0) {
+                int one = 1;
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+                // room for a stall of the receive thread without the kernel dropping datagrams
+                int size = UDP_RECEIVE_BUFFER;
+                setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+#ifdef SO_TIMESTAMPNS
+                setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+#endif
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+                if (bind(fd, res->ai_addr, res->ai_addrlen) != 0) {
+                    ::close(fd);
+                    fd = -1;
+                }
+            }
+            freeaddrinfo(res);
+        }
+        if (fd < 0) {
+            s.retry_at = steadyNow() + RECONNECT_INTERVAL_MS * 1000000ull;
+            if (s.status.load() != CS_Starting) {
+                setStatus(s, CS_Starting, "retrying");
+            }
+            return;
+        }
+        
+        if (!s.datagrams) {
+            s.datagrams.reset(new uint8_t[UDP_BATCH * DATAGRAM_SIZE]);
+        }
+        s.fd = fd;
+        poller->add(s, Poller::READ);
+        s.num_connects.fetch_add(1, std::memory_order_relaxed);
+        setStatus(s, CS_Running, "listening");
+    }
+    
+    // Drains the socket a batch of datagrams per call. Each datagram holds
+    // whole packets and is decoded where it landed.
+    void StreamClient::receiveDatagrams(Source& s)
+    {
+        for (;;) {
+#ifdef __linux__
+            mmsghdr messages[UDP_BATCH];
+            iovec iovs[UDP_BATCH];
+            // cmsg space for one timespec, aligned as the kernel expects
+            union { cmsghdr align; char data[CMSG_SPACE(sizeof(timespec))]; } controls[UDP_BATCH];
+            memset(messages, 0, sizeof(messages));
+            for (int i=0; i<UDP_BATCH; ++i) {
+                iovs[i].iov_base = s.datagrams.get() + i * DATAGRAM_SIZE;
+                iovs[i].iov_len = DATAGRAM_SIZE;
+                messages[i].msg_hdr.msg_iov = &iovs[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+                messages[i].msg_hdr.msg_control = controls[i].data;
+                messages[i].msg_hdr.msg_controllen = sizeof(controls[i].data);
+            }
+            const int n = recvmmsg(s.fd, messages, UDP_BATCH, MSG_DONTWAIT, nullptr);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            
+            // kernel timestamps are wall clock; move them onto the steady clock.
+            // The offset is re-read per batch, so a clock step between batches
+            // could move a later datagram before an earlier one: arrival times
+            // are clamped to the last one, as history lookups need them ordered
+            const uint64_t steady = steadyNow();
+            timespec wall;
+            clock_gettime(CLOCK_REALTIME, &wall);
+            const int64_t wall_minus_steady = int64_t(wall.tv_sec * 1000000000ull + wall.tv_nsec) - int64_t(steady);
+            
+            for (int i=0; i<n; ++i) {
+                uint64_t arrival_time = steady;
+                msghdr& h = messages[i].msg_hdr;
+                for (cmsghdr* c = CMSG_FIRSTHDR(&h); c != nullptr; c = CMSG_NXTHDR(&h, c)) {
+                    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+                        timespec t;
+                        memcpy(&t, CMSG_DATA(c), sizeof(t));
+                        const int64_t arrival = int64_t(t.tv_sec * 1000000000ull + t.tv_nsec) - wall_minus_steady;
+                        arrival_time = std::min(uint64_t(std::max<int64_t>(arrival, 0)), steady);
+                    }
+                }
+                s.receive_time = std::max(arrival_time, s.receive_time);
+                s.num_bytes.fetch_add(messages[i].msg_len, std::memory_order_relaxed);
+                s.decoder.decodeDatagram(static_cast<const uint8_t*>(iovs[i].iov_base), messages[i].msg_len);
+            }
+#else
+            const int n = 1;
+            const ssize_t size = recv(s.fd, s.datagrams.get(), DATAGRAM_SIZE, 0);
+            if (size < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            s.receive_time = steadyNow();
+            s.num_bytes.fetch_add(size, std::memory_order_relaxed);
+            s.decoder.decodeDatagram(s.datagrams.get(), size);
+#endif
+            s.num_datagrams.fetch_add(n, std::memory_order_relaxed);
+            s.last_receive_time.store(s.receive_time, std::memory_order_relaxed);
+            s.num_packets.store(s.decoder.getNumPackets(), std::memory_order_relaxed);
+            s.num_skipped_bytes.store(s.decoder.getNumSkippedBytes(), std::memory_order_relaxed);
+            if (n < UDP_BATCH) {
+                return;
+            }
+        }
+    }
+    
+    // drains what the socket has, so one wakeup handles a burst
+    void StreamClient::receive(Source& s)
+    {
+        for (;;) {
+            const size_t writable = s.decoder.writable();
+            ssize_t n = recv(s.fd, s.decoder.writePtr(), writable, 0);
+            if (n > 0) {
+                s.receive_time = steadyNow();
+                s.last_receive_time.store(s.receive_time, std::memory_order_relaxed);
+                s.num_bytes.fetch_add(n, std::memory_order_relaxed);
+                s.decoder.commit(n);
+                s.num_packets.store(s.decoder.getNumPackets(), std::memory_order_relaxed);
+                s.num_skipped_bytes.store(s.decoder.getNumSkippedBytes(), std::memory_order_relaxed);
+                if (size_t(n) < writable) {
+                    return;
+                }
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            } else {
+                closeSocket(s, n == 0 ? "disconnected by server" : strerror(errno));
+                return;
+            }
+        }
+    }
+    
+    void StreamClient::threadedFunction()
+    {
+        poller.reset(new Poller());
+        Poller::Event events[MAX_SOURCES];
+        
+        while (running) {
+            const size_t n = num_sources.load(std::memory_order_acquire);
+            const uint64_t now = steadyNow();
+            for (size_t i=0; i<n; ++i) {
+                Source& s = *sources[i];
+                if (s.fd < 0 && now >= s.retry_at) {
+                    openSocket(s);
+                }
+            }
+            
+            const int num_events = poller->wait(events, MAX_SOURCES, POLL_TIMEOUT_MS);
+            for (int i=0; i<num_events; ++i) {
+                Source& s = *events[i].source;
+                if (s.fd < 0) {
+                    continue;
+                }
+                if (s.udp) {
+                    receiveDatagrams(s);
+                } else if (s.connecting) {
+                    finishConnect(s);
+                } else if (events[i].error) {
+                    closeSocket(s, "connection error");
+                } else {
+                    receive(s);
+                }
+            }
+        }
+        
+        const size_t n = num_sources.load(std::memory_order_acquire);
+        for (size_t i=0; i<n; ++i) {
+            Source& s = *sources[i];
+            if (s.fd >= 0) {
+                poller->remove(s);
+                ::close(s.fd);
+                s.fd = -1;
+            }
+        }
+        poller.reset();
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "DataType.h"
+#include "StreamDecoder.h"
+
+namespace ofxPerceptionNeuron
+{
+    // health of one server connection, see StreamClient::getSourceStatus
+    struct SourceStatus
+    {
+        std::string ip;
+        int port = 0;
+        bool udp = false;
+        SocketStatus status = CS_OffWork;
+        uint64_t num_connects = 0;
+        uint64_t num_bytes = 0;
+        uint64_t num_datagrams = 0; // UDP only
+        uint64_t num_packets = 0;
+        uint64_t num_skipped_bytes = 0; // resynchronizing after garbage
+        uint64_t last_receive_time = 0; // steady clock ns of the last bytes, 0 if none yet
+    };
+    
+    // Client for one or more Axis Neuron data streams, over TCP or UDP.
+    // A single receive thread multiplexes every connection (epoll on Linux,
+    // poll elsewhere), (re)connects them without blocking the others, reads
+    // into each source's decoder and dispatches frames from that thread
+    // tagged with the source they came from and their arrival time.
+    class StreamClient
+    {
+    public:
+        // timestamp is the arrival time in steady clock ns; for UDP on Linux
+        // the kernel's, so it excludes time spent queued before the read
+        typedef void (*BvhFrameHandler)(void* user, int source, uint64_t timestamp, const BvhDataHeader* header, const float* data);
+        typedef void (*CalcFrameHandler)(void* user, int source, uint64_t timestamp, const CalcDataHeader* header, const float* data);
+        typedef void (*StatusHandler)(void* user, int source, SocketStatus status, const char* message);
+        
+        static const int MAX_SOURCES = 8;
+        // datagrams read per system call
+        static const int UDP_BATCH = 16;
+        
+        StreamClient();
+        ~StreamClient();
+        
+        void setBvhFrameHandler(BvhFrameHandler handler, void* user);
+        void setCalcFrameHandler(CalcFrameHandler handler, void* user);
+        void setStatusHandler(StatusHandler handler, void* user);
+        
+        // adds a server and starts the receive thread if needed; returns the
+        // source id, or -1 if MAX_SOURCES are in use. Call from one thread only.
+        int connect(const std::string& ip, int port);
+        // adds a UDP port to receive on, on all interfaces unless ip is given
+        int listenUdp(int port, const std::string& ip = "");
+        // closes every connection and forgets the sources
+        void close();
+        
+        bool isOpen() const { return thread.joinable(); }
+        // CS_Running if any source is, CS_Starting if any is connecting
+        SocketStatus getStatus() const;
+        
+        int getNumSources() const { return int(num_sources.load(std::memory_order_acquire)); }
+        SourceStatus getSourceStatus(int source) const;
+        bool isUdp(int source) const;
+    
+    protected:
+        struct Source;
+        class Poller;
+        
+        void threadedFunction();
+        int addSource(const std::string& ip, int port, bool udp);
+        void openSocket(Source& s);
+        void openUdpSocket(Source& s);
+        void closeSocket(Source& s, const char* message);
+        void finishConnect(Source& s);
+        void receive(Source& s);
+        void receiveDatagrams(Source& s);
+        void setStatus(Source& s, SocketStatus status, const char* message);
+        static void bvhFrameReceived(void* user, const BvhDataHeader* header, const float* data);
+        static void calcFrameReceived(void* user, const CalcDataHeader* header, const float* data);
+        
+        std::unique_ptr<Source> sources[MAX_SOURCES];
+        std::atomic<size_t> num_sources;
+        std::unique_ptr<Poller> poller; // receive thread
+        
+        std::thread thread;
+        std::atomic<bool> running;
+        
+        BvhFrameHandler bvh_handler = nullptr;
+        void* bvh_user = nullptr;
+        CalcFrameHandler calc_handler = nullptr;
+        void* calc_user = nullptr;
+        StatusHandler status_handler = nullptr;
+        void* status_user = nullptr;
+    };
+}
@@ -0,0 +1,147 @@
+#include "StreamDecoder.h"
+
+#include <string.h>
+
+namespace ofxPerceptionNeuron
+{
+    static_assert(sizeof(BvhDataHeader) == 64, "BvhDataHeader must be 64 bytes");
+    static_assert(sizeof(CalcDataHeader) == 64, "CalcDataHeader must be 64 bytes");
+    
+    static inline uint16_t readToken(const uint8_t* p)
+    {
+        // the stream is little endian, as are all platforms Axis Neuron ships on
+        return uint16_t(p[0]) | (uint16_t(p[1]) << 8);
+    }
+    
+    StreamDecoder::StreamDecoder()
+    {
+        // over-allocate by a float so a packet ending exactly at BUFFER_SIZE is still addressable
+        buffer.reset(new uint8_t[BUFFER_SIZE + sizeof(float)]);
+    }
+    
+    void StreamDecoder::setBvhFrameHandler(BvhFrameHandler handler, void* user)
+    {
+        bvh_handler = handler;
+        bvh_user = user;
+    }
+    
+    void StreamDecoder::setCalcFrameHandler(CalcFrameHandler handler, void* user)
+    {
+        calc_handler = handler;
+        calc_user = user;
+    }
+    
+    void StreamDecoder::reset()
+    {
+        head = 0;
+        tail = 0;
+    }
+    
+    void StreamDecoder::commit(size_t n)
+    {
+        tail += n;
+        if (tail > BUFFER_SIZE) {
+            tail = BUFFER_SIZE;
+        }
+        parse();
+        compact();
+    }
+    
+    size_t StreamDecoder::packetLength(const uint8_t* p)
+    {
+        const uint16_t token = readToken(p);
+        size_t length = 0;
+        if (token == BVH_TOKEN_BEGIN) {
+            const BvhDataHeader* header = reinterpret_cast<const BvhDataHeader*>(p);
+            if (header->Token2 == BVH_TOKEN_END) {
+                length = sizeof(BvhDataHeader) + header->DataCount * sizeof(float);
+            }
+        } else if (token == CALC_TOKEN_BEGIN) {
+            const CalcDataHeader* header = reinterpret_cast<const CalcDataHeader*>(p);
+            if (header->Token2 == CALC_TOKEN_END &&
+                header->DataCount <= (MAX_PACKET_SIZE - sizeof(CalcDataHeader)) / sizeof(float)) {
+                length = sizeof(CalcDataHeader) + header->DataCount * sizeof(float);
+            }
+        }
+        return length > MAX_PACKET_SIZE ? 0 : length;
+    }
+    
+    void StreamDecoder::dispatch(const uint8_t* p)
+    {
+        const uint16_t token = readToken(p);
+        if (token == BVH_TOKEN_BEGIN && bvh_handler) {
+            const BvhDataHeader* header = reinterpret_cast<const BvhDataHeader*>(p);
+            const float* data = reinterpret_cast<const float*>(p + sizeof(BvhDataHeader));
+            bvh_handler(bvh_user, header, data);
+        } else if (token == CALC_TOKEN_BEGIN && calc_handler) {
+            const CalcDataHeader* header = reinterpret_cast<const CalcDataHeader*>(p);
+            const float* data = reinterpret_cast<const float*>(p + sizeof(CalcDataHeader));
+            calc_handler(calc_user, header, data);
+        }
+        ++num_packets;
+    }
+    
+    size_t StreamDecoder::parse()
+    {
+        size_t dispatched = 0;
+        while (tail - head >= sizeof(BvhDataHeader)) {
+            const uint8_t* p = buffer.get() + head;
+            const size_t length = packetLength(p);
+            
+            if (length == 0) {
+                // not at a packet boundary: skip ahead to the next candidate token byte
+                const void* next = memchr(p + 1, 0xFF, tail - head - 1);
+                size_t skip = next ? (static_cast<const uint8_t*>(next) - p) : (tail - head);
+                head += skip;
+                num_skipped_bytes += skip;
+                continue;
+            }
+            
+            if (tail - head < length) {
+                break;
+            }
+            
+            if (head % sizeof(float) != 0) {
+                // only happens after a resync; realign so the payload can be read as floats in place
+                compact();
+                continue;
+            }
+            
+            dispatch(p);
+            head += length;
+            ++dispatched;
+        }
+        return dispatched;
+    }
+    
+    size_t StreamDecoder::decodeDatagram(const uint8_t* data, size_t size)
+    {
+        size_t dispatched = 0;
+        size_t offset = 0;
+        while (size - offset >= sizeof(BvhDataHeader)) {
+            const size_t length = packetLength(data + offset);
+            if (length == 0 || length > size - offset || offset % sizeof(float) != 0) {
+                // datagrams carry whole packets; anything else is not worth resynchronizing
+                break;
+            }
+            dispatch(data + offset);
+            offset += length;
+            ++dispatched;
+        }
+        num_skipped_bytes += size - offset;
+        return dispatched;
+    }
+    
+    void StreamDecoder::compact()
+    {
+        if (head == 0) {
+            return;
+        }
+        const size_t remain = tail - head;
+        if (remain > 0) {
+            memmove(buffer.get(), buffer.get() + head, remain);
+        }
+        head = 0;
+        tail = remain;
+    }
+}
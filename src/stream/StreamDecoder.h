@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+
+#include "DataType.h"
+
+namespace ofxPerceptionNeuron
+{
+    // Incremental decoder for the Axis Neuron binary stream.
+    // Bytes are received straight into the decoder's own buffer (see
+    // writePtr()/writable()) and complete packets are dispatched from there,
+    // so decoding never copies or allocates per packet.
+    class StreamDecoder
+    {
+    public:
+        typedef void (*BvhFrameHandler)(void* user, const BvhDataHeader* header, const float* data);
+        typedef void (*CalcFrameHandler)(void* user, const CalcDataHeader* header, const float* data);
+        
+        enum
+        {
+            BVH_TOKEN_BEGIN = 0xDDFF,
+            BVH_TOKEN_END = 0xEEFF,
+            CALC_TOKEN_BEGIN = 0x88FF,
+            CALC_TOKEN_END = 0x99FF,
+        };
+        
+        static const size_t BUFFER_SIZE = 1 << 16;
+        static const size_t MAX_PACKET_SIZE = BUFFER_SIZE / 2;
+        
+        StreamDecoder();
+        
+        void setBvhFrameHandler(BvhFrameHandler handler, void* user);
+        void setCalcFrameHandler(CalcFrameHandler handler, void* user);
+        
+        uint8_t* writePtr() { return buffer.get() + tail; }
+        size_t writable() const { return BUFFER_SIZE - tail; }
+        
+        // Consume n bytes written at writePtr() and dispatch every complete packet.
+        void commit(size_t n);
+        // Dispatch the packets in one datagram, read in place. data must be
+        // float aligned; the decoder's own buffer is left untouched.
+        size_t decodeDatagram(const uint8_t* data, size_t size);
+        void reset();
+        
+        uint64_t getNumPackets() const { return num_packets; }
+        uint64_t getNumSkippedBytes() const { return num_skipped_bytes; }
+    
+    protected:
+        // length of the packet starting at p, or 0 if p is not a packet start
+        static size_t packetLength(const uint8_t* p);
+        void dispatch(const uint8_t* p);
+        size_t parse();
+        void compact();
+        
+        std::unique_ptr<uint8_t[]> buffer;
+        size_t head = 0;
+        size_t tail = 0;
+        
+        BvhFrameHandler bvh_handler = nullptr;
+        void* bvh_user = nullptr;
+        CalcFrameHandler calc_handler = nullptr;
+        void* calc_user = nullptr;
+        
+        uint64_t num_packets = 0;
+        uint64_t num_skipped_bytes = 0;
+    };
+}
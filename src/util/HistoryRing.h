@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace ofxPerceptionNeuron
+{
+    // Fixed-size ring of the most recent timestamped records, each a frame
+    // index and a fixed number of floats. One producer pushes; any number of
+    // readers search and copy records without ever blocking it. Every slot
+    // carries a sequence number (a seqlock), so a reader that raced with the
+    // producer overwriting a slot sees read() fail instead of torn data.
+    // Records are addressed by their absolute push count, and timestamps are
+    // kept in their own array so a binary search touches only those.
+    class HistoryRing
+    {
+    public:
+        HistoryRing() : head(0) {}
+        
+        // capacity is rounded up to a power of two; only safe while neither side is running
+        void allocate(size_t capacity, size_t record_size)
+        {
+            size_t n = 1;
+            while (n < capacity) {
+                n <<= 1;
+            }
+            mask = n - 1;
+            size = record_size;
+            slots.reset(new Slot[n]);
+            timestamps.reset(new std::atomic<uint64_t>[n]);
+            data.reset(new float[n * record_size]);
+            for (size_t i=0; i<n; ++i) {
+                slots[i].seq.store(0, std::memory_order_relaxed);
+                slots[i].frame_index.store(0, std::memory_order_relaxed);
+                timestamps[i].store(0, std::memory_order_relaxed);
+            }
+            head.store(0, std::memory_order_relaxed);
+        }
+        
+        bool isAllocated() const { return slots != nullptr; }
+        size_t capacity() const { return slots ? mask + 1 : 0; }
+        size_t getRecordSize() const { return size; }
+        
+        // producer side: n values, at most getRecordSize()
+        void push(uint64_t timestamp, uint32_t frame_index, const float* values, size_t n)
+        {
+            const uint64_t i = head.load(std::memory_order_relaxed);
+            Slot& s = slots[i & mask];
+            s.seq.store(2 * i + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            s.frame_index.store(frame_index, std::memory_order_relaxed);
+            timestamps[i & mask].store(timestamp, std::memory_order_relaxed);
+            memcpy(&data[(i & mask) * size], values, std::min(n, size) * sizeof(float));
+            s.seq.store(2 * i + 2, std::memory_order_release);
+            head.store(i + 1, std::memory_order_release);
+        }
+        
+        // readers: records [getBegin(), getEnd()) are retained, oldest first
+        uint64_t getEnd() const { return head.load(std::memory_order_acquire); }
+        uint64_t getBegin() const
+        {
+            const uint64_t end = getEnd();
+            return end > capacity() ? end - capacity() : 0;
+        }
+        
+        // Copies record i; false if it was never written or has been overwritten.
+        // values may be null to fetch only the timestamp and frame index.
+        bool read(uint64_t i, uint64_t& timestamp, uint32_t& frame_index, float* values) const
+        {
+            if (!slots) {
+                return false;
+            }
+            const Slot& s = slots[i & mask];
+            const uint64_t seq = s.seq.load(std::memory_order_acquire);
+            if (seq != 2 * i + 2) {
+                return false;
+            }
+            frame_index = s.frame_index.load(std::memory_order_relaxed);
+            timestamp = timestamps[i & mask].load(std::memory_order_relaxed);
+            if (values) {
+                memcpy(values, &data[(i & mask) * size], size * sizeof(float));
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return s.seq.load(std::memory_order_relaxed) == seq;
+        }
+        
+        // the newest record with a timestamp at or before t; false if t is
+        // older than everything retained
+        bool findAtOrBefore(uint64_t t, uint64_t& index) const
+        {
+            uint64_t lo = getBegin(), hi = getEnd();
+            if (lo == hi || getTimestamp(lo) > t) {
+                return false;
+            }
+            // invariant: timestamp(lo) <= t, and hi is past the answer
+            while (hi - lo > 1) {
+                const uint64_t mid = lo + (hi - lo) / 2;
+                if (getTimestamp(mid) <= t) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+            index = lo;
+            return true;
+        }
+    
+    protected:
+        struct Slot
+        {
+            std::atomic<uint64_t> seq; // 2i+1 while record i is written, 2i+2 once complete
+            std::atomic<uint32_t> frame_index;
+        };
+        
+        uint64_t getTimestamp(uint64_t i) const { return timestamps[i & mask].load(std::memory_order_relaxed); }
+        
+        std::unique_ptr<Slot[]> slots;
+        std::unique_ptr<std::atomic<uint64_t>[]> timestamps;
+        std::unique_ptr<float[]> data;
+        size_t mask = 0;
+        size_t size = 0;
+        std::atomic<uint64_t> head;
+    };
+}
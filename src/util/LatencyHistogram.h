@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ofxPerceptionNeuron
+{
+    // Log-linear (HDR style) histogram of non-negative integers, typically
+    // nanoseconds. Values below SUB_BUCKETS are counted exactly; above that
+    // every power of two is split into SUB_BUCKETS / 2 buckets, so any
+    // reported value is within 1 / 32 (about 3%) of the recorded one.
+    // Values at or above 2^MAX_BITS (about 18 minutes in ns) land in the top bucket.
+    class LatencyHistogram
+    {
+    public:
+        enum
+        {
+            SUB_BITS = 6,
+            SUB_BUCKETS = 1 << SUB_BITS,
+            HALF_BUCKETS = SUB_BUCKETS / 2,
+            MAX_BITS = 40,
+            NUM_BUCKETS = SUB_BUCKETS + (MAX_BITS - SUB_BITS) * HALF_BUCKETS
+        };
+        
+        static size_t bucketOf(uint64_t v)
+        {
+            if (v < SUB_BUCKETS) {
+                return size_t(v);
+            }
+            int bits = 64 - __builtin_clzll(v);
+            if (bits > MAX_BITS) {
+                return NUM_BUCKETS - 1;
+            }
+            const int shift = bits - SUB_BITS;
+            const size_t top = size_t(v >> shift); // [HALF_BUCKETS, SUB_BUCKETS)
+            return SUB_BUCKETS + (shift - 1) * HALF_BUCKETS + (top - HALF_BUCKETS);
+        }
+        
+        // the largest value counted in bucket i
+        static uint64_t highestOf(size_t i)
+        {
+            if (i < SUB_BUCKETS) {
+                return i;
+            }
+            const int shift = int((i - SUB_BUCKETS) / HALF_BUCKETS) + 1;
+            const uint64_t top = HALF_BUCKETS + (i - SUB_BUCKETS) % HALF_BUCKETS;
+            return ((top + 1) << shift) - 1;
+        }
+        
+        LatencyHistogram() : counts(NUM_BUCKETS, 0) {}
+        
+        void record(uint64_t v)
+        {
+            ++counts[bucketOf(v)];
+            if (total == 0 || v < min_value) {
+                min_value = v;
+            }
+            max_value = std::max(max_value, v);
+            sum += v;
+            ++total;
+        }
+        
+        void reset()
+        {
+            std::fill(counts.begin(), counts.end(), 0);
+            total = sum = min_value = max_value = 0;
+        }
+        
+        uint64_t getCount() const { return total; }
+        uint64_t getMin() const { return min_value; }
+        uint64_t getMax() const { return max_value; }
+        double getMean() const { return total ? double(sum) / total : 0; }
+        
+        // the value at or below which percentile (0-100) of the samples fall,
+        // to the histogram's precision and never above getMax()
+        uint64_t getValueAtPercentile(double percentile) const
+        {
+            if (total == 0) {
+                return 0;
+            }
+            const double clamped = std::min(std::max(percentile, 0.0), 100.0);
+            const uint64_t rank = std::max<uint64_t>(1, uint64_t(clamped / 100 * total + 0.5));
+            uint64_t seen = 0;
+            for (size_t i=0; i<counts.size(); ++i) {
+                seen += counts[i];
+                if (seen >= rank) {
+                    return std::min(std::max(highestOf(i), min_value), max_value);
+                }
+            }
+            return max_value;
+        }
+        
+        // number of samples above v, e.g. frames over a latency budget
+        uint64_t getCountAbove(uint64_t v) const
+        {
+            uint64_t n = 0;
+            for (size_t i=bucketOf(v) + 1; i<counts.size(); ++i) {
+                n += counts[i];
+            }
+            return n;
+        }
+        
+        const std::vector<uint64_t>& getCounts() const { return counts; }
+    
+    protected:
+        friend class ConcurrentLatencyHistogram;
+        std::vector<uint64_t> counts;
+        uint64_t total = 0;
+        uint64_t sum = 0;
+        uint64_t min_value = 0;
+        uint64_t max_value = 0;
+    };
+    
+    // LatencyHistogram with one writer thread and any number of readers.
+    // record() is a few relaxed loads and stores; readers take a copy with
+    // snapshot(), which may be a sample or two out of step with itself but
+    // never blocks the writer.
+    class ConcurrentLatencyHistogram
+    {
+    public:
+        ConcurrentLatencyHistogram() : counts(new std::atomic<uint64_t>[LatencyHistogram::NUM_BUCKETS])
+        {
+            for (size_t i=0; i<LatencyHistogram::NUM_BUCKETS; ++i) {
+                counts[i].store(0, std::memory_order_relaxed);
+            }
+            total.store(0, std::memory_order_relaxed);
+            sum.store(0, std::memory_order_relaxed);
+            min_value.store(UINT64_MAX, std::memory_order_relaxed);
+            max_value.store(0, std::memory_order_relaxed);
+        }
+        
+        // writer thread only
+        void record(uint64_t v)
+        {
+            increment(counts[LatencyHistogram::bucketOf(v)], 1);
+            if (v < min_value.load(std::memory_order_relaxed)) {
+                min_value.store(v, std::memory_order_relaxed);
+            }
+            if (v > max_value.load(std::memory_order_relaxed)) {
+                max_value.store(v, std::memory_order_relaxed);
+            }
+            increment(sum, v);
+            increment(total, 1);
+        }
+        
+        uint64_t getCount() const { return total.load(std::memory_order_relaxed); }
+        
+        void snapshot(LatencyHistogram& out) const
+        {
+            out.counts.resize(LatencyHistogram::NUM_BUCKETS);
+            out.total = 0;
+            for (size_t i=0; i<LatencyHistogram::NUM_BUCKETS; ++i) {
+                out.counts[i] = counts[i].load(std::memory_order_relaxed);
+                out.total += out.counts[i];
+            }
+            out.sum = sum.load(std::memory_order_relaxed);
+            out.min_value = out.total ? min_value.load(std::memory_order_relaxed) : 0;
+            out.max_value = max_value.load(std::memory_order_relaxed);
+        }
+    
+    protected:
+        static void increment(std::atomic<uint64_t>& a, uint64_t v)
+        {
+            a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        }
+        
+        std::unique_ptr<std::atomic<uint64_t>[]> counts;
+        std::atomic<uint64_t> total;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> min_value;
+        std::atomic<uint64_t> max_value;
+    };
+}
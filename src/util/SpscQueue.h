@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ofxPerceptionNeuron
+{
+    // Bounded wait-free single-producer/single-consumer queue.
+    // Elements are written and read in place: the producer fills the slot
+    // returned by beginPush() and commitPush()es it, the consumer reads
+    // front() and pop()s it. Slots are reused, so elements that own storage
+    // (e.g. vectors) stop allocating once every slot has been filled once.
+    // A full queue makes beginPush() fail instead of blocking.
+    template<typename T>
+    class SpscQueue
+    {
+    public:
+        explicit SpscQueue(size_t capacity = 0) { reset(capacity); }
+        
+        // capacity is rounded up to a power of two; only safe while neither side is running
+        void reset(size_t capacity)
+        {
+            size_t n = 1;
+            while (n < capacity) {
+                n <<= 1;
+            }
+            slots.reset(capacity > 0 ? new T[n] : nullptr);
+            mask = capacity > 0 ? n - 1 : 0;
+            count = capacity > 0 ? n : 0;
+            head.store(0, std::memory_order_relaxed);
+            tail.store(0, std::memory_order_relaxed);
+            head_cache = 0;
+            tail_cache = 0;
+        }
+        
+        size_t capacity() const { return count; }
+        // approximate when called while either side is running
+        size_t size() const
+        {
+            return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+        }
+        
+        // producer side: nullptr if the queue is full
+        T* beginPush()
+        {
+            const size_t h = head.load(std::memory_order_relaxed);
+            if (h - tail_cache >= count) {
+                tail_cache = tail.load(std::memory_order_acquire);
+                if (h - tail_cache >= count) {
+                    return nullptr;
+                }
+            }
+            return &slots[h & mask];
+        }
+        void commitPush()
+        {
+            head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+        
+        // consumer side: nullptr if the queue is empty
+        T* front()
+        {
+            const size_t t = tail.load(std::memory_order_relaxed);
+            if (t == head_cache) {
+                head_cache = head.load(std::memory_order_acquire);
+                if (t == head_cache) {
+                    return nullptr;
+                }
+            }
+            return &slots[t & mask];
+        }
+        void pop()
+        {
+            tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+        
+        // only safe while neither side is running, e.g. to preallocate slots
+        T& slot(size_t i) { return slots[i]; }
+    
+    protected:
+        std::unique_ptr<T[]> slots;
+        size_t mask = 0;
+        size_t count = 0;
+        
+        // each side keeps a cached copy of the other's index so the shared
+        // cache lines are only touched when the queue looks full or empty
+        char pad0[64];
+        std::atomic<size_t> head;
+        size_t tail_cache = 0; // producer
+        char pad1[64];
+        std::atomic<size_t> tail;
+        size_t head_cache = 0; // consumer
+        char pad2[64];
+    };
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+namespace ofxPerceptionNeuron
+{
+    // Wait-free single-producer/single-consumer triple buffer.
+    // The producer fills back() and publish()es it; the consumer calls
+    // update() to pick up the newest published slot as front(). Neither side
+    // ever blocks, and intermediate frames are overwritten rather than queued.
+    template<typename T>
+    class TripleBuffer
+    {
+    public:
+        TripleBuffer() : middle(2) {}
+        
+        // producer side
+        T& back() { return slots[back_index]; }
+        void publish()
+        {
+            back_index = middle.exchange(back_index | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+        }
+        
+        // consumer side
+        const T& front() const { return slots[front_index]; }
+        T& front() { return slots[front_index]; }
+        bool hasNew() const { return (middle.load(std::memory_order_relaxed) & FRESH) != 0; }
+        bool update()
+        {
+            if (!hasNew()) {
+                return false;
+            }
+            front_index = middle.exchange(front_index, std::memory_order_acq_rel) & INDEX_MASK;
+            return true;
+        }
+        
+        // only safe while neither side is running, e.g. to preallocate slots
+        T& slot(int i) { return slots[i]; }
+        
+    protected:
+        enum
+        {
+            INDEX_MASK = 0x3,
+            FRESH = 0x4,
+        };
+        
+        // indices are padded apart so producer and consumer don't share a cache line
+        T slots[3];
+        uint8_t back_index = 0;
+        char pad0[63];
+        std::atomic<uint8_t> middle;
+        char pad1[63];
+        uint8_t front_index = 1;
+    };
+}